@@ -0,0 +1,176 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <fin/fin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs every workload in a fresh context, warmup times and then reps times,
+// and reports the wall time of fin_ctx_eval_str as one JSON object per line:
+// {"bench":"calls","mode":"stack","reps":10,"median_ms":...,"p99_ms":...,...}
+// The compile workload is a generated source without a Main, so it is only
+// parsed and compiled. With -pool n a rep compiles the workload untimed, then
+// times BENCH_POOL_CALLS invocations of Main per worker on a fin_pool_t.
+
+#define BENCH_COMPILE_FUNCS 2000
+#define BENCH_POOL_CALLS    4
+
+typedef struct bench_t {
+    char  name[64];
+    char* src;
+} bench_t;
+
+static double bench_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static char* bench_read_file(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* buffer = (char*)malloc(size + 1);
+    size_t read = fread(buffer, 1, size, fp);
+    buffer[read] = '\0';
+    fclose(fp);
+    return buffer;
+}
+
+static char* bench_compile_src() {
+    static const char* func =
+        "struct V%d {\n"
+        "    int x;\n"
+        "    float y;\n"
+        "}\n"
+        "\n"
+        "int F%d(int a, int b) {\n"
+        "    int c = a * %d + b;\n"
+        "    V%d v = { c, 1.5 };\n"
+        "    while (c > 100) {\n"
+        "        c = c / 2 - v.x %% 3;\n"
+        "    }\n"
+        "    if (c < a)\n"
+        "        return F%d(c, b - 1);\n"
+        "    return c + math.Abs(b);\n"
+        "}\n"
+        "\n";
+    size_t size = BENCH_COMPILE_FUNCS * (strlen(func) + 32) + 1;
+    char* src = (char*)malloc(size);
+    size_t len = 0;
+    for (int32_t i=0; i<BENCH_COMPILE_FUNCS; i++)
+        len += snprintf(src + len, size - len, func, i, i, i, i, i ? i - 1 : 0);
+    return src;
+}
+
+static int bench_compare(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double bench_pool(fin_ctx_t* ctx, const char* src, int32_t workers) {
+    fin_mod_t* mod = fin_ctx_compile_str(ctx, src);
+    fin_mod_func_t* entry = mod ? fin_ctx_find_func(ctx, mod, "Main()") : NULL;
+    fin_pool_t* pool = entry ? fin_pool_create(ctx, workers) : NULL;
+    if (!pool)
+        return 0.0;
+    double start = bench_now_ms();
+    for (int32_t i=0; i<workers * BENCH_POOL_CALLS; i++)
+        fin_pool_submit(pool, entry, NULL, NULL);
+    fin_pool_wait(pool);
+    double end = bench_now_ms();
+    fin_pool_destroy(pool);
+    return end - start;
+}
+
+static void bench_run(bench_t* bench, fin_ctx_config_t* config, const char* mode, int32_t warmup, int32_t reps, int32_t workers) {
+    double* times = (double*)malloc(sizeof(double) * reps);
+    for (int32_t i=-warmup; i<reps; i++) {
+        fin_ctx_t* ctx = fin_ctx_create_config(config);
+        double time = 0.0;
+        if (workers)
+            time = bench_pool(ctx, bench->src, workers);
+        else {
+            double start = bench_now_ms();
+            fin_ctx_eval_str(ctx, bench->src);
+            time = bench_now_ms() - start;
+        }
+        fin_ctx_destroy(ctx);
+        if (i >= 0)
+            times[i] = time;
+    }
+    qsort(times, reps, sizeof(double), &bench_compare);
+    int32_t p99 = (reps * 99 + 99) / 100 - 1;
+    printf("{\"bench\":\"%s\",\"mode\":\"%s\",\"workers\":%d,\"reps\":%d,\"median_ms\":%.3f,\"p99_ms\":%.3f,\"min_ms\":%.3f,\"max_ms\":%.3f}\n",
+           bench->name, mode, workers, reps,
+           reps % 2 ? times[reps / 2] : (times[reps / 2 - 1] + times[reps / 2]) / 2,
+           times[p99], times[0], times[reps - 1]);
+    fflush(stdout);
+    free(times);
+}
+
+// bench [-reg | -jit | -tiered] [-warmup n] [-reps n] [-pool n] [file.fin...]
+int main(int argc, const char* argv[]) {
+    fin_ctx_config_t config = { NULL, fin_vm_mode_stack, 0, 0 };
+    const char* mode = "stack";
+    int32_t warmup = 2;
+    int32_t reps = 10;
+    int32_t workers = 0;
+    int32_t arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-reg") == 0)
+            config.vm_mode = fin_vm_mode_reg;
+        else if (strcmp(argv[arg], "-jit") == 0)
+            config.vm_mode = fin_vm_mode_jit;
+        else if (strcmp(argv[arg], "-tiered") == 0)
+            config.vm_mode = fin_vm_mode_tiered;
+        else if (strcmp(argv[arg], "-warmup") == 0 && arg + 1 < argc)
+            warmup = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "-reps") == 0 && arg + 1 < argc)
+            reps = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "-pool") == 0 && arg + 1 < argc)
+            workers = atoi(argv[++arg]);
+        else
+            continue;
+        mode = config.vm_mode == fin_vm_mode_reg    ? "reg" :
+               config.vm_mode == fin_vm_mode_jit    ? "jit" :
+               config.vm_mode == fin_vm_mode_tiered ? "tiered" : "stack";
+    }
+    if (reps < 1 || warmup < 0 || workers < 0) {
+        printf("Invalid -reps, -warmup or -pool\n");
+        return 1;
+    }
+
+    for (; arg < argc; arg++) {
+        bench_t bench;
+        const char* name = strrchr(argv[arg], '/');
+        const char* ext = strrchr(argv[arg], '.');
+        name = name ? name + 1 : argv[arg];
+        snprintf(bench.name, sizeof(bench.name), "%.*s", (int)(ext > name ? ext - name : strlen(name)), name);
+        bench.src = bench_read_file(argv[arg]);
+        if (!bench.src) {
+            printf("Can't read %s\n", argv[arg]);
+            return 1;
+        }
+        bench_run(&bench, &config, mode, warmup, reps, workers);
+        free(bench.src);
+    }
+
+    if (!workers) {
+        bench_t compile = { "compile", NULL };
+        compile.src = bench_compile_src();
+        bench_run(&compile, &config, mode, warmup, reps, workers);
+        free(compile.src);
+    }
+    return 0;
+}
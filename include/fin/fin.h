@@ -37,6 +37,26 @@ typedef void* (*fin_alloc)(void* ptr, unsigned int size);
 typedef struct fin_str_t fin_str_t;
 typedef struct fin_obj_t fin_obj_t;
 typedef struct fin_ctx_t fin_ctx_t;
+typedef struct fin_aot_module_t fin_aot_module_t;
+typedef struct fin_mod_t fin_mod_t;
+typedef struct fin_mod_func_t fin_mod_func_t;
+typedef struct fin_pool_t fin_pool_t;
+typedef struct fin_fiber_t fin_fiber_t;
+
+typedef enum fin_vm_mode_t {
+    fin_vm_mode_stack,
+    fin_vm_mode_reg,
+    fin_vm_mode_jit,    // stack code translated to machine code, see FIN_JIT
+    fin_vm_mode_tiered, // stack code, hot functions translated in the background
+} fin_vm_mode_t;
+
+// Zero initialized config selects the defaults.
+typedef struct fin_ctx_config_t {
+    fin_alloc     alloc;
+    fin_vm_mode_t vm_mode;
+    int32_t       max_frames;   // nested script calls before the frames of a vm grow, 1024 when 0
+    int32_t       fiber_slice;  // back edges and calls per resume of a fiber, unlimited when 0
+} fin_ctx_config_t;
 
 typedef union fin_val_t {
     bool              b;
@@ -56,10 +76,55 @@ int32_t     fin_str_len(fin_str_t* str);
 
 fin_ctx_t* fin_ctx_create_default();
 fin_ctx_t* fin_ctx_create(fin_alloc alloc);
+fin_ctx_t* fin_ctx_create_config(const fin_ctx_config_t* config);
 void       fin_ctx_destroy(fin_ctx_t* ctx);
 void       fin_ctx_eval_str(fin_ctx_t* ctx, const char* cstr);
 void       fin_ctx_eval_file(fin_ctx_t* ctx, const char* path);
 
+// Compiles without running, the module lives as long as the context. Funcs
+// are found by signature, e.g. "Fib(int)", in mod or in any module when NULL.
+fin_mod_t*      fin_ctx_compile_str(fin_ctx_t* ctx, const char* cstr);
+fin_mod_func_t* fin_ctx_find_func(fin_ctx_t* ctx, fin_mod_t* mod, const char* sign);
+
+// Runs funcs of compiled modules on worker threads with a vm each, see
+// fin_pool.h. The allocator of the context must be thread safe.
+fin_pool_t* fin_pool_create(fin_ctx_t* ctx, int32_t workers);
+void        fin_pool_destroy(fin_pool_t* pool);
+void        fin_pool_submit(fin_pool_t* pool, fin_mod_func_t* func, const fin_val_t* args, fin_val_t* res);
+void        fin_pool_wait(fin_pool_t* pool);
+
+// Script calls that suspend when a native they call yields or their slice
+// runs out, see fin_fiber.h.
+fin_fiber_t* fin_fiber_create(fin_ctx_t* ctx, fin_mod_func_t* func, const fin_val_t* args);
+void         fin_fiber_destroy(fin_fiber_t* fiber);
+bool         fin_fiber_resume(fin_fiber_t* fiber, const fin_val_t* value, fin_val_t* res);
+bool         fin_fiber_done(fin_fiber_t* fiber);
+bool         fin_ctx_yield(fin_ctx_t* ctx);
+
+// Event loop of the context, see fin_loop.h. Spawned fibers start with the
+// next fin_ctx_run, which returns once they all finished.
+fin_fiber_t* fin_ctx_spawn(fin_ctx_t* ctx, fin_mod_func_t* func, const fin_val_t* args);
+void         fin_ctx_run(fin_ctx_t* ctx);
+
+// Struct objects are freed by a tracing collector, see fin_gc.h, which runs
+// on its own as scripts allocate. This collects right away, once scripts of
+// the context running on other threads stop at their next back edge, call or
+// allocation, and does nothing when one doesn't within a few milliseconds.
+// Objects returned to the host are only safe from it while no pool or other
+// thread runs scripts of the context.
+void         fin_ctx_collect(fin_ctx_t* ctx);
+
+// Writes the C translation of the script at path, see fin_aot.h. Scripts
+// compiled after fin_ctx_aot_register run from a matching translation.
+bool       fin_ctx_aot_file(fin_ctx_t* ctx, const char* path, const char* out_path);
+void       fin_ctx_aot_register(fin_ctx_t* ctx, const fin_aot_module_t* aot);
+void       fin_ctx_profile_dump(fin_ctx_t* ctx);
+
+// Samples the script call stacks while running, Linux only. Stopping writes
+// the samples to path as folded stacks, the input of flamegraph.pl.
+bool       fin_ctx_sample_start(fin_ctx_t* ctx, int32_t hz);
+bool       fin_ctx_sample_stop(fin_ctx_t* ctx, const char* path);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,376 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#include "fin_aot.h"
+#include "fin_ctx.h"
+#include "fin_gc.h"
+#include "fin_mod.h"
+#include "fin_op.h"
+#include "fin_vm.h"
+#include <assert.h>
+#include <string.h>
+
+// Each stack function becomes one C function. The operand stack depth of every
+// instruction is known, so locals and operands are C variables named l<idx>
+// and s<depth>, and the C compiler allocates their registers. Args stay in
+// place, calls to script functions pass theirs at the start of the frame.
+
+#define FIN_AOT_SIZE(op, size)                 size,
+#define FIN_AOT_SIZE_EXPR(op, res, expr, sign) 0,
+#define FIN_AOT_BASE(op, size)                 fin_op_##op,
+#define FIN_AOT_BASE_EXPR(op, res, expr, sign) fin_op_##op,
+#define FIN_AOT_BASE_SUPER2(a, b)              fin_op_##a,
+#define FIN_AOT_BASE_SUPER3(a, b, c)           fin_op_##a,
+#define FIN_AOT_BASE_SUPER4(a, b, c, d)        fin_op_##a,
+#define FIN_AOT_EXPR(op, res, expr, sign)      { #res, #expr },
+
+static const uint8_t fin_aot_op_sizes[fin_op_count] = {
+    FIN_OP_LIST(FIN_AOT_SIZE)
+    FIN_OP_UNARY_LIST(FIN_AOT_SIZE_EXPR)
+    FIN_OP_BINARY_LIST(FIN_AOT_SIZE_EXPR)
+};
+
+// Superinstructions are translated as the sequence they replace.
+static const uint8_t fin_aot_op_base[fin_op_count] = {
+    FIN_OP_LIST(FIN_AOT_BASE)
+    FIN_OP_UNARY_LIST(FIN_AOT_BASE_EXPR)
+    FIN_OP_BINARY_LIST(FIN_AOT_BASE_EXPR)
+    FIN_OP_SUPER2_LIST(FIN_AOT_BASE_SUPER2)
+    FIN_OP_SUPER3_LIST(FIN_AOT_BASE_SUPER3)
+    FIN_OP_SUPER4_LIST(FIN_AOT_BASE_SUPER4)
+};
+
+// Unary and binary instructions are emitted from the expressions of fin_op.h,
+// starting at fin_op_pos_i.
+static const struct {
+    const char* res;
+    const char* expr;
+} fin_aot_exprs[] = {
+    FIN_OP_UNARY_LIST(FIN_AOT_EXPR)
+    FIN_OP_BINARY_LIST(FIN_AOT_EXPR)
+};
+
+typedef struct fin_aot_instr_t {
+    fin_op_t op;
+    uint32_t x;
+    int32_t  next;
+    int32_t  target;    // of branches, -1 otherwise
+} fin_aot_instr_t;
+
+static fin_aot_instr_t fin_aot_decode(const uint8_t* code, int32_t pos) {
+    fin_aot_instr_t instr;
+    bool wide = code[pos] == fin_op_wide;
+    instr.op = (fin_op_t)fin_aot_op_base[code[wide ? pos + 1 : pos]];
+    const uint8_t* bytes = code + pos + (wide ? 2 : 1);
+    int32_t size = fin_aot_op_sizes[instr.op] << (wide ? 1 : 0);
+    instr.x = 0;
+    for (int32_t i=0; i<size; i++)
+        instr.x |= (uint32_t)bytes[i] << (i * 8);
+    instr.next = (int32_t)(bytes + size - code);
+    instr.target = -1;
+    if (instr.op == fin_op_branch || instr.op == fin_op_branch_if || instr.op == fin_op_branch_if_n)
+        instr.target = instr.next + (wide ? (int32_t)instr.x : (int16_t)instr.x);
+    return instr;
+}
+
+// Operand stack depth after instr, -1 when control doesn't fall through.
+static int32_t fin_aot_depth(fin_mod_t* mod, fin_aot_instr_t instr, int32_t depth) {
+    switch (instr.op) {
+        case fin_op_load_const:
+        case fin_op_load_arg:
+        case fin_op_load_local:
+            return depth + 1;
+        case fin_op_store_arg:
+        case fin_op_store_local:
+        case fin_op_branch_if:
+        case fin_op_branch_if_n:
+        case fin_op_pop:
+            return depth - 1;
+        case fin_op_load_field:
+            return depth;
+        case fin_op_store_field:
+            return depth - 2;
+        case fin_op_call: {
+            fin_mod_func_t* callee = mod->binds[instr.x].func;
+            return depth - callee->args + (callee->ret_type ? 1 : 0);
+        }
+        case fin_op_new:
+            return depth - mod->obj_types[instr.x]->fields_count + 1;
+        case fin_op_tail_call:
+        case fin_op_branch:
+        case fin_op_return:
+            return -1;
+        default:
+            return instr.op < fin_op_and_b ? depth : depth - 1;
+    }
+}
+
+static void fin_aot_emit_call(FILE* out, fin_mod_t* mod, int32_t bind, int32_t depth) {
+    fin_mod_func_t* callee = mod->binds[bind].func;
+    int32_t base = depth - callee->args;
+    if (callee->is_native) {
+        fprintf(out, "    { fin_val_t a[%d] = { ", callee->args + 1);
+        for (int32_t i=0; i<callee->args; i++)
+            fprintf(out, "s%d, ", base + i);
+        fprintf(out, "{ 0 } }; fin_val_t r; E.natives[%d](E.ctx, a, &r);", bind);
+        if (callee->ret_type)
+            fprintf(out, " s%d = r;", base);
+        fprintf(out, " }\n");
+        return;
+    }
+    fprintf(out, "    ");
+    for (int32_t i=0; i<callee->args; i++)
+        fprintf(out, "stack[%d] = s%d; ", i, base + i);
+    fprintf(out, "E.call(vm, E.binds[%d], stack + %d);", bind, callee->args);
+    if (callee->ret_type)
+        fprintf(out, " s%d = stack[0];", base);
+    fprintf(out, "\n");
+}
+
+// A void script function has no value to return, but keeps the result slot.
+static void fin_aot_emit_return(FILE* out, fin_mod_func_t* func, int32_t depth) {
+    if (func->ret_type && depth > 0)
+        fprintf(out, "    args[0] = s%d;\n", depth - 1);
+    fprintf(out, "    return;\n");
+}
+
+static void fin_aot_emit_instr(FILE* out, fin_mod_func_t* func, fin_aot_instr_t instr, int32_t depth) {
+    fin_mod_t* mod = func->mod;
+    int32_t d = depth;
+    uint32_t x = instr.x;
+    switch (instr.op) {
+        case fin_op_load_const:  fprintf(out, "    s%d = E.consts[%u];\n", d, x);  break;
+        case fin_op_load_arg:    fprintf(out, "    s%d = args[%u];\n", d, x);      break;
+        case fin_op_store_arg:   fprintf(out, "    args[%u] = s%d;\n", x, d - 1);  break;
+        case fin_op_load_local:  fprintf(out, "    s%d = l%u;\n", d, x);           break;
+        case fin_op_store_local: fprintf(out, "    l%u = s%d;\n", x, d - 1);       break;
+        case fin_op_load_field:
+            fprintf(out, "    if (s%d.o) s%d = s%d.o->fields[%u];\n", d - 1, d - 1, d - 1, x);
+            break;
+        case fin_op_store_field:
+            fprintf(out, "    if (s%d.o) s%d.o->fields[%u] = s%d;\n", d - 2, d - 2, x, d - 1);
+            break;
+        case fin_op_call:
+            fin_aot_emit_call(out, mod, (int32_t)x, d);
+            break;
+        case fin_op_tail_call: {
+            fin_mod_func_t* callee = mod->binds[x].func;
+            if (callee == func) {
+                for (int32_t i=0; i<callee->args; i++)
+                    fprintf(out, "    args[%d] = s%d;\n", i, d - callee->args + i);
+                fprintf(out, "    FIN_AOT_SAFEPOINT();\n");
+                fprintf(out, "    goto entry;\n");
+                break;
+            }
+            // Other functions of the translation get the frame if it fits,
+            // through a call in tail position that the C compiler turns into
+            // a jump.
+            if (callee->mod == mod && !callee->is_reg &&
+                callee->args + callee->locals + callee->stack <= func->args + func->locals + func->stack) {
+                for (int32_t i=0; i<callee->args; i++)
+                    fprintf(out, "    args[%d] = s%d;\n", i, d - callee->args + i);
+                fprintf(out, "    FIN_AOT_SAFEPOINT();\n");
+                fprintf(out, "    fin_aot_func_%d(vm, args, args + %d);\n", (int32_t)(callee - mod->funcs), callee->args);
+                fprintf(out, "    return;\n");
+                break;
+            }
+            fin_aot_emit_call(out, mod, (int32_t)x, d);
+            fin_aot_emit_return(out, func, d - callee->args + (callee->ret_type ? 1 : 0));
+            break;
+        }
+        case fin_op_branch:
+            if (instr.target < instr.next)
+                fprintf(out, "    FIN_AOT_SAFEPOINT();\n");
+            fprintf(out, "    goto L%d;\n", instr.target);
+            break;
+        case fin_op_branch_if:
+        case fin_op_branch_if_n:
+            if (instr.target < instr.next)
+                fprintf(out, "    FIN_AOT_SAFEPOINT();\n");
+            fprintf(out, "    if (%ss%d.b) goto L%d;\n", instr.op == fin_op_branch_if ? "" : "!", d - 1, instr.target);
+            break;
+        case fin_op_return:
+            fin_aot_emit_return(out, func, d);
+            break;
+        case fin_op_pop:
+            break;
+        case fin_op_new: {
+            int32_t count = mod->obj_types[x]->fields_count;
+            fprintf(out, "    { fin_val_t a[%d] = { ", count + 1);
+            for (int32_t i=0; i<count; i++)
+                fprintf(out, "s%d, ", d - count + i);
+            fprintf(out, "{ 0 } }; s%d.o = E.obj_create(vm, E.obj_types[%u], a); }\n", d - count, x);
+            break;
+        }
+        default: {
+            const char* res = fin_aot_exprs[instr.op - fin_op_pos_i].res;
+            const char* expr = fin_aot_exprs[instr.op - fin_op_pos_i].expr;
+            const char* ctx = strstr(expr, "ctx") ? " fin_ctx_t* ctx = E.ctx;" : "";
+            if (instr.op < fin_op_and_b)
+                fprintf(out, "    {%s fin_val_t a = s%d; s%d.%s = %s; }\n", ctx, d - 1, d - 1, res, expr);
+            else
+                fprintf(out, "    {%s fin_val_t a = s%d, b = s%d; s%d.%s = %s; }\n", ctx, d - 2, d - 1, d - 2, res, expr);
+            break;
+        }
+    }
+}
+
+static void fin_aot_emit_func(fin_ctx_t* ctx, FILE* out, fin_mod_func_t* func, int32_t idx) {
+    fin_mod_t* mod = func->mod;
+    const uint8_t* code = func->code;
+    int32_t* depth = (int32_t*)ctx->alloc(NULL, sizeof(int32_t) * (func->code_length + 1) * 3);
+    int32_t* labels = depth + func->code_length + 1;
+    int32_t* work = labels + func->code_length + 1;
+    for (int32_t i=0; i<=func->code_length; i++) {
+        depth[i] = -1;
+        labels[i] = 0;
+    }
+
+    // Depths flow from the entry along fall through and branch edges.
+    int32_t work_count = 0;
+    int32_t depth_max = 0;
+    bool loops = false;
+    depth[0] = 0;
+    work[work_count++] = 0;
+    while (work_count) {
+        int32_t pos = work[--work_count];
+        if (pos >= func->code_length)
+            continue;
+        fin_aot_instr_t instr = fin_aot_decode(code, pos);
+        int32_t after = fin_aot_depth(mod, instr, depth[pos]);
+        if (instr.op == fin_op_tail_call && mod->binds[instr.x].func == func)
+            loops = true;
+        if (depth[pos] > depth_max)
+            depth_max = depth[pos];
+        if (after > depth_max)
+            depth_max = after;
+        if (instr.target >= 0) {
+            labels[instr.target] = 1;
+            if (depth[instr.target] < 0) {
+                depth[instr.target] = instr.op == fin_op_branch ? depth[pos] : depth[pos] - 1;
+                work[work_count++] = instr.target;
+            }
+        }
+        if (after >= 0 && depth[instr.next] < 0) {
+            depth[instr.next] = after;
+            work[work_count++] = instr.next;
+        }
+    }
+
+    fprintf(out, "// %s\n", fin_str_cstr(func->sign));
+    fprintf(out, "static void fin_aot_func_%d(fin_vm_t* vm, fin_val_t* args, fin_val_t* stack) {\n", idx);
+    // Slots of scalar replaced locals may be stored and never loaded.
+    for (int32_t i=0; i<func->locals; i++)
+        fprintf(out, "    fin_val_t l%d = { 0 }; (void)l%d;\n", i, i);
+    for (int32_t i=0; i<depth_max; i++)
+        fprintf(out, "    fin_val_t s%d;\n", i);
+    if (loops)
+        fprintf(out, "entry:\n");
+    for (int32_t pos = 0; pos < func->code_length;) {
+        fin_aot_instr_t instr = fin_aot_decode(code, pos);
+        if (labels[pos])
+            fprintf(out, "L%d:\n", pos);
+        if (depth[pos] >= 0)
+            fin_aot_emit_instr(out, func, instr, depth[pos]);
+        pos = instr.next;
+    }
+    if (labels[func->code_length])
+        fprintf(out, "L%d:\n    return;\n", func->code_length);
+    fprintf(out, "}\n\n");
+    ctx->alloc(depth, 0);
+}
+
+// FNV-1a over the shape and the stack code of mod.
+uint64_t fin_aot_hash(fin_mod_t* mod) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+#define FIN_AOT_HASH(b) hash = (hash ^ (uint8_t)(b)) * 0x100000001b3ull
+    FIN_AOT_HASH(mod->funcs_count);
+    FIN_AOT_HASH(mod->consts_count);
+    FIN_AOT_HASH(mod->binds_count);
+    for (int32_t i=0; i<mod->funcs_count; i++) {
+        fin_mod_func_t* func = &mod->funcs[i];
+        FIN_AOT_HASH(func->is_native | func->is_reg << 1);
+        FIN_AOT_HASH(func->code_length);
+        FIN_AOT_HASH(func->code_length >> 8);
+        for (int32_t c=0; c<func->code_length; c++)
+            FIN_AOT_HASH(func->code[c]);
+    }
+#undef FIN_AOT_HASH
+    return hash;
+}
+
+// Writes the translation of the stack functions of mod. Native and register
+// functions are left to the vm. Tail calls between functions of the
+// translation rely on the C compiler optimizing sibling calls.
+bool fin_aot_emit(fin_ctx_t* ctx, fin_mod_t* mod, FILE* out) {
+    fprintf(out, "// Translated by fin, see fin_aot.h.\n\n");
+    fprintf(out, "#include \"fin_aot.h\"\n#include <math.h>\n\n");
+    fprintf(out, "static fin_mod_func_t*  fin_aot_binds[%d];\n", mod->binds_count + 1);
+    fprintf(out, "static fin_aot_native_t fin_aot_natives[%d];\n", mod->binds_count + 1);
+    fprintf(out, "static fin_aot_env_t    E = { NULL, NULL, NULL, fin_aot_binds, fin_aot_natives };\n\n");
+    fprintf(out, "#define fin_str_concat E.str_concat\n");
+    fprintf(out, "#define FIN_AOT_SAFEPOINT() if (__atomic_load_n(E.gc_stop, __ATOMIC_RELAXED)) E.safepoint(E.ctx)\n\n");
+    for (int32_t i=0; i<mod->funcs_count; i++) {
+        fin_mod_func_t* func = &mod->funcs[i];
+        if (!func->is_native && !func->is_reg)
+            fprintf(out, "static void fin_aot_func_%d(fin_vm_t* vm, fin_val_t* args, fin_val_t* stack);\n", i);
+    }
+    fprintf(out, "\n");
+
+    for (int32_t i=0; i<mod->funcs_count; i++) {
+        fin_mod_func_t* func = &mod->funcs[i];
+        if (!func->is_native && !func->is_reg)
+            fin_aot_emit_func(ctx, out, func, i);
+    }
+
+    fprintf(out, "static const fin_aot_func_t fin_aot_funcs[%d] = {\n", mod->funcs_count + 1);
+    for (int32_t i=0; i<mod->funcs_count; i++) {
+        fin_mod_func_t* func = &mod->funcs[i];
+        if (!func->is_native && !func->is_reg)
+            fprintf(out, "    fin_aot_func_%d,\n", i);
+        else
+            fprintf(out, "    NULL,\n");
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "const fin_aot_module_t fin_aot_module = { 0x%016llxull, %d, %d, fin_aot_funcs, &E };\n",
+            (unsigned long long)fin_aot_hash(mod), mod->funcs_count, mod->binds_count);
+    return !ferror(out);
+}
+
+// Runs the functions of mod from a registered translation of the same code.
+void fin_aot_link(fin_ctx_t* ctx, fin_mod_t* mod) {
+    if (!ctx->aot)
+        return;
+    uint64_t hash = fin_aot_hash(mod);
+    const fin_aot_module_t* aot = NULL;
+    for (fin_ctx_aot_t* it = ctx->aot; it && !aot; it = it->next) {
+        if (it->module->hash == hash && it->module->funcs_count == mod->funcs_count && it->module->binds_count == mod->binds_count)
+            aot = it->module;
+    }
+    if (!aot)
+        return;
+
+    fin_aot_env_t* env = aot->env;
+    env->ctx        = ctx;
+    env->alloc      = ctx->alloc;
+    env->consts     = mod->consts;
+    env->call       = &fin_vm_jit_call;
+    env->obj_create = &fin_obj_create;
+    env->obj_types  = mod->obj_types;
+    env->gc_stop    = fin_gc_stopping(ctx);
+    env->safepoint  = &fin_gc_safepoint;
+    env->str_concat = &fin_str_concat;
+    for (int32_t i=0; i<mod->binds_count; i++) {
+        fin_mod_func_t* func = mod->binds[i].func;
+        env->binds[i] = func;
+        env->natives[i] = func->is_native ? func->func : NULL;
+    }
+    for (int32_t i=0; i<mod->funcs_count; i++) {
+        if (aot->funcs[i]) {
+            mod->funcs[i].jit = (void*)aot->funcs[i];
+            mod->funcs[i].is_aot = true;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#ifndef FIN_AOT_H
+#define FIN_AOT_H
+
+#include <fin/fin.h>
+#include <stdio.h>
+#include "fin_obj.h"
+
+// Ahead of time translation of the stack code of a script module to C. The
+// translation includes this header and exports its fin_aot_module_t as
+// fin_aot_module. Built as a shared object or linked statically, it is passed
+// to fin_ctx_aot_register and replaces the bytecode of every module compiled
+// afterwards from the same script. A translation runs in one context at a
+// time.
+
+typedef struct fin_vm_t       fin_vm_t;
+typedef struct fin_mod_t      fin_mod_t;
+typedef struct fin_mod_func_t fin_mod_func_t;
+
+typedef void (*fin_aot_func_t)(fin_vm_t* vm, fin_val_t* args, fin_val_t* stack);
+typedef void (*fin_aot_native_t)(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* res);
+
+// Runtime state of a translation, filled in when its module is linked. The
+// binds and natives arrays belong to the translation.
+typedef struct fin_aot_env_t {
+    fin_ctx_t*        ctx;
+    fin_alloc         alloc;
+    const fin_val_t*  consts;
+    fin_mod_func_t**  binds;
+    fin_aot_native_t* natives;      // NULL for script functions
+    void              (*call)(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* top);
+    fin_obj_t*        (*obj_create)(fin_vm_t* vm, const fin_obj_type_t* type, const fin_val_t* fields);
+    fin_str_t*        (*str_concat)(fin_ctx_t* ctx, fin_str_t* a, fin_str_t* b);
+    const fin_obj_type_t** obj_types;
+    const int32_t*    gc_stop;      // polled at back edges and tail calls
+    void              (*safepoint)(fin_ctx_t* ctx);
+} fin_aot_env_t;
+
+typedef struct fin_aot_module_t {
+    uint64_t              hash;         // of the code translated, see fin_aot_hash
+    int32_t               funcs_count;
+    int32_t               binds_count;
+    const fin_aot_func_t* funcs;        // NULL for functions left to the vm
+    fin_aot_env_t*        env;
+} fin_aot_module_t;
+
+bool     fin_aot_emit(fin_ctx_t* ctx, fin_mod_t* mod, FILE* out);
+void     fin_aot_link(fin_ctx_t* ctx, fin_mod_t* mod);
+uint64_t fin_aot_hash(fin_mod_t* mod);
+
+#endif //#ifndef FIN_AOT_H
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#include "fin_arena.h"
+#include "fin_ctx.h"
+#include <string.h>
+
+#define FIN_ARENA_BLOCK_SIZE (32 * 1024)
+#define FIN_ARENA_STRS       64
+
+typedef struct fin_arena_block_t {
+    struct fin_arena_block_t* next;
+    int64_t                   data[0];
+} fin_arena_block_t;
+
+typedef struct fin_arena_strs_t {
+    struct fin_arena_strs_t* next;
+    int32_t                  count;
+    fin_str_t*               strs[FIN_ARENA_STRS];
+} fin_arena_strs_t;
+
+// Lives at the start of the first block.
+struct fin_arena_t {
+    fin_ctx_t*         ctx;
+    fin_arena_block_t* blocks;
+    char*              top;
+    char*              end;
+    char*              last;    // the latest allocation, which can grow in place
+    fin_arena_strs_t*  strs;
+};
+
+static void fin_arena_block_add(fin_arena_t* arena, int32_t size) {
+    if (size < FIN_ARENA_BLOCK_SIZE - (int32_t)sizeof(fin_arena_block_t))
+        size = FIN_ARENA_BLOCK_SIZE - (int32_t)sizeof(fin_arena_block_t);
+    fin_arena_block_t* block = (fin_arena_block_t*)arena->ctx->alloc(NULL, sizeof(fin_arena_block_t) + size);
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->top = (char*)block->data;
+    arena->end = arena->top + size;
+}
+
+fin_arena_t* fin_arena_create(fin_ctx_t* ctx) {
+    fin_arena_block_t* block = (fin_arena_block_t*)ctx->alloc(NULL, FIN_ARENA_BLOCK_SIZE);
+    fin_arena_t* arena = (fin_arena_t*)block->data;
+    block->next = NULL;
+    arena->ctx = ctx;
+    arena->blocks = block;
+    arena->top = (char*)block->data + ((sizeof(fin_arena_t) + 7) & ~7);
+    arena->end = (char*)block + FIN_ARENA_BLOCK_SIZE;
+    arena->last = NULL;
+    arena->strs = NULL;
+    return arena;
+}
+
+void fin_arena_destroy(fin_arena_t* arena) {
+    fin_ctx_t* ctx = arena->ctx;
+    for (fin_arena_strs_t* strs = arena->strs; strs; strs = strs->next) {
+        for (int32_t i=0; i<strs->count; i++)
+            fin_str_destroy(ctx, strs->strs[i]);
+    }
+    fin_arena_block_t* block = arena->blocks;
+    while (block) {
+        fin_arena_block_t* next = block->next;
+        ctx->alloc(block, 0);
+        block = next;
+    }
+}
+
+fin_ctx_t* fin_arena_ctx(fin_arena_t* arena) {
+    return arena->ctx;
+}
+
+void* fin_arena_alloc(fin_arena_t* arena, int32_t size) {
+    size = (size + 7) & ~7;
+    if (arena->top + size > arena->end)
+        fin_arena_block_add(arena, size);
+    arena->last = arena->top;
+    arena->top += size;
+    return arena->last;
+}
+
+// Grows ptr, of size bytes, in place when it is the latest allocation.
+void* fin_arena_realloc(fin_arena_t* arena, void* ptr, int32_t size, int32_t new_size) {
+    if (ptr && ptr == arena->last && arena->last + new_size <= arena->end) {
+        arena->top = arena->last + ((new_size + 7) & ~7);
+        return ptr;
+    }
+    void* buffer = fin_arena_alloc(arena, new_size);
+    if (ptr)
+        memcpy(buffer, ptr, size < new_size ? size : new_size);
+    return buffer;
+}
+
+// The arena takes over the reference to str, NULL for an empty string.
+fin_str_t* fin_arena_str(fin_arena_t* arena, fin_str_t* str) {
+    if (!str)
+        return NULL;
+    if (!arena->strs || arena->strs->count == FIN_ARENA_STRS) {
+        fin_arena_strs_t* strs = (fin_arena_strs_t*)fin_arena_alloc(arena, sizeof(fin_arena_strs_t));
+        strs->next = arena->strs;
+        strs->count = 0;
+        arena->strs = strs;
+    }
+    arena->strs->strs[arena->strs->count++] = str;
+    return str;
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#ifndef FIN_ARENA_H
+#define FIN_ARENA_H
+
+#include <fin/fin.h>
+
+// Bump allocator for data that dies at once, the AST of a script and the
+// scratch data of its compilation. Nothing is freed on its own, destroying
+// the arena frees all of it and releases the strings it was handed.
+
+typedef struct fin_arena_t fin_arena_t;
+
+fin_arena_t* fin_arena_create(fin_ctx_t* ctx);
+void         fin_arena_destroy(fin_arena_t* arena);
+fin_ctx_t*   fin_arena_ctx(fin_arena_t* arena);
+void*        fin_arena_alloc(fin_arena_t* arena, int32_t size);
+void*        fin_arena_realloc(fin_arena_t* arena, void* ptr, int32_t size, int32_t new_size);
+fin_str_t*   fin_arena_str(fin_arena_t* arena, fin_str_t* str);
+
+#endif //#ifndef FIN_ARENA_H
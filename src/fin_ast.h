@@ -243,6 +243,7 @@ typedef struct fin_ast_enum_t {
 typedef struct fin_ast_field_t {
     fin_str_t*              name;
     fin_ast_type_ref_t*     type;
+    bool                    is_inline;  // struct T name; stores the fields of T in place
     struct fin_ast_field_t* next;
 } fin_ast_field_t;
 
@@ -269,14 +270,15 @@ typedef struct fin_ast_type_t {
 } fin_ast_type_t;
 
 typedef struct fin_ast_module_t {
-    fin_ctx_t*      ctx;
     fin_str_t*      name;
     fin_ast_type_t* types;
     fin_ast_enum_t* enums;
     fin_ast_func_t* funcs;
 } fin_ast_module_t;
 
-fin_ast_module_t* fin_ast_parse(fin_ctx_t* ctx, const char* str);
-void              fin_ast_destroy(fin_ast_module_t* mod);
+typedef struct fin_arena_t fin_arena_t;
+
+// The AST, its strings included, lives as long as arena.
+fin_ast_module_t* fin_ast_parse(fin_arena_t* arena, const char* str);
 
 #endif // #ifndef FIN_AST_H
@@ -4,9 +4,15 @@
  */
 
 #include "fin_ctx.h"
+#include "fin_aot.h"
+#include "fin_gc.h"
+#include "fin_jit.h"
+#include "fin_loop.h"
 #include "fin_mod.h"
+#include "fin_sample.h"
 #include "fin_vm.h"
 #include "fin_str.h"
+#include "mod/fin_fiber.h"
 #include "mod/fin_io.h"
 #include "mod/fin_math.h"
 #include "mod/fin_time.h"
@@ -14,6 +20,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void* fin_allocator(void* ptr, unsigned int size) {
     if (ptr) {
@@ -32,14 +39,28 @@ static void* fin_allocator(void* ptr, unsigned int size) {
 }
 
 fin_ctx_t* fin_ctx_create(fin_alloc alloc) {
+    fin_ctx_config_t config = { alloc, fin_vm_mode_stack, 0, 0 };
+    return fin_ctx_create_config(&config);
+}
+
+fin_ctx_t* fin_ctx_create_config(const fin_ctx_config_t* config) {
+    fin_alloc alloc = config->alloc ? config->alloc : &fin_allocator;
     fin_ctx_t* ctx = (fin_ctx_t*)alloc(NULL, sizeof(fin_ctx_t));
     ctx->alloc = alloc;
     ctx->pool = fin_str_pool_create(alloc);
     ctx->mod = NULL;
+    ctx->aot = NULL;
+    ctx->jit = NULL;
+    ctx->loop = NULL;
+    fin_gc_create(ctx);
+    ctx->vm_mode = config->vm_mode;
+    ctx->max_frames = config->max_frames ? config->max_frames : 1024;
+    ctx->fiber_slice = config->fiber_slice;
     fin_io_register(ctx); // this should be optional
     fin_math_register(ctx); // this should be optional
     fin_time_register(ctx); // this should be optional
     fin_std_register(ctx); // this should be optional
+    fin_fiber_register(ctx); // this should be optional
     return ctx;
 }
 
@@ -48,12 +69,24 @@ fin_ctx_t* fin_ctx_create_default() {
 }
 
 void fin_ctx_destroy(fin_ctx_t* ctx) {
+    fin_sample_stop(ctx, NULL);
+    fin_loop_destroy(ctx);
+    fin_jit_shutdown(ctx);
+    fin_gc_destroy(ctx);
+#if FIN_VM_PROFILE
+    fin_ctx_profile_dump(ctx);
+#endif
     fin_mod_t* mod = ctx->mod;
     while (mod) {
         fin_mod_t* tmp = mod;
         mod = mod->next;
         fin_mod_destroy(ctx, tmp);
     }
+    while (ctx->aot) {
+        fin_ctx_aot_t* next = ctx->aot->next;
+        ctx->alloc(ctx->aot, 0);
+        ctx->aot = next;
+    }
 
     fin_str_pool_destroy(ctx->pool);
     ctx->alloc(ctx, 0);
@@ -68,10 +101,53 @@ void fin_ctx_eval_str(fin_ctx_t* ctx, const char* cstr) {
     }
 }
 
-void fin_ctx_eval_file(fin_ctx_t* ctx, const char* path) {
+fin_mod_t* fin_ctx_compile_str(fin_ctx_t* ctx, const char* cstr) {
+    return fin_mod_compile(ctx, cstr);
+}
+
+static fin_mod_func_t* fin_ctx_find_func_in(fin_mod_t* mod, const char* sign) {
+    for (int32_t i=0; i<mod->funcs_count; i++) {
+        if (strcmp(fin_str_cstr(mod->funcs[i].sign), sign) == 0)
+            return &mod->funcs[i];
+    }
+    return NULL;
+}
+
+fin_mod_func_t* fin_ctx_find_func(fin_ctx_t* ctx, fin_mod_t* mod, const char* sign) {
+    if (mod)
+        return fin_ctx_find_func_in(mod, sign);
+    for (fin_mod_t* m = ctx->mod; m; m = m->next) {
+        fin_mod_func_t* func = fin_ctx_find_func_in(m, sign);
+        if (func)
+            return func;
+    }
+    return NULL;
+}
+
+// Called by natives to suspend the fiber running them, see fin_fiber.h. False
+// when the calling script code can't be suspended.
+bool fin_ctx_yield(fin_ctx_t* ctx) {
+    return fin_vm_yield(ctx);
+}
+
+void fin_ctx_collect(fin_ctx_t* ctx) {
+    fin_gc_collect(ctx);
+}
+
+// Runs func as a fiber of the event loop of ctx, see fin_loop.h. It starts
+// with the next fin_ctx_run and is destroyed once it returns.
+fin_fiber_t* fin_ctx_spawn(fin_ctx_t* ctx, fin_mod_func_t* func, const fin_val_t* args) {
+    return fin_loop_spawn(ctx, func, args);
+}
+
+void fin_ctx_run(fin_ctx_t* ctx) {
+    fin_loop_run(ctx);
+}
+
+static char* fin_ctx_read_file(fin_ctx_t* ctx, const char* path) {
     FILE* fp = fopen(path, "rb");
     if (!fp)
-        return;
+        return NULL;
 
     fseek(fp, 0, SEEK_END);
     int32_t file_size = (int32_t)ftell(fp);
@@ -83,8 +159,63 @@ void fin_ctx_eval_file(fin_ctx_t* ctx, const char* path) {
     buffer[file_size] = '\0';
     assert(read == file_size);
     fclose(fp);
+    return buffer;
+}
+
+void fin_ctx_eval_file(fin_ctx_t* ctx, const char* path) {
+    char* buffer = fin_ctx_read_file(ctx, path);
+    if (!buffer)
+        return;
 
     fin_ctx_eval_str(ctx, buffer);
 
     ctx->alloc(buffer, 0);
 }
+
+bool fin_ctx_aot_file(fin_ctx_t* ctx, const char* path, const char* out_path) {
+    char* buffer = fin_ctx_read_file(ctx, path);
+    if (!buffer)
+        return false;
+
+    bool result = false;
+    fin_mod_t* mod = fin_mod_compile(ctx, buffer);
+    FILE* fp = mod ? fopen(out_path, "w") : NULL;
+    if (fp) {
+        result = fin_aot_emit(ctx, mod, fp);
+        result = fclose(fp) == 0 && result;
+    }
+
+    ctx->alloc(buffer, 0);
+    return result;
+}
+
+void fin_ctx_aot_register(fin_ctx_t* ctx, const fin_aot_module_t* aot) {
+    fin_ctx_aot_t* entry = (fin_ctx_aot_t*)ctx->alloc(NULL, sizeof(fin_ctx_aot_t));
+    entry->module = aot;
+    entry->next = ctx->aot;
+    ctx->aot = entry;
+}
+
+// Reports the instructions interpreted so far by FIN_VM_PROFILE builds to
+// the file named by FIN_PROFILE_OUT, or to stderr.
+void fin_ctx_profile_dump(fin_ctx_t* ctx) {
+#if FIN_VM_PROFILE
+    const char* path = getenv("FIN_PROFILE_OUT");
+    FILE* fp = path ? fopen(path, "a") : stderr;
+    if (!fp)
+        return;
+    fin_vm_profile_dump(fp);
+    if (fp != stderr)
+        fclose(fp);
+#endif
+}
+
+// Samples the script call stacks of the process hz times per second of CPU
+// time, see fin_sample.h. One context samples at a time.
+bool fin_ctx_sample_start(fin_ctx_t* ctx, int32_t hz) {
+    return fin_sample_start(ctx, hz);
+}
+
+bool fin_ctx_sample_stop(fin_ctx_t* ctx, const char* path) {
+    return fin_sample_stop(ctx, path);
+}
@@ -11,16 +11,40 @@
 typedef struct fin_mod_t      fin_mod_t;
 typedef struct fin_str_pool_t fin_str_pool_t;
 
+typedef struct fin_ctx_aot_t {
+    const fin_aot_module_t* module;
+    struct fin_ctx_aot_t*   next;
+} fin_ctx_aot_t;
+
 typedef struct fin_ctx_t {
     fin_alloc       alloc;
     fin_str_pool_t* pool;
     fin_mod_t*      mod;
+    fin_ctx_aot_t*  aot;
+    void*           jit;        // background compiler of tiered mode
+    void*           loop;       // event loop of fin_ctx_run
+    void*           gc;         // collector of struct objects, see fin_gc.h
+    fin_vm_mode_t   vm_mode;
+    int32_t         max_frames;
+    int32_t         fiber_slice;
 } fin_ctx_t;
 
 fin_ctx_t* fin_ctx_create(fin_alloc alloc);
+fin_ctx_t* fin_ctx_create_config(const fin_ctx_config_t* config);
 fin_ctx_t* fin_ctx_create_default();
 void       fin_ctx_destroy(fin_ctx_t* ctx);
 void       fin_ctx_eval_str(fin_ctx_t* ctx, const char* cstr);
 void       fin_ctx_eval_file(fin_ctx_t* ctx, const char* path);
+fin_mod_t* fin_ctx_compile_str(fin_ctx_t* ctx, const char* cstr);
+fin_mod_func_t* fin_ctx_find_func(fin_ctx_t* ctx, fin_mod_t* mod, const char* sign);
+bool       fin_ctx_yield(fin_ctx_t* ctx);
+fin_fiber_t* fin_ctx_spawn(fin_ctx_t* ctx, fin_mod_func_t* func, const fin_val_t* args);
+void       fin_ctx_run(fin_ctx_t* ctx);
+void       fin_ctx_collect(fin_ctx_t* ctx);
+bool       fin_ctx_aot_file(fin_ctx_t* ctx, const char* path, const char* out_path);
+void       fin_ctx_aot_register(fin_ctx_t* ctx, const fin_aot_module_t* aot);
+void       fin_ctx_profile_dump(fin_ctx_t* ctx);
+bool       fin_ctx_sample_start(fin_ctx_t* ctx, int32_t hz);
+bool       fin_ctx_sample_stop(fin_ctx_t* ctx, const char* path);
 
 #endif //#ifndef FIN_CTX_H
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#include "fin_fiber.h"
+#include "fin_ctx.h"
+#include "fin_mod.h"
+#include "fin_vm.h"
+
+typedef struct fin_fiber_t {
+    fin_ctx_t*      ctx;
+    fin_vm_t*       vm;
+    fin_mod_func_t* func;
+    fin_val_t*      args;       // kept until the first resume
+    bool            started;
+    bool            done;
+} fin_fiber_t;
+
+fin_fiber_t* fin_fiber_create(fin_ctx_t* ctx, fin_mod_func_t* func, const fin_val_t* args) {
+    if (func->is_reg)
+        return NULL;
+    fin_fiber_t* fiber = (fin_fiber_t*)ctx->alloc(NULL, sizeof(fin_fiber_t));
+    fiber->ctx = ctx;
+    fiber->vm = fin_vm_create_fiber(ctx, ctx->fiber_slice);
+    fiber->func = func;
+    fiber->args = NULL;
+    if (func->args) {
+        fiber->args = (fin_val_t*)ctx->alloc(NULL, sizeof(fin_val_t) * func->args);
+        for (int32_t i=0; i<func->args; i++)
+            fiber->args[i] = args[i];
+    }
+    fiber->started = false;
+    fiber->done = false;
+    return fiber;
+}
+
+void fin_fiber_destroy(fin_fiber_t* fiber) {
+    fin_ctx_t* ctx = fiber->ctx;
+    if (fiber->args)
+        ctx->alloc(fiber->args, 0);
+    fin_vm_destroy(fiber->vm);
+    ctx->alloc(fiber, 0);
+}
+
+// Starts or continues the fiber. Returns true once its function returned,
+// res then takes the result unless NULL. value replaces the result of the
+// native that suspended the fiber, unless NULL.
+bool fin_fiber_resume(fin_fiber_t* fiber, const fin_val_t* value, fin_val_t* res) {
+    if (fiber->done)
+        return true;
+    if (fiber->started)
+        fiber->done = fin_vm_resume(fiber->vm, value, res);
+    else {
+        fiber->started = true;
+        fiber->done = fin_vm_call(fiber->vm, fiber->func, fiber->args, res);
+    }
+    return fiber->done;
+}
+
+bool fin_fiber_done(fin_fiber_t* fiber) {
+    return fiber->done;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#ifndef FIN_FIBER_H
+#define FIN_FIBER_H
+
+#include <fin/fin.h>
+
+// A script call with its own value stack and frames that can suspend midway.
+// Natives suspend the fiber running them with fin_ctx_yield, the script code
+// of the fiber stops once the native returns and the host continues it later
+// with fin_fiber_resume, from any thread. With a fiber_slice in the config of
+// the context the fiber is also preempted once it took that many back edges
+// and script calls since it was resumed, so that a host running many fibers
+// bounds the time each one holds the thread. Fibers run stack code in the
+// interpreter, reg functions can't be suspended.
+
+fin_fiber_t* fin_fiber_create(fin_ctx_t* ctx, fin_mod_func_t* func, const fin_val_t* args);
+void         fin_fiber_destroy(fin_fiber_t* fiber);
+bool         fin_fiber_resume(fin_fiber_t* fiber, const fin_val_t* value, fin_val_t* res);
+bool         fin_fiber_done(fin_fiber_t* fiber);
+
+#endif //#ifndef FIN_FIBER_H
@@ -0,0 +1,619 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+    #define _POSIX_C_SOURCE 200112L     // clock_gettime under -std=c99
+#endif
+
+#include "fin_gc.h"
+#include "fin_ctx.h"
+#include "fin_obj.h"
+#include "fin_vm.h"
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+    #include <windows.h>
+    typedef SRWLOCK fin_gc_lock_t;
+    typedef CONDITION_VARIABLE fin_gc_cond_t;
+    #define FIN_GC_LOCK_INIT(l)     InitializeSRWLock(l)
+    #define FIN_GC_LOCK_FREE(l)
+    #define FIN_GC_LOCK(l)          AcquireSRWLockExclusive(l)
+    #define FIN_GC_UNLOCK(l)        ReleaseSRWLockExclusive(l)
+    #define FIN_GC_COND_INIT(c)     InitializeConditionVariable(c)
+    #define FIN_GC_COND_FREE(c)
+    #define FIN_GC_WAIT(c, l)       SleepConditionVariableSRW(c, l, INFINITE, 0)
+    #define FIN_GC_WAIT_1MS(c, l)   (!SleepConditionVariableSRW(c, l, 1, 0))
+    #define FIN_GC_WAKE(c)          WakeAllConditionVariable(c)
+    #define FIN_GC_TLS              __declspec(thread)
+    #define FIN_GC_NO_SANITIZE
+    #define FIN_GC_SPILL()
+#else
+    #include <pthread.h>
+    #include <time.h>
+    typedef pthread_mutex_t fin_gc_lock_t;
+    typedef pthread_cond_t fin_gc_cond_t;
+    #define FIN_GC_LOCK_INIT(l)     pthread_mutex_init(l, NULL)
+    #define FIN_GC_LOCK_FREE(l)     pthread_mutex_destroy(l)
+    #define FIN_GC_LOCK(l)          pthread_mutex_lock(l)
+    #define FIN_GC_UNLOCK(l)        pthread_mutex_unlock(l)
+    #define FIN_GC_COND_INIT(c)     pthread_cond_init(c, NULL)
+    #define FIN_GC_COND_FREE(c)     pthread_cond_destroy(c)
+    #define FIN_GC_WAIT(c, l)       pthread_cond_wait(c, l)
+    #define FIN_GC_WAIT_1MS(c, l)   fin_gc_wait_1ms(c, l)
+    #define FIN_GC_WAKE(c)          pthread_cond_broadcast(c)
+    #define FIN_GC_TLS              __thread
+    // The C stack is read past the locals the sanitizer knows about.
+    #define FIN_GC_NO_SANITIZE      __attribute__((noinline, no_sanitize_address))
+    // setjmp mangles some of the registers it saves, this saves them all.
+    #define FIN_GC_SPILL()          __builtin_unwind_init()
+#endif
+
+#define FIN_GC_MIN_LIMIT   4096         // allocations of a heap between collections
+#define FIN_GC_CLASSES     17           // field counts with a size class
+#define FIN_GC_PAGE_SIZE   (64 * 1024)  // slabs of a size class are cut from pages
+#define FIN_GC_PAGE_ALLOCS 64           // allocations a page left by a destroyed vm counts for
+#define FIN_GC_WAIT_MS     10           // for running vms to park before a collection is put off
+
+typedef struct fin_gc_page_t {
+    struct fin_gc_page_t* next;
+    fin_val_t             data[0];
+} fin_gc_page_t;
+
+// Objects of a field count, the freed ones are reused first.
+typedef struct fin_gc_class_t {
+    fin_obj_t* free;
+    char*      bump;
+    char*      end;
+} fin_gc_class_t;
+
+typedef struct fin_gc_heap_t {
+    struct fin_gc_t*      gc;
+    fin_vm_t*             vm;       // NULL for the objects of destroyed vms
+    fin_obj_t*            objs;
+    int32_t               count;
+    int32_t               allocs;   // since the last collection
+    int32_t               limit;
+    int32_t               max_size; // of its objects
+    fin_gc_class_t        classes[FIN_GC_CLASSES];
+    fin_gc_page_t*        pages;
+    struct fin_gc_heap_t* next;
+} fin_gc_heap_t;
+
+// The C stack of a thread parked at a safepoint, from the registers it
+// spilled up to its outermost script call.
+typedef struct fin_gc_parked_t {
+    char*                   begin;
+    char*                   end;
+    struct fin_gc_parked_t* next;
+} fin_gc_parked_t;
+
+typedef struct fin_gc_t {
+    fin_gc_lock_t    lock;
+    fin_gc_cond_t    cond;
+    fin_gc_heap_t*   heaps;
+    fin_gc_heap_t    orphans;
+    int32_t          running;   // threads running script code
+    int32_t          stop;      // set while a collection waits for them to park
+    int32_t          cycles;    // collections so far
+    fin_gc_parked_t* parked;
+    int32_t          parked_count;
+    int32_t          limit;
+    fin_ctx_t*       ctx;
+} fin_gc_t;
+
+typedef struct fin_gc_entry_t {
+    fin_obj_t*     obj;
+    fin_gc_heap_t* heap;
+    bool           marked;
+} fin_gc_entry_t;
+
+// State of a collection, with every object in an open addressed table.
+typedef struct fin_gc_mark_t {
+    fin_gc_entry_t*  entries;
+    uint32_t         mask;
+    int32_t          max_size;
+    fin_gc_entry_t** stack;
+    int32_t          stack_count;
+    int32_t          stack_capacity;
+    fin_ctx_t*       ctx;
+} fin_gc_mark_t;
+
+// Outermost script call of this thread, where the scan of its C stack ends.
+static FIN_GC_TLS char*   fin_gc_stack_base = NULL;
+static FIN_GC_TLS int32_t fin_gc_depth = 0;
+
+#if !defined(_MSC_VER)
+// Waits up to 1ms, true when the time ran out.
+static bool fin_gc_wait_1ms(pthread_cond_t* cond, pthread_mutex_t* lock) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(cond, lock, &ts) != 0;
+}
+#endif
+
+static void fin_gc_heap_init(fin_gc_t* gc, fin_gc_heap_t* heap, fin_vm_t* vm) {
+    heap->gc = gc;
+    heap->vm = vm;
+    heap->objs = NULL;
+    heap->count = 0;
+    heap->allocs = 0;
+    heap->limit = gc->limit;
+    heap->max_size = 0;
+    memset(heap->classes, 0, sizeof(heap->classes));
+    heap->pages = NULL;
+    heap->next = NULL;
+}
+
+// Objects too large for a size class are allocated one by one.
+static void fin_gc_free(fin_ctx_t* ctx, fin_obj_t* obj) {
+    if (obj->type->fields_count >= FIN_GC_CLASSES)
+        ctx->alloc(obj, 0);
+}
+
+static void fin_gc_heap_free(fin_ctx_t* ctx, fin_gc_heap_t* heap) {
+    fin_obj_t* obj = heap->objs;
+    while (obj) {
+        fin_obj_t* next = obj->next;
+        fin_gc_free(ctx, obj);
+        obj = next;
+    }
+    fin_gc_page_t* page = heap->pages;
+    while (page) {
+        fin_gc_page_t* next = page->next;
+        ctx->alloc(page, 0);
+        page = next;
+    }
+    heap->objs = NULL;
+    heap->count = 0;
+    heap->pages = NULL;
+}
+
+void fin_gc_create(fin_ctx_t* ctx) {
+    fin_gc_t* gc = (fin_gc_t*)ctx->alloc(NULL, sizeof(fin_gc_t));
+    FIN_GC_LOCK_INIT(&gc->lock);
+    FIN_GC_COND_INIT(&gc->cond);
+    gc->heaps = NULL;
+    gc->running = 0;
+    gc->stop = 0;
+    gc->cycles = 0;
+    gc->parked = NULL;
+    gc->parked_count = 0;
+    gc->limit = FIN_GC_MIN_LIMIT;
+    gc->ctx = ctx;
+    fin_gc_heap_init(gc, &gc->orphans, NULL);
+    ctx->gc = gc;
+}
+
+// Frees every object, the vms of the context are destroyed by now.
+void fin_gc_destroy(fin_ctx_t* ctx) {
+    fin_gc_t* gc = (fin_gc_t*)ctx->gc;
+    assert(!gc->heaps);
+    fin_gc_heap_free(ctx, &gc->orphans);
+    FIN_GC_COND_FREE(&gc->cond);
+    FIN_GC_LOCK_FREE(&gc->lock);
+    ctx->alloc(gc, 0);
+    ctx->gc = NULL;
+}
+
+fin_gc_heap_t* fin_gc_heap_create(fin_ctx_t* ctx, fin_vm_t* vm) {
+    fin_gc_t* gc = (fin_gc_t*)ctx->gc;
+    fin_gc_heap_t* heap = (fin_gc_heap_t*)ctx->alloc(NULL, sizeof(fin_gc_heap_t));
+    FIN_GC_LOCK(&gc->lock);
+    fin_gc_heap_init(gc, heap, vm);
+    if (gc->orphans.allocs < gc->limit)
+        heap->limit = gc->limit - gc->orphans.allocs;
+    else
+        heap->limit = 1;
+    heap->next = gc->heaps;
+    gc->heaps = heap;
+    FIN_GC_UNLOCK(&gc->lock);
+    return heap;
+}
+
+// The objects of heap outlive its vm, results of the vm may refer to them,
+// and so do the pages holding them until a collection finds them empty. Its
+// free slots are dropped, its allocations bring the next collection closer.
+void fin_gc_heap_destroy(fin_gc_heap_t* heap) {
+    fin_gc_t* gc = heap->gc;
+    FIN_GC_LOCK(&gc->lock);
+    fin_gc_heap_t** it = &gc->heaps;
+    while (*it != heap)
+        it = &(*it)->next;
+    *it = heap->next;
+    gc->orphans.allocs += heap->allocs;
+    if (heap->objs) {
+        fin_obj_t* last = heap->objs;
+        while (last->next)
+            last = last->next;
+        last->next = gc->orphans.objs;
+        gc->orphans.objs = heap->objs;
+        gc->orphans.count += heap->count;
+        if (heap->max_size > gc->orphans.max_size)
+            gc->orphans.max_size = heap->max_size;
+        heap->objs = NULL;
+        fin_gc_page_t* page = heap->pages;
+        while (page && page->next) {
+            gc->orphans.allocs += FIN_GC_PAGE_ALLOCS;
+            page = page->next;
+        }
+        if (page) {
+            gc->orphans.allocs += FIN_GC_PAGE_ALLOCS;
+            page->next = gc->orphans.pages;
+            gc->orphans.pages = heap->pages;
+            heap->pages = NULL;
+        }
+    }
+    FIN_GC_UNLOCK(&gc->lock);
+    fin_gc_heap_free(gc->ctx, heap);
+    gc->ctx->alloc(heap, 0);
+}
+
+static inline fin_gc_entry_t* fin_gc_find(fin_gc_mark_t* mark, uintptr_t ptr) {
+    uint32_t idx = (uint32_t)((ptr >> 3) * 0x9E3779B1u) & mark->mask;
+    while (mark->entries[idx].obj) {
+        if ((uintptr_t)mark->entries[idx].obj == ptr)
+            return &mark->entries[idx];
+        idx = (idx + 1) & mark->mask;
+    }
+    return NULL;
+}
+
+static void fin_gc_mark_entry(fin_gc_mark_t* mark, fin_gc_entry_t* entry) {
+    if (!entry || entry->marked)
+        return;
+    entry->marked = true;
+    if (mark->stack_count == mark->stack_capacity) {
+        mark->stack_capacity = mark->stack_capacity ? mark->stack_capacity * 2 : 256;
+        mark->stack = (fin_gc_entry_t**)mark->ctx->alloc(mark->stack, sizeof(fin_gc_entry_t*) * mark->stack_capacity);
+    }
+    mark->stack[mark->stack_count++] = entry;
+}
+
+static void fin_gc_mark_ptr(fin_gc_mark_t* mark, uintptr_t ptr) {
+    if (ptr && !(ptr & (sizeof(void*) - 1)))
+        fin_gc_mark_entry(mark, fin_gc_find(mark, ptr));
+}
+
+// A word of the C stack may point into an object, optimized C code keeps the
+// address of a field at times. The starts it could have are tried in turn.
+static void fin_gc_mark_word(fin_gc_mark_t* mark, uintptr_t word) {
+    word &= ~(uintptr_t)(sizeof(void*) - 1);
+    for (int32_t offset = 0; offset < mark->max_size && offset <= word; offset += sizeof(void*)) {
+        fin_gc_entry_t* entry = fin_gc_find(mark, word - offset);
+        if (entry) {
+            fin_obj_t* obj = entry->obj;
+            if (word < (uintptr_t)(obj->fields + obj->type->fields_count))
+                fin_gc_mark_entry(mark, entry);
+            return;
+        }
+    }
+}
+
+static void fin_gc_mark_vals(void* arg, const fin_val_t* vals, int32_t count) {
+    for (int32_t i=0; i<count; i++)
+        fin_gc_mark_ptr((fin_gc_mark_t*)arg, (uintptr_t)vals[i].o);
+}
+
+// Marks what the words of a C stack between begin and end point into.
+static FIN_GC_NO_SANITIZE void fin_gc_mark_c_range(fin_gc_mark_t* mark, char* begin, char* end) {
+    if (begin > end) {
+        char* swap = begin;
+        begin = end;
+        end = swap;
+    }
+    uintptr_t* word = (uintptr_t*)(((uintptr_t)begin + sizeof(uintptr_t) - 1) & ~(uintptr_t)(sizeof(uintptr_t) - 1));
+    for (; (char*)(word + 1) <= end; word++)
+        fin_gc_mark_word(mark, *word);
+}
+
+// Marks what the words of the C stack point into, from here up to the
+// outermost script call, with the callee saved registers spilled below.
+static FIN_GC_NO_SANITIZE void fin_gc_mark_c_stack(fin_gc_mark_t* mark) {
+    jmp_buf regs;
+    FIN_GC_SPILL();
+    setjmp(regs);
+    fin_gc_mark_c_range(mark, (char*)&regs, fin_gc_stack_base);
+}
+
+// Parks the calling thread until the collection that set stop is over, with
+// its registers spilled so that the collector can scan its C stack. Called
+// with the lock held.
+static FIN_GC_NO_SANITIZE void fin_gc_park(fin_gc_t* gc) {
+    jmp_buf regs;
+    FIN_GC_SPILL();
+    setjmp(regs);
+    fin_gc_parked_t parked;
+    parked.begin = (char*)&regs;
+    parked.end = fin_gc_stack_base;
+    parked.next = gc->parked;
+    gc->parked = &parked;
+    gc->parked_count++;
+    FIN_GC_WAKE(&gc->cond);
+    while (gc->stop)
+        FIN_GC_WAIT(&gc->cond, &gc->lock);
+    fin_gc_parked_t** it = &gc->parked;
+    while (*it != &parked)
+        it = &(*it)->next;
+    *it = parked.next;
+    gc->parked_count--;
+}
+
+// Sets stop and waits for the threads running script code, other than the
+// calling one when self, to park. A thread blocked in a native never does,
+// after FIN_GC_WAIT_MS the collection is put off and they are let go.
+static bool fin_gc_stop_world(fin_gc_t* gc, bool self) {
+    if (gc->running == (self ? 1 : 0))
+        return true;
+    __atomic_store_n(&gc->stop, 1, __ATOMIC_RELAXED);
+    int32_t waited = 0;
+    while (gc->parked_count < gc->running - (self ? 1 : 0) && waited < FIN_GC_WAIT_MS) {
+        if (FIN_GC_WAIT_1MS(&gc->cond, &gc->lock))
+            waited++;
+    }
+    if (gc->parked_count == gc->running - (self ? 1 : 0))
+        return true;
+    __atomic_store_n(&gc->stop, 0, __ATOMIC_RELAXED);
+    FIN_GC_WAKE(&gc->cond);
+    return false;
+}
+
+static int fin_gc_page_compare(const void* a, const void* b) {
+    uintptr_t page_a = (uintptr_t)*(fin_gc_page_t* const*)a;
+    uintptr_t page_b = (uintptr_t)*(fin_gc_page_t* const*)b;
+    return page_a < page_b ? -1 : page_a > page_b ? 1 : 0;
+}
+
+// Frees the pages of destroyed vms that no longer hold a live object. Runs
+// after a sweep, which leaves only the live objects in the orphans.
+static void fin_gc_release_pages(fin_gc_t* gc) {
+    fin_ctx_t* ctx = gc->ctx;
+    int32_t count = 0;
+    for (fin_gc_page_t* page = gc->orphans.pages; page; page = page->next)
+        count++;
+    if (!count)
+        return;
+    fin_gc_page_t** pages = (fin_gc_page_t**)ctx->alloc(NULL, sizeof(fin_gc_page_t*) * count);
+    bool* used = (bool*)ctx->alloc(NULL, sizeof(bool) * count);
+    count = 0;
+    for (fin_gc_page_t* page = gc->orphans.pages; page; page = page->next) {
+        used[count] = false;
+        pages[count++] = page;
+    }
+    qsort(pages, count, sizeof(fin_gc_page_t*), &fin_gc_page_compare);
+
+    for (fin_obj_t* obj = gc->orphans.objs; obj; obj = obj->next) {
+        if (obj->type->fields_count >= FIN_GC_CLASSES)
+            continue;
+        int32_t lo = 0;
+        int32_t hi = count - 1;
+        while (lo < hi) {
+            int32_t mid = (lo + hi + 1) / 2;
+            if ((char*)pages[mid] > (char*)obj)
+                hi = mid - 1;
+            else
+                lo = mid;
+        }
+        assert((char*)obj > (char*)pages[lo] && (char*)obj < (char*)pages[lo] + FIN_GC_PAGE_SIZE);
+        used[lo] = true;
+    }
+
+    gc->orphans.pages = NULL;
+    for (int32_t i=0; i<count; i++) {
+        if (used[i]) {
+            pages[i]->next = gc->orphans.pages;
+            gc->orphans.pages = pages[i];
+        }
+        else
+            ctx->alloc(pages[i], 0);
+    }
+    ctx->alloc(used, 0);
+    ctx->alloc(pages, 0);
+}
+
+// Collects once the other threads running script code park, or parks the
+// calling thread when self and another collection waits for it. False when
+// nothing was collected. Called with the lock held.
+static bool fin_gc_run(fin_gc_t* gc, bool self) {
+    if (gc->stop) {
+        if (!self)
+            return false;
+        int32_t cycles = gc->cycles;
+        fin_gc_park(gc);
+        return gc->cycles != cycles;
+    }
+    if (!fin_gc_stop_world(gc, self))
+        return false;
+    fin_ctx_t* ctx = gc->ctx;
+    int32_t count = 0;
+    fin_gc_mark_t mark;
+    mark.max_size = 0;
+    for (fin_gc_heap_t* heap = &gc->orphans; heap; heap = heap == &gc->orphans ? gc->heaps : heap->next) {
+        count += heap->count;
+        if (heap->max_size > mark.max_size)
+            mark.max_size = heap->max_size;
+    }
+    uint32_t capacity = 64;
+    while (capacity < (uint32_t)count * 2)
+        capacity *= 2;
+    mark.entries = (fin_gc_entry_t*)ctx->alloc(NULL, sizeof(fin_gc_entry_t) * capacity);
+    memset(mark.entries, 0, sizeof(fin_gc_entry_t) * capacity);
+    mark.mask = capacity - 1;
+    mark.stack = NULL;
+    mark.stack_count = 0;
+    mark.stack_capacity = 0;
+    mark.ctx = ctx;
+
+    for (fin_gc_heap_t* heap = &gc->orphans; heap; heap = heap == &gc->orphans ? gc->heaps : heap->next) {
+        for (fin_obj_t* obj = heap->objs; obj; obj = obj->next) {
+            uint32_t idx = (uint32_t)(((uintptr_t)obj >> 3) * 0x9E3779B1u) & mark.mask;
+            while (mark.entries[idx].obj)
+                idx = (idx + 1) & mark.mask;
+            mark.entries[idx].obj = obj;
+            mark.entries[idx].heap = heap;
+        }
+        heap->objs = NULL;
+        heap->count = 0;
+    }
+
+    for (fin_gc_heap_t* heap = gc->heaps; heap; heap = heap->next)
+        fin_vm_roots(heap->vm, &fin_gc_mark_vals, &mark);
+    if (self)
+        fin_gc_mark_c_stack(&mark);
+    for (fin_gc_parked_t* parked = gc->parked; parked; parked = parked->next)
+        fin_gc_mark_c_range(&mark, parked->begin, parked->end);
+    while (mark.stack_count) {
+        fin_obj_t* obj = mark.stack[--mark.stack_count]->obj;
+        for (int32_t i=0; i<obj->type->refs_count; i++)
+            fin_gc_mark_ptr(&mark, (uintptr_t)obj->fields[obj->type->refs[i]].o);
+    }
+
+    int32_t live = 0;
+    for (uint32_t i=0; i<=mark.mask; i++) {
+        fin_gc_entry_t* entry = &mark.entries[i];
+        if (!entry->obj)
+            continue;
+        if (entry->marked) {
+            entry->obj->next = entry->heap->objs;
+            entry->heap->objs = entry->obj;
+            entry->heap->count++;
+            live++;
+        }
+        else if (entry->obj->type->fields_count < FIN_GC_CLASSES) {
+            if (entry->heap == &gc->orphans)
+                continue;
+            fin_gc_class_t* cls = &entry->heap->classes[entry->obj->type->fields_count];
+            entry->obj->next = cls->free;
+            cls->free = entry->obj;
+        }
+        else
+            ctx->alloc(entry->obj, 0);
+    }
+    ctx->alloc(mark.entries, 0);
+    if (mark.stack)
+        ctx->alloc(mark.stack, 0);
+    fin_gc_release_pages(gc);
+
+    gc->limit = live > FIN_GC_MIN_LIMIT ? live : FIN_GC_MIN_LIMIT;
+    gc->orphans.allocs = 0;
+    for (fin_gc_heap_t* heap = gc->heaps; heap; heap = heap->next) {
+        heap->allocs = 0;
+        heap->limit = gc->limit;
+    }
+    gc->cycles++;
+    if (gc->stop) {
+        __atomic_store_n(&gc->stop, 0, __ATOMIC_RELAXED);
+        FIN_GC_WAKE(&gc->cond);
+    }
+    return true;
+}
+
+static void fin_gc_page_create(fin_gc_heap_t* heap, fin_gc_class_t* cls) {
+    fin_gc_page_t* page = (fin_gc_page_t*)heap->gc->ctx->alloc(NULL, FIN_GC_PAGE_SIZE);
+    page->next = heap->pages;
+    heap->pages = page;
+    cls->bump = (char*)page->data;
+    cls->end = (char*)page + FIN_GC_PAGE_SIZE;
+}
+
+fin_obj_t* fin_gc_alloc(fin_gc_heap_t* heap, int32_t fields_count) {
+    fin_gc_t* gc = heap->gc;
+    if (++heap->allocs >= heap->limit) {
+        FIN_GC_LOCK(&gc->lock);
+        if (!fin_gc_run(gc, fin_gc_depth > 0)) {
+            heap->allocs = 0;
+            if (heap->limit < INT32_MAX / 2)
+                heap->limit *= 2;
+        }
+        FIN_GC_UNLOCK(&gc->lock);
+    }
+    else if (fin_gc_depth > 0 && __atomic_load_n(&gc->stop, __ATOMIC_RELAXED))
+        fin_gc_safepoint(gc->ctx);
+    int32_t size = (int32_t)(sizeof(fin_obj_t) + sizeof(fin_val_t) * fields_count);
+    fin_obj_t* obj;
+    if (fields_count < FIN_GC_CLASSES) {
+        fin_gc_class_t* cls = &heap->classes[fields_count];
+        if (cls->free) {
+            obj = cls->free;
+            cls->free = obj->next;
+        }
+        else {
+            if (cls->bump + size > cls->end)
+                fin_gc_page_create(heap, cls);
+            obj = (fin_obj_t*)cls->bump;
+            cls->bump += size;
+        }
+    }
+    else
+        obj = (fin_obj_t*)gc->ctx->alloc(NULL, size);
+    if (size > heap->max_size)
+        heap->max_size = size;
+    obj->next = heap->objs;
+    heap->objs = obj;
+    heap->count++;
+    return obj;
+}
+
+// Brackets the script code run by a vm. stack_base is an address in the
+// frame of the caller, the outermost one of the thread bounds the scan of
+// its C stack. A thread does not start running script code while a
+// collection waits for the others to park.
+void fin_gc_enter(fin_ctx_t* ctx, void* stack_base) {
+    fin_gc_t* gc = (fin_gc_t*)ctx->gc;
+    if (fin_gc_depth++ > 0)
+        return;
+    fin_gc_stack_base = (char*)stack_base;
+    FIN_GC_LOCK(&gc->lock);
+    while (gc->stop)
+        FIN_GC_WAIT(&gc->cond, &gc->lock);
+    gc->running++;
+    FIN_GC_UNLOCK(&gc->lock);
+}
+
+void fin_gc_leave(fin_ctx_t* ctx) {
+    fin_gc_t* gc = (fin_gc_t*)ctx->gc;
+    if (--fin_gc_depth > 0)
+        return;
+    fin_gc_stack_base = NULL;
+    FIN_GC_LOCK(&gc->lock);
+    gc->running--;
+    if (gc->stop)
+        FIN_GC_WAKE(&gc->cond);
+    FIN_GC_UNLOCK(&gc->lock);
+}
+
+// Non-zero while a collection waits for the threads running script code to
+// reach a safepoint. Polled at back edges and calls by the interpreters, and
+// by jitted and translated code.
+const int32_t* fin_gc_stopping(fin_ctx_t* ctx) {
+    return &((fin_gc_t*)ctx->gc)->stop;
+}
+
+// Parks the calling thread, which runs script code, while a collection waits
+// for it.
+void fin_gc_safepoint(fin_ctx_t* ctx) {
+    fin_gc_t* gc = (fin_gc_t*)ctx->gc;
+    FIN_GC_LOCK(&gc->lock);
+    if (gc->stop)
+        fin_gc_park(gc);
+    FIN_GC_UNLOCK(&gc->lock);
+}
+
+// Collects now, from the host or from a native of the context. False when a
+// thread running script code did not park in time.
+bool fin_gc_collect(fin_ctx_t* ctx) {
+    fin_gc_t* gc = (fin_gc_t*)ctx->gc;
+    FIN_GC_LOCK(&gc->lock);
+    bool done = fin_gc_run(gc, fin_gc_depth > 0);
+    FIN_GC_UNLOCK(&gc->lock);
+    return done;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#ifndef FIN_GC_H
+#define FIN_GC_H
+
+#include <fin/fin.h>
+
+typedef struct fin_vm_t      fin_vm_t;
+typedef struct fin_gc_heap_t fin_gc_heap_t;
+
+// Mark and sweep collector of the struct objects of a context. Every vm
+// allocates into a heap of its own without locking, and a heap that allocated
+// as many objects as survived the last collection starts the next one. The
+// other threads running script code, see fin_gc_enter, park first at a
+// safepoint: an allocation, a back edge or a call, in every vm mode and in
+// jitted and translated code. A collection that waits longer than a few
+// milliseconds, for a thread blocked in a native, is put off and the heap
+// that started it grows.
+//
+// Roots are found conservatively: a value on the stack of any vm that points
+// to an object, or a word on the C stack of the collecting thread or of a
+// parked one that points into one, keeps it alive. That covers jitted and
+// translated code, which keep values in registers and C locals, without stack
+// maps. From the roots objects are traced precisely, through the fields their
+// struct type declares as structs. Objects returned to the host stay valid
+// until the next script call in the context, and only while no other thread
+// runs its scripts: the workers of a fin_pool_t collect at any time.
+//
+// Objects of up to 16 fields are cut from pages of a size class per field
+// count, so that allocating pops a freed one or bumps a pointer, and objects
+// of a type sit next to each other. Pages are kept until their heap goes, and
+// then until a collection finds no live object on them.
+
+void           fin_gc_create(fin_ctx_t* ctx);
+void           fin_gc_destroy(fin_ctx_t* ctx);
+fin_gc_heap_t* fin_gc_heap_create(fin_ctx_t* ctx, fin_vm_t* vm);
+void           fin_gc_heap_destroy(fin_gc_heap_t* heap);
+fin_obj_t*     fin_gc_alloc(fin_gc_heap_t* heap, int32_t fields_count);
+void           fin_gc_enter(fin_ctx_t* ctx, void* stack_base);
+void           fin_gc_leave(fin_ctx_t* ctx);
+const int32_t* fin_gc_stopping(fin_ctx_t* ctx);
+void           fin_gc_safepoint(fin_ctx_t* ctx);
+bool           fin_gc_collect(fin_ctx_t* ctx);
+
+#endif //#ifndef FIN_GC_H
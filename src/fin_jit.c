@@ -0,0 +1,694 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "fin_jit.h"
+#include "fin_ctx.h"
+#include "fin_gc.h"
+#include "fin_mod.h"
+#include "fin_obj.h"
+#include "fin_op.h"
+#include "fin_vm.h"
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#if FIN_JIT && defined(__x86_64__) && defined(__linux__)
+    #define FIN_JIT_X64 1
+    #include <pthread.h>
+    #include <sys/mman.h>
+#else
+    #define FIN_JIT_X64 0
+#endif
+
+#if FIN_JIT_X64
+
+// Baseline x86-64 code, one template per stack instruction. The frame keeps
+// the layout of the interpreter:
+//   rbx  args
+//   r12  locals
+//   r13  operand stack top
+//   r14  vm
+// Every function starts with the same prologue, so that a tail call can set
+// up rbx and r12 and jump past it into the body of the callee.
+
+#define FIN_JIT_RAX 0
+#define FIN_JIT_RCX 1
+#define FIN_JIT_RDX 2
+#define FIN_JIT_RBX 3
+#define FIN_JIT_R12 12
+#define FIN_JIT_R13 13
+
+#define FIN_JIT_ARGS   FIN_JIT_RBX
+#define FIN_JIT_LOCALS FIN_JIT_R12
+#define FIN_JIT_TOP    FIN_JIT_R13
+
+#define FIN_JIT_PROLOGUE 20
+#define FIN_JIT_HEADER   16
+
+#define FIN_JIT_SIZE(op, size)                 size,
+#define FIN_JIT_SIZE_EXPR(op, res, expr, sign) 0,
+#define FIN_JIT_BASE(op, size)                 fin_op_##op,
+#define FIN_JIT_BASE_EXPR(op, res, expr, sign) fin_op_##op,
+#define FIN_JIT_BASE_SUPER2(a, b)              fin_op_##a,
+#define FIN_JIT_BASE_SUPER3(a, b, c)           fin_op_##a,
+#define FIN_JIT_BASE_SUPER4(a, b, c, d)        fin_op_##a,
+
+static const uint8_t fin_jit_op_sizes[fin_op_count] = {
+    FIN_OP_LIST(FIN_JIT_SIZE)
+    FIN_OP_UNARY_LIST(FIN_JIT_SIZE_EXPR)
+    FIN_OP_BINARY_LIST(FIN_JIT_SIZE_EXPR)
+};
+
+// Superinstructions are compiled as the sequence they replace.
+static const uint8_t fin_jit_op_base[fin_op_count] = {
+    FIN_OP_LIST(FIN_JIT_BASE)
+    FIN_OP_UNARY_LIST(FIN_JIT_BASE_EXPR)
+    FIN_OP_BINARY_LIST(FIN_JIT_BASE_EXPR)
+    FIN_OP_SUPER2_LIST(FIN_JIT_BASE_SUPER2)
+    FIN_OP_SUPER3_LIST(FIN_JIT_BASE_SUPER3)
+    FIN_OP_SUPER4_LIST(FIN_JIT_BASE_SUPER4)
+};
+
+typedef struct fin_jit_fixup_t {
+    int32_t at;
+    int32_t target;
+} fin_jit_fixup_t;
+
+typedef struct fin_jit_t {
+    fin_ctx_t*       ctx;
+    fin_mod_func_t*  func;
+    uint8_t*         begin;
+    uint8_t*         top;
+    uint8_t*         end;
+    int32_t*         native_at;
+    fin_jit_fixup_t* fixups;
+    int32_t          fixups_count;
+    int32_t          epilogue;
+} fin_jit_t;
+
+static void fin_jit_ensure(fin_jit_t* jit, int32_t size) {
+    if (jit->top + size >= jit->end) {
+        int32_t length = (int32_t)(jit->end - jit->begin) * 2;
+        uint8_t* buffer = (uint8_t*)jit->ctx->alloc(jit->begin, length);
+        jit->top   = buffer + (jit->top - jit->begin);
+        jit->begin = buffer;
+        jit->end   = buffer + length;
+    }
+}
+
+static int32_t fin_jit_pos(fin_jit_t* jit) {
+    return (int32_t)(jit->top - jit->begin);
+}
+
+static void fin_jit_emit(fin_jit_t* jit, const uint8_t* bytes, int32_t count) {
+    fin_jit_ensure(jit, count);
+    memcpy(jit->top, bytes, count);
+    jit->top += count;
+}
+
+static void fin_jit_emit8(fin_jit_t* jit, uint8_t val) {
+    fin_jit_emit(jit, &val, 1);
+}
+
+static void fin_jit_emit32(fin_jit_t* jit, int32_t val) {
+    uint8_t bytes[4] = { val & 0xFF, (val >> 8) & 0xFF, (val >> 16) & 0xFF, (val >> 24) & 0xFF };
+    fin_jit_emit(jit, bytes, 4);
+}
+
+static void fin_jit_emit64(fin_jit_t* jit, uint64_t val) {
+    fin_jit_emit32(jit, (int32_t)(val & 0xFFFFFFFF));
+    fin_jit_emit32(jit, (int32_t)(val >> 32));
+}
+
+#define FIN_JIT_EMIT(jit, ...) do {                                \
+            static const uint8_t bytes[] = { __VA_ARGS__ };        \
+            fin_jit_emit(jit, bytes, sizeof(bytes));               \
+        } while (0)
+
+// [prefix] rex opcode modrm(reg, [base + disp32])
+static void fin_jit_mem(fin_jit_t* jit, uint8_t prefix, bool wide, const char* opcode, int32_t reg, int32_t base, int32_t disp) {
+    uint8_t rex = (wide ? 0x48 : 0x40) | (reg & 8 ? 0x04 : 0) | (base & 8 ? 0x01 : 0);
+    if (prefix)
+        fin_jit_emit8(jit, prefix);
+    if (rex != 0x40)
+        fin_jit_emit8(jit, rex);
+    fin_jit_emit(jit, (const uint8_t*)opcode, (int32_t)strlen(opcode));
+    fin_jit_emit8(jit, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == 4)
+        fin_jit_emit8(jit, 0x24);
+    fin_jit_emit32(jit, disp);
+}
+
+#define FIN_JIT_LOAD(jit, reg, base, disp)  fin_jit_mem(jit, 0, true, "\x8B", reg, base, disp)
+#define FIN_JIT_STORE(jit, reg, base, disp) fin_jit_mem(jit, 0, true, "\x89", reg, base, disp)
+
+// mov rax, imm64
+static void fin_jit_imm(fin_jit_t* jit, uint64_t val) {
+    FIN_JIT_EMIT(jit, 0x48, 0xB8);
+    fin_jit_emit64(jit, val);
+}
+
+// lea r13, [r13 + count * 8]
+static void fin_jit_top(fin_jit_t* jit, int32_t count) {
+    if (count)
+        fin_jit_mem(jit, 0, true, "\x8D", FIN_JIT_TOP, FIN_JIT_TOP, count * 8);
+}
+
+static void fin_jit_push(fin_jit_t* jit) {
+    FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_TOP, 0);
+    fin_jit_top(jit, 1);
+}
+
+static void fin_jit_call(fin_jit_t* jit, const void* target) {
+    fin_jit_imm(jit, (uint64_t)(uintptr_t)target);
+    FIN_JIT_EMIT(jit, 0xFF, 0xD0);                          // call rax
+}
+
+// Short forward jump to patch with fin_jit_land.
+static int32_t fin_jit_skip(fin_jit_t* jit, uint8_t opcode) {
+    fin_jit_emit8(jit, opcode);
+    fin_jit_emit8(jit, 0);
+    return fin_jit_pos(jit);
+}
+
+static void fin_jit_land(fin_jit_t* jit, int32_t at) {
+    int32_t offset = fin_jit_pos(jit) - at;
+    assert(offset < 0x80);
+    jit->begin[at - 1] = (uint8_t)offset;
+}
+
+// Jump to the instruction at target, resolved once all of them are placed.
+static void fin_jit_branch(fin_jit_t* jit, const char* opcode, int32_t target) {
+    fin_jit_emit(jit, (const uint8_t*)opcode, (int32_t)strlen(opcode));
+    fin_jit_emit32(jit, 0);
+    if ((jit->fixups_count & (jit->fixups_count - 1)) == 0 && jit->fixups_count >= 16)
+        jit->fixups = (fin_jit_fixup_t*)jit->ctx->alloc(jit->fixups, sizeof(fin_jit_fixup_t) * jit->fixups_count * 2);
+    jit->fixups[jit->fixups_count].at = fin_jit_pos(jit);
+    jit->fixups[jit->fixups_count].target = target;
+    jit->fixups_count++;
+}
+
+static void fin_jit_return(fin_jit_t* jit) {
+    if (jit->func->ret_type) {
+        FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -8);
+        FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_ARGS, 0);
+    }
+    if (jit->epilogue >= 0) {
+        fin_jit_emit8(jit, 0xE9);
+        fin_jit_emit32(jit, jit->epilogue - fin_jit_pos(jit) - 4);
+        return;
+    }
+    jit->epilogue = fin_jit_pos(jit);
+    FIN_JIT_EMIT(jit, 0x48, 0x83, 0xC4, 0x18,               // add rsp, 24
+                      0x41, 0x5E,                           // pop r14
+                      0x41, 0x5D,                           // pop r13
+                      0x41, 0x5C,                           // pop r12
+                      0x5B,                                 // pop rbx
+                      0xC3);                                // ret
+}
+
+// Calls through fin_vm_jit_call, which counts the frame and runs the callee
+// jitted or interpreted.
+static void fin_jit_call_script(fin_jit_t* jit, fin_mod_func_t* callee) {
+    FIN_JIT_EMIT(jit, 0x4C, 0x89, 0xF7);                    // mov rdi, r14
+    FIN_JIT_EMIT(jit, 0x48, 0xBE);                          // mov rsi, callee
+    fin_jit_emit64(jit, (uint64_t)(uintptr_t)callee);
+    FIN_JIT_EMIT(jit, 0x4C, 0x89, 0xEA);                    // mov rdx, r13
+    fin_jit_call(jit, (const void*)&fin_vm_jit_call);
+    fin_jit_top(jit, (callee->ret_type ? 1 : 0) - callee->args);
+}
+
+static void fin_jit_call_native(fin_jit_t* jit, fin_mod_func_t* callee) {
+    fin_jit_mem(jit, 0, true, "\x8D", 6, FIN_JIT_TOP, -8 * callee->args); // lea rsi, args
+    FIN_JIT_EMIT(jit, 0x48, 0x89, 0xE2);                    // mov rdx, rsp
+    FIN_JIT_EMIT(jit, 0x48, 0xBF);                          // mov rdi, ctx
+    fin_jit_emit64(jit, (uint64_t)(uintptr_t)jit->ctx);
+    fin_jit_call(jit, (const void*)callee->func);
+    if (callee->ret_type) {
+        FIN_JIT_EMIT(jit, 0x48, 0x8B, 0x04, 0x24);          // mov rax, [rsp]
+        FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_TOP, -8 * callee->args);
+    }
+    fin_jit_top(jit, (callee->ret_type ? 1 : 0) - callee->args);
+}
+
+// Parks at a back edge or a self tail call while a collection waits for the
+// vm, see FIN_VM_SAFEPOINT.
+static void fin_jit_safepoint(fin_jit_t* jit) {
+    fin_jit_imm(jit, (uint64_t)(uintptr_t)fin_gc_stopping(jit->ctx));
+    fin_jit_mem(jit, 0, false, "\x83", 7, FIN_JIT_RAX, 0); // cmp dword [rax], imm8
+    fin_jit_emit8(jit, 0);
+    int32_t running = fin_jit_skip(jit, 0x74);              // jz
+    FIN_JIT_EMIT(jit, 0x48, 0xBF);                          // mov rdi, ctx
+    fin_jit_emit64(jit, (uint64_t)(uintptr_t)jit->ctx);
+    fin_jit_call(jit, (const void*)&fin_gc_safepoint);
+    fin_jit_land(jit, running);
+}
+
+// A tail call to jitted code of the same frame size or smaller reuses the
+// frame, which was checked against the value stack on entry. Anything else
+// is called and returned from.
+static void fin_jit_tail_call(fin_jit_t* jit, fin_mod_func_t* callee) {
+    fin_mod_func_t* func = jit->func;
+    if (callee->is_native || callee->is_reg ||
+        callee->args + callee->locals + callee->stack > func->args + func->locals + func->stack) {
+        if (callee->is_native)
+            fin_jit_call_native(jit, callee);
+        else
+            fin_jit_call_script(jit, callee);
+        fin_jit_return(jit);
+        return;
+    }
+    for (int32_t i=0; i<callee->args; i++) {
+        FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -8 * (callee->args - i));
+        FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_ARGS, 8 * i);
+    }
+    fin_jit_imm(jit, (uint64_t)(uintptr_t)&callee->jit);
+    FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_RAX, 0);
+    FIN_JIT_EMIT(jit, 0x48, 0x85, 0xC0);                    // test rax, rax
+    int32_t interpreted = fin_jit_skip(jit, 0x74);          // jz
+    fin_jit_safepoint(jit);
+    fin_jit_imm(jit, (uint64_t)(uintptr_t)&callee->jit);
+    FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_RAX, 0);
+    fin_jit_mem(jit, 0, true, "\x8D", FIN_JIT_LOCALS, FIN_JIT_ARGS, 8 * callee->args);
+    FIN_JIT_EMIT(jit, 0x48, 0x83, 0xC0, FIN_JIT_PROLOGUE,   // add rax, prologue
+                      0xFF, 0xE0);                          // jmp rax
+    fin_jit_land(jit, interpreted);
+    fin_jit_mem(jit, 0, true, "\x8D", FIN_JIT_TOP, FIN_JIT_ARGS, 8 * callee->args);
+    fin_jit_call_script(jit, callee);
+    fin_jit_return(jit);
+}
+
+// rax = a, then op with b, a replaced by the result.
+static void fin_jit_binary_i(fin_jit_t* jit, const char* opcode) {
+    FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -16);
+    fin_jit_mem(jit, 0, true, opcode, FIN_JIT_RAX, FIN_JIT_TOP, -8);
+    FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_TOP, -16);
+    fin_jit_top(jit, -1);
+}
+
+static void fin_jit_binary_f(fin_jit_t* jit, const char* opcode) {
+    fin_jit_mem(jit, 0xF2, false, "\x0F\x10", 0, FIN_JIT_TOP, -16);  // movsd xmm0, a
+    fin_jit_mem(jit, 0xF2, false, opcode, 0, FIN_JIT_TOP, -8);
+    fin_jit_mem(jit, 0xF2, false, "\x0F\x11", 0, FIN_JIT_TOP, -16);  // movsd a, xmm0
+    fin_jit_top(jit, -1);
+}
+
+// Comparisons write the bool byte of the result, like the interpreter.
+static void fin_jit_compare_i(fin_jit_t* jit, uint8_t setcc) {
+    FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -16);
+    fin_jit_mem(jit, 0, true, "\x3B", FIN_JIT_RAX, FIN_JIT_TOP, -8);  // cmp rax, b
+    FIN_JIT_EMIT(jit, 0x0F);
+    fin_jit_emit8(jit, setcc);
+    fin_jit_emit8(jit, 0xC0);                               // setcc al
+    fin_jit_mem(jit, 0, false, "\x88", FIN_JIT_RAX, FIN_JIT_TOP, -16);
+    fin_jit_top(jit, -1);
+}
+
+// ucomisd x, y with x and y swapped for lt and leq, so that unordered
+// operands compare false.
+static void fin_jit_compare_f(fin_jit_t* jit, bool swap, uint8_t setcc) {
+    fin_jit_mem(jit, 0xF2, false, "\x0F\x10", 0, FIN_JIT_TOP, swap ? -8 : -16);
+    fin_jit_mem(jit, 0x66, false, "\x0F\x2E", 0, FIN_JIT_TOP, swap ? -16 : -8);
+    FIN_JIT_EMIT(jit, 0x0F);
+    fin_jit_emit8(jit, setcc);
+    fin_jit_emit8(jit, 0xC0);                               // setcc al
+    if (setcc == 0x94)
+        FIN_JIT_EMIT(jit, 0x0F, 0x9B, 0xC1, 0x20, 0xC8);    // setnp cl, and al, cl
+    else if (setcc == 0x95)
+        FIN_JIT_EMIT(jit, 0x0F, 0x9A, 0xC1, 0x08, 0xC8);    // setp cl, or al, cl
+    fin_jit_mem(jit, 0, false, "\x88", FIN_JIT_RAX, FIN_JIT_TOP, -16);
+    fin_jit_top(jit, -1);
+}
+
+// Instructions without a template run their interpreter implementation.
+static void fin_jit_exec(fin_jit_t* jit, fin_op_t op) {
+    FIN_JIT_EMIT(jit, 0x4C, 0x89, 0xF7);                    // mov rdi, r14
+    FIN_JIT_EMIT(jit, 0x4C, 0x89, 0xEE);                    // mov rsi, r13
+    fin_jit_emit8(jit, 0xBA);                               // mov edx, op
+    fin_jit_emit32(jit, op);
+    fin_jit_call(jit, (const void*)&fin_vm_jit_exec);
+    FIN_JIT_EMIT(jit, 0x49, 0x89, 0xC5);                    // mov r13, rax
+}
+
+static void fin_jit_op(fin_jit_t* jit, fin_op_t op, uint32_t x, int32_t next) {
+    fin_mod_t* mod = jit->func->mod;
+    switch (op) {
+        case fin_op_load_const:
+            fin_jit_imm(jit, (uint64_t)mod->consts[x].i);
+            fin_jit_push(jit);
+            break;
+        case fin_op_load_arg:
+            FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_ARGS, 8 * x);
+            fin_jit_push(jit);
+            break;
+        case fin_op_store_arg:
+            FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -8);
+            FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_ARGS, 8 * x);
+            fin_jit_top(jit, -1);
+            break;
+        case fin_op_load_local:
+            FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_LOCALS, 8 * x);
+            fin_jit_push(jit);
+            break;
+        case fin_op_store_local:
+            FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -8);
+            FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_LOCALS, 8 * x);
+            fin_jit_top(jit, -1);
+            break;
+        case fin_op_load_field: {
+            FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -8);
+            FIN_JIT_EMIT(jit, 0x48, 0x85, 0xC0);            // test rax, rax
+            int32_t null = fin_jit_skip(jit, 0x74);         // jz
+            FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_RAX, offsetof(fin_obj_t, fields) + 8 * x);
+            FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_TOP, -8);
+            fin_jit_land(jit, null);
+            break;
+        }
+        case fin_op_store_field: {
+            FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -16);
+            FIN_JIT_EMIT(jit, 0x48, 0x85, 0xC0);            // test rax, rax
+            int32_t null = fin_jit_skip(jit, 0x74);         // jz
+            FIN_JIT_LOAD(jit, FIN_JIT_RCX, FIN_JIT_TOP, -8);
+            FIN_JIT_STORE(jit, FIN_JIT_RCX, FIN_JIT_RAX, offsetof(fin_obj_t, fields) + 8 * x);
+            fin_jit_land(jit, null);
+            fin_jit_top(jit, -2);
+            break;
+        }
+        case fin_op_call: {
+            fin_mod_func_t* callee = mod->binds[x].func;
+            if (callee->is_native)
+                fin_jit_call_native(jit, callee);
+            else
+                fin_jit_call_script(jit, callee);
+            break;
+        }
+        case fin_op_tail_call:
+            fin_jit_tail_call(jit, mod->binds[x].func);
+            break;
+        case fin_op_branch:
+            if ((int32_t)x < 0)
+                fin_jit_safepoint(jit);
+            fin_jit_branch(jit, "\xE9", next + (int32_t)x);
+            break;
+        case fin_op_branch_if:
+        case fin_op_branch_if_n:
+            if ((int32_t)x < 0)
+                fin_jit_safepoint(jit);
+            fin_jit_top(jit, -1);
+            fin_jit_mem(jit, 0, false, "\x80", 7, FIN_JIT_TOP, 0); // cmp byte [r13], imm8
+            fin_jit_emit8(jit, 0);
+            fin_jit_branch(jit, op == fin_op_branch_if ? "\x0F\x85" : "\x0F\x84", next + (int32_t)x);
+            break;
+        case fin_op_return:
+            fin_jit_return(jit);
+            break;
+        case fin_op_pop:
+            fin_jit_top(jit, -1);
+            break;
+        case fin_op_new:
+            FIN_JIT_EMIT(jit, 0x4C, 0x89, 0xF7);            // mov rdi, r14
+            FIN_JIT_EMIT(jit, 0x4C, 0x89, 0xEE);            // mov rsi, r13
+            FIN_JIT_EMIT(jit, 0x48, 0xBA);                  // mov rdx, type
+            fin_jit_emit64(jit, (uint64_t)(uintptr_t)mod->obj_types[x]);
+            fin_jit_call(jit, (const void*)&fin_vm_jit_new);
+            FIN_JIT_EMIT(jit, 0x49, 0x89, 0xC5);            // mov r13, rax
+            break;
+
+        case fin_op_pos_i:
+            break;
+        case fin_op_neg_i:
+            fin_jit_mem(jit, 0, true, "\xF7", 3, FIN_JIT_TOP, -8);
+            break;
+        case fin_op_not_i:
+            fin_jit_mem(jit, 0, true, "\x83", 7, FIN_JIT_TOP, -8); // cmp qword, imm8
+            fin_jit_emit8(jit, 0);
+            FIN_JIT_EMIT(jit, 0x0F, 0x94, 0xC0,             // sete al
+                              0x0F, 0xB6, 0xC0);            // movzx eax, al
+            FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_TOP, -8);
+            break;
+        case fin_op_bnot_i:
+            fin_jit_mem(jit, 0, true, "\xF7", 2, FIN_JIT_TOP, -8);
+            break;
+        case fin_op_inc_i:
+        case fin_op_dec_i:
+            fin_jit_mem(jit, 0, true, "\x83", op == fin_op_inc_i ? 0 : 5, FIN_JIT_TOP, -8);
+            fin_jit_emit8(jit, 1);
+            break;
+        case fin_op_neg_f:
+            fin_jit_imm(jit, 0x8000000000000000ull);
+            fin_jit_mem(jit, 0, true, "\x31", FIN_JIT_RAX, FIN_JIT_TOP, -8);
+            break;
+
+        case fin_op_and_b:
+        case fin_op_or_b:
+            fin_jit_mem(jit, 0, false, "\x8A", FIN_JIT_RAX, FIN_JIT_TOP, -16);
+            fin_jit_mem(jit, 0, false, op == fin_op_and_b ? "\x22" : "\x0A", FIN_JIT_RAX, FIN_JIT_TOP, -8);
+            fin_jit_mem(jit, 0, false, "\x88", FIN_JIT_RAX, FIN_JIT_TOP, -16);
+            fin_jit_top(jit, -1);
+            break;
+        case fin_op_add_i:  fin_jit_binary_i(jit, "\x03");     break;
+        case fin_op_sub_i:  fin_jit_binary_i(jit, "\x2B");     break;
+        case fin_op_mul_i:  fin_jit_binary_i(jit, "\x0F\xAF"); break;
+        case fin_op_band_i: fin_jit_binary_i(jit, "\x23");     break;
+        case fin_op_bor_i:  fin_jit_binary_i(jit, "\x0B");     break;
+        case fin_op_bxor_i: fin_jit_binary_i(jit, "\x33");     break;
+        case fin_op_div_i:
+        case fin_op_mod_i:
+            FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -16);
+            FIN_JIT_EMIT(jit, 0x48, 0x99);                  // cqo
+            fin_jit_mem(jit, 0, true, "\xF7", 7, FIN_JIT_TOP, -8); // idiv qword
+            FIN_JIT_STORE(jit, op == fin_op_div_i ? FIN_JIT_RAX : FIN_JIT_RDX, FIN_JIT_TOP, -16);
+            fin_jit_top(jit, -1);
+            break;
+        case fin_op_shl_i:
+        case fin_op_shr_i:
+            FIN_JIT_LOAD(jit, FIN_JIT_RAX, FIN_JIT_TOP, -16);
+            FIN_JIT_LOAD(jit, FIN_JIT_RCX, FIN_JIT_TOP, -8);
+            FIN_JIT_EMIT(jit, 0x48, 0xD3);
+            fin_jit_emit8(jit, op == fin_op_shl_i ? 0xE0 : 0xF8); // shl/sar rax, cl
+            FIN_JIT_STORE(jit, FIN_JIT_RAX, FIN_JIT_TOP, -16);
+            fin_jit_top(jit, -1);
+            break;
+        case fin_op_lt_i:   fin_jit_compare_i(jit, 0x9C);      break;
+        case fin_op_leq_i:  fin_jit_compare_i(jit, 0x9E);      break;
+        case fin_op_gt_i:   fin_jit_compare_i(jit, 0x9F);      break;
+        case fin_op_geq_i:  fin_jit_compare_i(jit, 0x9D);      break;
+        case fin_op_eq_i:
+        case fin_op_eq_s:   fin_jit_compare_i(jit, 0x94);      break;
+        case fin_op_neq_i:
+        case fin_op_neq_s:  fin_jit_compare_i(jit, 0x95);      break;
+        case fin_op_add_f:  fin_jit_binary_f(jit, "\x0F\x58"); break;
+        case fin_op_sub_f:  fin_jit_binary_f(jit, "\x0F\x5C"); break;
+        case fin_op_mul_f:  fin_jit_binary_f(jit, "\x0F\x59"); break;
+        case fin_op_div_f:  fin_jit_binary_f(jit, "\x0F\x5E"); break;
+        case fin_op_lt_f:   fin_jit_compare_f(jit, true,  0x97); break;
+        case fin_op_leq_f:  fin_jit_compare_f(jit, true,  0x93); break;
+        case fin_op_gt_f:   fin_jit_compare_f(jit, false, 0x97); break;
+        case fin_op_geq_f:  fin_jit_compare_f(jit, false, 0x93); break;
+        case fin_op_eq_f:   fin_jit_compare_f(jit, false, 0x94); break;
+        case fin_op_neq_f:  fin_jit_compare_f(jit, false, 0x95); break;
+        default:
+            fin_jit_exec(jit, op);
+            break;
+    }
+}
+
+// Translates the stack code of func. Binds must be resolved.
+bool fin_jit_compile(fin_ctx_t* ctx, fin_mod_func_t* func) {
+    fin_jit_t jit;
+    jit.ctx          = ctx;
+    jit.func         = func;
+    jit.begin        = (uint8_t*)ctx->alloc(NULL, 256);
+    jit.top          = jit.begin;
+    jit.end          = jit.begin + 256;
+    jit.native_at    = (int32_t*)ctx->alloc(NULL, sizeof(int32_t) * (func->code_length + 1));
+    jit.fixups       = (fin_jit_fixup_t*)ctx->alloc(NULL, sizeof(fin_jit_fixup_t) * 16);
+    jit.fixups_count = 0;
+    jit.epilogue     = -1;
+
+    FIN_JIT_EMIT(&jit, 0x53,                                // push rbx
+                       0x41, 0x54,                          // push r12
+                       0x41, 0x55,                          // push r13
+                       0x41, 0x56,                          // push r14
+                       0x48, 0x83, 0xEC, 0x18,              // sub rsp, 24
+                       0x49, 0x89, 0xFE,                    // mov r14, rdi
+                       0x48, 0x89, 0xF3,                    // mov rbx, rsi
+                       0x49, 0x89, 0xD4);                   // mov r12, rdx
+    assert(fin_jit_pos(&jit) == FIN_JIT_PROLOGUE);
+    fin_jit_mem(&jit, 0, true, "\x8D", FIN_JIT_TOP, FIN_JIT_LOCALS, 8 * func->locals);
+
+    const uint8_t* code = func->code;
+    for (int32_t pos = 0; pos < func->code_length;) {
+        bool wide = code[pos] == fin_op_wide;
+        fin_op_t op = (fin_op_t)fin_jit_op_base[code[wide ? pos + 1 : pos]];
+        const uint8_t* bytes = code + pos + (wide ? 2 : 1);
+        int32_t size = fin_jit_op_sizes[op] << (wide ? 1 : 0);
+        uint32_t x = 0;
+        for (int32_t i=0; i<size; i++)
+            x |= (uint32_t)bytes[i] << (i * 8);
+        int32_t next = (int32_t)(bytes + size - code);
+        if (size == 2 && !wide && op >= fin_op_branch && op <= fin_op_branch_if_n)
+            x = (uint32_t)(int32_t)(int16_t)x;
+
+        jit.native_at[pos] = fin_jit_pos(&jit);
+        fin_jit_op(&jit, op, x, next);
+        pos = next;
+    }
+
+    for (int32_t i=0; i<jit.fixups_count; i++) {
+        int32_t at = jit.fixups[i].at;
+        int32_t offset = jit.native_at[jit.fixups[i].target] - at;
+        memcpy(jit.begin + at - 4, &offset, 4);
+    }
+
+    bool result = false;
+    size_t length = FIN_JIT_HEADER + (jit.top - jit.begin);
+    uint8_t* mem = (uint8_t*)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+        memcpy(mem, &length, sizeof(length));
+        memcpy(mem + FIN_JIT_HEADER, jit.begin, jit.top - jit.begin);
+        if (mprotect(mem, length, PROT_READ | PROT_EXEC) == 0) {
+            // Published to the interpreter, which may be running on another
+            // thread in tiered mode.
+            __atomic_store_n(&func->jit, mem + FIN_JIT_HEADER, __ATOMIC_RELEASE);
+            result = true;
+        }
+        else
+            munmap(mem, length);
+    }
+
+    ctx->alloc(jit.fixups, 0);
+    ctx->alloc(jit.native_at, 0);
+    ctx->alloc(jit.begin, 0);
+    return result;
+}
+
+void fin_jit_free(fin_ctx_t* ctx, fin_mod_func_t* func) {
+    if (!func->jit)
+        return;
+    uint8_t* mem = (uint8_t*)func->jit - FIN_JIT_HEADER;
+    size_t length;
+    memcpy(&length, mem, sizeof(length));
+    munmap(mem, length);
+    func->jit = NULL;
+}
+
+// Tiered mode compiles hot functions on a thread of the context, in the
+// order they got hot. The code and the binds of a linked module don't change,
+// and the allocator of the context must be thread safe.
+
+#define FIN_JIT_QUEUE_SIZE 64
+
+typedef struct fin_jit_queue_t {
+    fin_ctx_t*      ctx;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    fin_mod_func_t* funcs[FIN_JIT_QUEUE_SIZE];
+    int32_t         head;
+    int32_t         count;
+    bool            stop;
+} fin_jit_queue_t;
+
+static void* fin_jit_worker(void* arg) {
+    fin_jit_queue_t* queue = (fin_jit_queue_t*)arg;
+    pthread_mutex_lock(&queue->lock);
+    while (true) {
+        while (!queue->count && !queue->stop)
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        if (queue->stop)
+            break;
+        fin_mod_func_t* func = queue->funcs[queue->head];
+        queue->head = (queue->head + 1) % FIN_JIT_QUEUE_SIZE;
+        queue->count--;
+        pthread_mutex_unlock(&queue->lock);
+        fin_jit_compile(queue->ctx, func);
+        pthread_mutex_lock(&queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+static pthread_mutex_t fin_jit_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Called by the interpreter when a counter of func crosses its threshold,
+// possibly from several vms of a fin_pool_t at once.
+void fin_jit_tier_up(fin_ctx_t* ctx, fin_mod_func_t* func) {
+    if (ctx->vm_mode != fin_vm_mode_tiered || func->is_reg || __atomic_load_n(&func->jit, __ATOMIC_ACQUIRE))
+        return;
+    if (__atomic_exchange_n(&func->is_hot, true, __ATOMIC_RELAXED))
+        return;
+
+    fin_jit_queue_t* queue = (fin_jit_queue_t*)__atomic_load_n(&ctx->jit, __ATOMIC_ACQUIRE);
+    if (!queue) {
+        pthread_mutex_lock(&fin_jit_queue_lock);
+        queue = (fin_jit_queue_t*)ctx->jit;
+        if (!queue) {
+            queue = (fin_jit_queue_t*)ctx->alloc(NULL, sizeof(fin_jit_queue_t));
+            queue->ctx   = ctx;
+            queue->head  = 0;
+            queue->count = 0;
+            queue->stop  = false;
+            pthread_mutex_init(&queue->lock, NULL);
+            pthread_cond_init(&queue->cond, NULL);
+            if (pthread_create(&queue->thread, NULL, &fin_jit_worker, queue) != 0) {
+                pthread_cond_destroy(&queue->cond);
+                pthread_mutex_destroy(&queue->lock);
+                ctx->alloc(queue, 0);
+                queue = NULL;
+            }
+            else
+                __atomic_store_n(&ctx->jit, queue, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&fin_jit_queue_lock);
+        if (!queue)
+            return;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count < FIN_JIT_QUEUE_SIZE) {
+        queue->funcs[(queue->head + queue->count) % FIN_JIT_QUEUE_SIZE] = func;
+        queue->count++;
+        pthread_cond_signal(&queue->cond);
+    }
+    else
+        __atomic_store_n(&func->is_hot, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Stops the compiler thread, dropping the functions still queued.
+void fin_jit_shutdown(fin_ctx_t* ctx) {
+    fin_jit_queue_t* queue = (fin_jit_queue_t*)ctx->jit;
+    if (!queue)
+        return;
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = true;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->thread, NULL);
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    ctx->alloc(queue, 0);
+    ctx->jit = NULL;
+}
+
+#else
+
+bool fin_jit_compile(fin_ctx_t* ctx, fin_mod_func_t* func) {
+    return false;
+}
+
+void fin_jit_free(fin_ctx_t* ctx, fin_mod_func_t* func) {
+}
+
+void fin_jit_tier_up(fin_ctx_t* ctx, fin_mod_func_t* func) {
+}
+
+void fin_jit_shutdown(fin_ctx_t* ctx) {
+}
+
+#endif //#if FIN_JIT_X64
@@ -0,0 +1,23 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#ifndef FIN_JIT_H
+#define FIN_JIT_H
+
+#include <fin/fin.h>
+
+typedef struct fin_vm_t       fin_vm_t;
+typedef struct fin_mod_func_t fin_mod_func_t;
+
+// Machine code of a stack function. Takes the args of the call, followed by
+// the locals and operands of the function, as laid out by the interpreter.
+typedef void (*fin_jit_func_t)(fin_vm_t* vm, fin_val_t* args, fin_val_t* stack);
+
+bool fin_jit_compile(fin_ctx_t* ctx, fin_mod_func_t* func);
+void fin_jit_free(fin_ctx_t* ctx, fin_mod_func_t* func);
+void fin_jit_tier_up(fin_ctx_t* ctx, fin_mod_func_t* func);
+void fin_jit_shutdown(fin_ctx_t* ctx);
+
+#endif //#ifndef FIN_JIT_H
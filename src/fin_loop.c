@@ -0,0 +1,570 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "fin_loop.h"
+#include "fin_ctx.h"
+#include "fin_fiber.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__linux__)
+    #define FIN_LOOP_EPOLL 1
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <pthread.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <sys/ioctl.h>
+    #include <sys/timerfd.h>
+#else
+    #define FIN_LOOP_EPOLL 0
+#endif
+
+#if defined(_MSC_VER)
+    #include <io.h>
+    #include <windows.h>
+    #define fin_loop_sys_read(fd, buf, len)  _read(fd, buf, len)
+    #define fin_loop_sys_write(fd, buf, len) _write(fd, buf, len)
+#else
+    #include <time.h>
+    #include <unistd.h>
+    #define fin_loop_sys_read(fd, buf, len)  read(fd, buf, len)
+    #define fin_loop_sys_write(fd, buf, len) write(fd, buf, len)
+#endif
+
+#define FIN_LOOP_CHUNK 4096     // at most PIPE_BUF per write, so that a pipe
+                                // reported writable takes it without blocking
+
+// Blocking versions of the operations, for callers outside the loop and for
+// fds epoll does not support.
+
+static void fin_loop_sleep_sync(int64_t ms) {
+#if defined(_MSC_VER)
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) != 0)
+        ;
+#endif
+}
+
+static fin_str_t* fin_loop_read_sync(fin_ctx_t* ctx, int32_t fd) {
+    char buffer[FIN_LOOP_CHUNK];
+    int32_t len = (int32_t)fin_loop_sys_read(fd, buffer, sizeof(buffer));
+    return len > 0 ? fin_str_create(ctx, buffer, len) : NULL;
+}
+
+static int32_t fin_loop_write_sync(int32_t fd, fin_str_t* data, int32_t done) {
+    const char* cstr = fin_str_cstr(data);
+    int32_t len = fin_str_len(data);
+    while (done < len) {
+        int32_t count = (int32_t)fin_loop_sys_write(fd, cstr + done, len - done);
+        if (count <= 0)
+            break;
+        done += count;
+    }
+    return done;
+}
+
+static fin_str_t* fin_loop_file_read_sync(fin_ctx_t* ctx, fin_str_t* path) {
+    FILE* fp = fopen(fin_str_cstr(path), "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    int32_t size = (int32_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* buffer = (char*)ctx->alloc(NULL, size + 1);
+    int32_t read = (int32_t)fread(buffer, 1, size, fp);
+    fclose(fp);
+    fin_str_t* str = fin_str_create(ctx, buffer, read);
+    ctx->alloc(buffer, 0);
+    return str;
+}
+
+static void fin_loop_file_write_sync(fin_str_t* path, fin_str_t* data) {
+    FILE* fp = fopen(fin_str_cstr(path), "wb");
+    if (!fp)
+        return;
+    fputs(fin_str_cstr(data), fp);
+    fclose(fp);
+}
+
+#if FIN_LOOP_EPOLL
+
+typedef enum fin_loop_op_t {
+    fin_loop_op_sleep,
+    fin_loop_op_read,
+    fin_loop_op_write,
+    fin_loop_op_file_read,
+    fin_loop_op_file_write,
+} fin_loop_op_t;
+
+typedef struct fin_loop_wait_t fin_loop_wait_t;
+
+typedef struct fin_loop_task_t {
+    fin_fiber_t*            fiber;
+    fin_val_t               value;      // result of the operation it waited for
+    bool                    has_value;
+    bool                    value_str;  // value is a string not yet delivered
+    bool                    waiting;
+    fin_loop_wait_t*        wait;       // in flight, NULL when none
+    struct fin_loop_task_t* next;       // in the ready queue
+    struct fin_loop_task_t* all_prev;   // in the list of the unfinished ones
+    struct fin_loop_task_t* all_next;
+} fin_loop_task_t;
+
+// An operation in flight. fd is registered with epoll, a dup of the fd of the
+// script for reads and writes, so that several fibers can wait on one fd. A
+// read first checks that data is available, the fibers woken for data that
+// another one took wait again instead of blocking the loop.
+struct fin_loop_wait_t {
+    fin_loop_op_t           op;
+    fin_loop_task_t*        task;
+    int                     fd;
+    int32_t                 target;     // fd of the script
+    int32_t                 done;       // bytes written so far
+    fin_str_t*              path;
+    fin_str_t*              data;
+    fin_val_t               result;
+    struct fin_loop_wait_t* next;       // in the queues of the file thread
+};
+
+typedef struct fin_loop_t {
+    fin_ctx_t*       ctx;
+    int              epoll;
+    int              wake;              // eventfd of the file thread
+    int32_t          tasks;             // fibers not finished
+    fin_loop_task_t* all;
+    fin_loop_task_t* ready;
+    fin_loop_task_t* ready_tail;
+    pthread_t        thread;
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+    fin_loop_wait_t* files;             // file operations to run
+    fin_loop_wait_t* files_done;
+    bool             thread_started;
+    bool             stop;
+} fin_loop_t;
+
+// The task of the loop running on this thread.
+static __thread fin_loop_task_t* fin_loop_running = NULL;
+
+static fin_loop_t* fin_loop_get(fin_ctx_t* ctx) {
+    fin_loop_t* loop = (fin_loop_t*)ctx->loop;
+    if (loop)
+        return loop;
+    loop = (fin_loop_t*)ctx->alloc(NULL, sizeof(fin_loop_t));
+    loop->ctx = ctx;
+    loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+    loop->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->tasks = 0;
+    loop->all = NULL;
+    loop->ready = NULL;
+    loop->ready_tail = NULL;
+    loop->files = NULL;
+    loop->files_done = NULL;
+    loop->thread_started = false;
+    loop->stop = false;
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->cond, NULL);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->wake, &event);
+    ctx->loop = loop;
+    return loop;
+}
+
+static void fin_loop_push(fin_loop_t* loop, fin_loop_task_t* task) {
+    task->next = NULL;
+    if (loop->ready_tail)
+        loop->ready_tail->next = task;
+    else
+        loop->ready = task;
+    loop->ready_tail = task;
+}
+
+static void fin_loop_wait_free(fin_ctx_t* ctx, fin_loop_wait_t* wait) {
+    if (wait->path)
+        fin_str_destroy(ctx, wait->path);
+    if (wait->data)
+        fin_str_destroy(ctx, wait->data);
+    ctx->alloc(wait, 0);
+}
+
+static void fin_loop_complete(fin_loop_t* loop, fin_loop_wait_t* wait, bool has_value) {
+    fin_loop_task_t* task = wait->task;
+    task->value = wait->result;
+    task->has_value = has_value;
+    task->value_str = wait->op == fin_loop_op_read || wait->op == fin_loop_op_file_read;
+    task->waiting = false;
+    task->wait = NULL;
+    fin_loop_push(loop, task);
+    fin_loop_wait_free(loop->ctx, wait);
+}
+
+// Suspends the running task until wait completes, with fd registered in
+// epoll unless it is -1. Otherwise wait is freed and the caller completes the
+// operation itself.
+static bool fin_loop_wait(fin_ctx_t* ctx, fin_loop_wait_t* wait, int fd, uint32_t events) {
+    fin_loop_task_t* task = fin_loop_running;
+    fin_loop_t* loop = (fin_loop_t*)ctx->loop;
+    wait->task = task;
+    wait->fd = fd;
+    bool result = task && loop;
+    if (result && fd != -1) {
+        // Fails for fds epoll does not support, like regular files.
+        struct epoll_event event;
+        event.events = events | EPOLLONESHOT;
+        event.data.ptr = wait;
+        result = epoll_ctl(loop->epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+        if (result && !fin_ctx_yield(ctx)) {
+            epoll_ctl(loop->epoll, EPOLL_CTL_DEL, fd, NULL);
+            result = false;
+        }
+    }
+    else if (result)
+        result = fin_ctx_yield(ctx);
+    if (!result) {
+        if (fd != -1)
+            close(fd);
+        fin_loop_wait_free(ctx, wait);
+        return false;
+    }
+    task->waiting = true;
+    task->wait = wait;
+    return true;
+}
+
+static fin_loop_wait_t* fin_loop_wait_create(fin_ctx_t* ctx, fin_loop_op_t op) {
+    fin_loop_wait_t* wait = (fin_loop_wait_t*)ctx->alloc(NULL, sizeof(fin_loop_wait_t));
+    wait->op = op;
+    wait->task = NULL;
+    wait->fd = -1;
+    wait->target = -1;
+    wait->done = 0;
+    wait->path = NULL;
+    wait->data = NULL;
+    wait->result.i = 0;
+    wait->next = NULL;
+    return wait;
+}
+
+static void* fin_loop_files(void* arg) {
+    fin_loop_t* loop = (fin_loop_t*)arg;
+    pthread_mutex_lock(&loop->lock);
+    while (true) {
+        while (!loop->files && !loop->stop)
+            pthread_cond_wait(&loop->cond, &loop->lock);
+        if (loop->stop)
+            break;
+        fin_loop_wait_t* wait = loop->files;
+        loop->files = wait->next;
+        pthread_mutex_unlock(&loop->lock);
+        if (wait->op == fin_loop_op_file_read)
+            wait->result.s = fin_loop_file_read_sync(loop->ctx, wait->path);
+        else
+            fin_loop_file_write_sync(wait->path, wait->data);
+        pthread_mutex_lock(&loop->lock);
+        wait->next = loop->files_done;
+        loop->files_done = wait;
+        uint64_t one = 1;
+        if (write(loop->wake, &one, sizeof(one)) != sizeof(one))
+            assert(0);
+    }
+    pthread_mutex_unlock(&loop->lock);
+    return NULL;
+}
+
+static bool fin_loop_file(fin_ctx_t* ctx, fin_loop_wait_t* wait) {
+    fin_loop_t* loop = (fin_loop_t*)ctx->loop;
+    if (!fin_loop_wait(ctx, wait, -1, 0))
+        return false;
+    pthread_mutex_lock(&loop->lock);
+    if (!loop->thread_started)
+        loop->thread_started = pthread_create(&loop->thread, NULL, &fin_loop_files, loop) == 0;
+    assert(loop->thread_started);
+    wait->next = NULL;
+    fin_loop_wait_t** tail = &loop->files;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = wait;
+    pthread_cond_signal(&loop->cond);
+    pthread_mutex_unlock(&loop->lock);
+    return true;
+}
+
+// Finishes the operation of an fd epoll reported ready with events.
+static void fin_loop_ready(fin_loop_t* loop, fin_loop_wait_t* wait, uint32_t events) {
+    fin_ctx_t* ctx = loop->ctx;
+    epoll_ctl(loop->epoll, EPOLL_CTL_DEL, wait->fd, NULL);
+    switch (wait->op) {
+        case fin_loop_op_sleep:
+            close(wait->fd);
+            fin_loop_complete(loop, wait, false);
+            return;
+        case fin_loop_op_read: {
+            // The fd of the script blocks, read it only once it can't: with
+            // data available, at its end or on an error.
+            int available = 0;
+            if (!(events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) &&
+                ioctl(wait->target, FIONREAD, &available) == 0 && available == 0) {
+                struct epoll_event event;
+                event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                event.data.ptr = wait;
+                epoll_ctl(loop->epoll, EPOLL_CTL_ADD, wait->fd, &event);
+                return;
+            }
+            wait->result.s = fin_loop_read_sync(ctx, wait->target);
+            close(wait->fd);
+            fin_loop_complete(loop, wait, true);
+            return;
+        }
+        case fin_loop_op_write: {
+            int32_t len = fin_str_len(wait->data) - wait->done;
+            if (len > FIN_LOOP_CHUNK)
+                len = FIN_LOOP_CHUNK;
+            int32_t count = (int32_t)write(wait->target, fin_str_cstr(wait->data) + wait->done, len);
+            if (count > 0)
+                wait->done += count;
+            if (count > 0 && wait->done < fin_str_len(wait->data)) {
+                struct epoll_event event;
+                event.events = EPOLLOUT | EPOLLONESHOT;
+                event.data.ptr = wait;
+                epoll_ctl(loop->epoll, EPOLL_CTL_ADD, wait->fd, &event);
+                return;
+            }
+            close(wait->fd);
+            wait->result.i = wait->done;
+            fin_loop_complete(loop, wait, true);
+            return;
+        }
+        default:
+            assert(0);
+    }
+}
+
+fin_fiber_t* fin_loop_spawn(fin_ctx_t* ctx, fin_mod_func_t* func, const fin_val_t* args) {
+    fin_fiber_t* fiber = fin_fiber_create(ctx, func, args);
+    if (!fiber)
+        return NULL;
+    fin_loop_t* loop = fin_loop_get(ctx);
+    fin_loop_task_t* task = (fin_loop_task_t*)ctx->alloc(NULL, sizeof(fin_loop_task_t));
+    task->fiber = fiber;
+    task->has_value = false;
+    task->value_str = false;
+    task->waiting = false;
+    task->wait = NULL;
+    task->all_prev = NULL;
+    task->all_next = loop->all;
+    if (loop->all)
+        loop->all->all_prev = task;
+    loop->all = task;
+    fin_loop_push(loop, task);
+    loop->tasks++;
+    return fiber;
+}
+
+// Runs until every spawned fiber has returned. Each round resumes the fibers
+// ready at its start, then polls for the operations that completed. A fiber
+// that suspends without an operation in flight, like fiber.Yield() or a
+// preempted one, is ready again in the next round.
+void fin_loop_run(fin_ctx_t* ctx) {
+    fin_loop_t* loop = (fin_loop_t*)ctx->loop;
+    if (!loop)
+        return;
+    struct epoll_event events[64];
+    while (loop->tasks) {
+        fin_loop_task_t* next = loop->ready;
+        loop->ready = NULL;
+        loop->ready_tail = NULL;
+        while (next) {
+            fin_loop_task_t* task = next;
+            next = task->next;
+            fin_loop_task_t* outer = fin_loop_running;
+            fin_loop_running = task;
+            bool done = fin_fiber_resume(task->fiber, task->has_value ? &task->value : NULL, NULL);
+            fin_loop_running = outer;
+            task->has_value = false;
+            if (done) {
+                if (task->all_prev)
+                    task->all_prev->all_next = task->all_next;
+                else
+                    loop->all = task->all_next;
+                if (task->all_next)
+                    task->all_next->all_prev = task->all_prev;
+                fin_fiber_destroy(task->fiber);
+                ctx->alloc(task, 0);
+                loop->tasks--;
+            }
+            else if (!task->waiting)
+                fin_loop_push(loop, task);
+        }
+        if (!loop->tasks)
+            break;
+        int count = epoll_wait(loop->epoll, events, FIN_COUNT_OF(events), loop->ready ? 0 : -1);
+        if (count < 0 && errno != EINTR)
+            break;
+        for (int i=0; i<count; i++) {
+            fin_loop_wait_t* wait = (fin_loop_wait_t*)events[i].data.ptr;
+            if (wait) {
+                fin_loop_ready(loop, wait, events[i].events);
+                continue;
+            }
+            uint64_t value;
+            if (read(loop->wake, &value, sizeof(value)) < 0)
+                continue;
+            pthread_mutex_lock(&loop->lock);
+            fin_loop_wait_t* done = loop->files_done;
+            loop->files_done = NULL;
+            pthread_mutex_unlock(&loop->lock);
+            while (done) {
+                fin_loop_wait_t* after = done->next;
+                fin_loop_complete(loop, done, done->op == fin_loop_op_file_read);
+                done = after;
+            }
+        }
+    }
+}
+
+// Drops the fibers that did not finish, their operations are abandoned and
+// freed through their tasks, in epoll or in a queue of the stopped file
+// thread.
+void fin_loop_destroy(fin_ctx_t* ctx) {
+    fin_loop_t* loop = (fin_loop_t*)ctx->loop;
+    if (!loop)
+        return;
+    if (loop->thread_started) {
+        pthread_mutex_lock(&loop->lock);
+        loop->stop = true;
+        pthread_cond_signal(&loop->cond);
+        pthread_mutex_unlock(&loop->lock);
+        pthread_join(loop->thread, NULL);
+    }
+    while (loop->all) {
+        fin_loop_task_t* task = loop->all;
+        loop->all = task->all_next;
+        fin_loop_wait_t* wait = task->wait;
+        if (wait) {
+            if (wait->fd != -1)
+                close(wait->fd);
+            if (wait->op == fin_loop_op_file_read && wait->result.s)
+                fin_str_destroy(ctx, wait->result.s);
+            fin_loop_wait_free(ctx, wait);
+        }
+        if (task->has_value && task->value_str && task->value.s)
+            fin_str_destroy(ctx, task->value.s);
+        fin_fiber_destroy(task->fiber);
+        ctx->alloc(task, 0);
+    }
+    pthread_cond_destroy(&loop->cond);
+    pthread_mutex_destroy(&loop->lock);
+    close(loop->wake);
+    close(loop->epoll);
+    ctx->alloc(loop, 0);
+    ctx->loop = NULL;
+}
+
+void fin_loop_sleep(fin_ctx_t* ctx, int64_t ms) {
+    if (fin_loop_running && ms > 0) {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec = ms / 1000;
+        spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+        if (fd != -1 && timerfd_settime(fd, 0, &spec, NULL) == 0) {
+            if (fin_loop_wait(ctx, fin_loop_wait_create(ctx, fin_loop_op_sleep), fd, EPOLLIN))
+                return;
+        }
+        else if (fd != -1)
+            close(fd);
+    }
+    fin_loop_sleep_sync(ms);
+}
+
+void fin_loop_read(fin_ctx_t* ctx, int32_t fd, fin_val_t* res) {
+    int dup_fd = fin_loop_running ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1;
+    if (dup_fd != -1) {
+        fin_loop_wait_t* wait = fin_loop_wait_create(ctx, fin_loop_op_read);
+        wait->target = fd;
+        if (fin_loop_wait(ctx, wait, dup_fd, EPOLLIN | EPOLLRDHUP))
+            return;
+    }
+    res->s = fin_loop_read_sync(ctx, fd);
+}
+
+void fin_loop_write(fin_ctx_t* ctx, int32_t fd, fin_str_t* data, fin_val_t* res) {
+    int dup_fd = fin_loop_running && data ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1;
+    if (dup_fd != -1) {
+        fin_loop_wait_t* wait = fin_loop_wait_create(ctx, fin_loop_op_write);
+        wait->target = fd;
+        wait->data = fin_str_clone(data);
+        if (fin_loop_wait(ctx, wait, dup_fd, EPOLLOUT))
+            return;
+    }
+    res->i = fin_loop_write_sync(fd, data, 0);
+}
+
+void fin_loop_file_read(fin_ctx_t* ctx, fin_str_t* path, fin_val_t* res) {
+    if (fin_loop_running && path) {
+        fin_loop_wait_t* wait = fin_loop_wait_create(ctx, fin_loop_op_file_read);
+        wait->path = fin_str_clone(path);
+        if (fin_loop_file(ctx, wait))
+            return;
+    }
+    res->s = path ? fin_loop_file_read_sync(ctx, path) : NULL;
+}
+
+void fin_loop_file_write(fin_ctx_t* ctx, fin_str_t* path, fin_str_t* data) {
+    if (fin_loop_running && path) {
+        fin_loop_wait_t* wait = fin_loop_wait_create(ctx, fin_loop_op_file_write);
+        wait->path = fin_str_clone(path);
+        wait->data = data ? fin_str_clone(data) : NULL;
+        if (fin_loop_file(ctx, wait))
+            return;
+    }
+    if (path)
+        fin_loop_file_write_sync(path, data);
+}
+
+#else
+
+fin_fiber_t* fin_loop_spawn(fin_ctx_t* ctx, fin_mod_func_t* func, const fin_val_t* args) {
+    return NULL;
+}
+
+void fin_loop_run(fin_ctx_t* ctx) {
+}
+
+void fin_loop_destroy(fin_ctx_t* ctx) {
+}
+
+void fin_loop_sleep(fin_ctx_t* ctx, int64_t ms) {
+    fin_loop_sleep_sync(ms);
+}
+
+void fin_loop_read(fin_ctx_t* ctx, int32_t fd, fin_val_t* res) {
+    res->s = fin_loop_read_sync(ctx, fd);
+}
+
+void fin_loop_write(fin_ctx_t* ctx, int32_t fd, fin_str_t* data, fin_val_t* res) {
+    res->i = fin_loop_write_sync(fd, data, 0);
+}
+
+void fin_loop_file_read(fin_ctx_t* ctx, fin_str_t* path, fin_val_t* res) {
+    res->s = path ? fin_loop_file_read_sync(ctx, path) : NULL;
+}
+
+void fin_loop_file_write(fin_ctx_t* ctx, fin_str_t* path, fin_str_t* data) {
+    if (path)
+        fin_loop_file_write_sync(path, data);
+}
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#ifndef FIN_LOOP_H
+#define FIN_LOOP_H
+
+#include <fin/fin.h>
+
+// Event loop of a context, running script calls as fibers on the thread of
+// fin_loop_run. The io natives below suspend the fiber calling them until
+// their operation completes, with its result as the result of the native,
+// and the loop resumes the other fibers meanwhile. Called outside a fiber of
+// the loop they complete before returning. Timers and fds that support epoll
+// (pipes, sockets, ttys) wait in epoll, regular files are read and written
+// by a helper thread. Linux only, elsewhere every operation blocks.
+
+fin_fiber_t* fin_loop_spawn(fin_ctx_t* ctx, fin_mod_func_t* func, const fin_val_t* args);
+void         fin_loop_run(fin_ctx_t* ctx);
+void         fin_loop_destroy(fin_ctx_t* ctx);
+
+void         fin_loop_sleep(fin_ctx_t* ctx, int64_t ms);
+void         fin_loop_read(fin_ctx_t* ctx, int32_t fd, fin_val_t* res);
+void         fin_loop_write(fin_ctx_t* ctx, int32_t fd, fin_str_t* data, fin_val_t* res);
+void         fin_loop_file_read(fin_ctx_t* ctx, fin_str_t* path, fin_val_t* res);
+void         fin_loop_file_write(fin_ctx_t* ctx, fin_str_t* path, fin_str_t* data);
+
+#endif //#ifndef FIN_LOOP_H
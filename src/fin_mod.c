@@ -4,12 +4,15 @@
  */
 
 #include "fin_mod.h"
+#include "fin_arena.h"
 #include "fin_ctx.h"
 #include "fin_ast.h"
+#include "fin_jit.h"
 #include "fin_op.h"
 #include "fin_lex.h"
 #include "fin_str.h"
 #include "fin_obj.h"
+#include "fin_vm.h"
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
@@ -20,44 +23,159 @@
 #   define FIN_LOG(...)
 #endif
 
+#define FIN_MOD_INTRINSIC(op, res, expr, sign) { sign, fin_op_##op, fin_reg_op_##op },
+
+static const struct {
+    const char*  sign;
+    fin_op_t     op;
+    fin_reg_op_t reg_op;
+} fin_mod_intrinsics[] = {
+    FIN_OP_UNARY_LIST(FIN_MOD_INTRINSIC)
+    FIN_OP_BINARY_LIST(FIN_MOD_INTRINSIC)
+};
+
+#undef FIN_MOD_INTRINSIC
+
+// Only read by fin_mod_fuse, which training builds leave out.
+#if !FIN_VM_TRAIN
+
+#define FIN_MOD_OP_SIZE(op, size)                 size,
+#define FIN_MOD_OP_SIZE_EXPR(op, res, expr, sign) 0,
+
+static const uint8_t fin_mod_op_sizes[] = {
+    FIN_OP_LIST(FIN_MOD_OP_SIZE)
+    FIN_OP_UNARY_LIST(FIN_MOD_OP_SIZE_EXPR)
+    FIN_OP_BINARY_LIST(FIN_MOD_OP_SIZE_EXPR)
+};
+
+#undef FIN_MOD_OP_SIZE
+#undef FIN_MOD_OP_SIZE_EXPR
+
+#define FIN_MOD_SUPER2(a, b)       { fin_op_##a##__##b, 2, { fin_op_##a, fin_op_##b } },
+#define FIN_MOD_SUPER3(a, b, c)    { fin_op_##a##__##b##__##c, 3, { fin_op_##a, fin_op_##b, fin_op_##c } },
+#define FIN_MOD_SUPER4(a, b, c, d) { fin_op_##a##__##b##__##c##__##d, 4, { fin_op_##a, fin_op_##b, fin_op_##c, fin_op_##d } },
+
+// Longest sequences first, terminated by a zero length entry.
+static const struct {
+    fin_op_t op;
+    int32_t  count;
+    fin_op_t ops[4];
+} fin_mod_supers[] = {
+    FIN_OP_SUPER4_LIST(FIN_MOD_SUPER4)
+    FIN_OP_SUPER3_LIST(FIN_MOD_SUPER3)
+    FIN_OP_SUPER2_LIST(FIN_MOD_SUPER2)
+    { fin_op_count, 0, { fin_op_count } }
+};
+
+#undef FIN_MOD_SUPER2
+#undef FIN_MOD_SUPER3
+#undef FIN_MOD_SUPER4
+
+#endif //#if !FIN_VM_TRAIN
+
+#if FIN_ASM
+#define FIN_MOD_OP_NAME(op)                       #op,
+#define FIN_MOD_OP_NAME_SIZE(op, size)            #op,
+#define FIN_MOD_OP_NAME_EXPR(op, res, expr, sign) #op,
+static const char* fin_mod_op_names[] = {
+    FIN_OP_LIST(FIN_MOD_OP_NAME_SIZE)
+    FIN_OP_UNARY_LIST(FIN_MOD_OP_NAME_EXPR)
+    FIN_OP_BINARY_LIST(FIN_MOD_OP_NAME_EXPR)
+};
+static const char* fin_mod_reg_op_names[] = {
+    FIN_REG_OP_LIST(FIN_MOD_OP_NAME)
+    FIN_OP_UNARY_LIST(FIN_MOD_OP_NAME_EXPR)
+    FIN_OP_BINARY_LIST(FIN_MOD_OP_NAME_EXPR)
+};
+#undef FIN_MOD_OP_NAME
+#undef FIN_MOD_OP_NAME_SIZE
+#undef FIN_MOD_OP_NAME_EXPR
+#   define FIN_LOG_RK(x) ((x) & FIN_REG_K ? 'k' : 'r'), ((x) & ~FIN_REG_K)
+#endif
+
+// A scalar replaced struct keeps its fields in slots idx to idx + fields - 1,
+// the locals after it are unnamed placeholders for the extra slots.
 typedef struct fin_mod_local_t {
     fin_str_t* name;
     fin_str_t* type;
-    uint8_t    idx;
+    int32_t    idx;
+    int32_t    fields;
     bool       is_param;
 } fin_mod_local_t;
 
+typedef struct fin_mod_scalar_t {
+    fin_str_t* name;
+    bool       escapes;
+} fin_mod_scalar_t;
+
 typedef struct fin_mod_code_t {
     uint8_t*      top;
     uint8_t*      begin;
     uint8_t*      end;
+    fin_arena_t*  arena;        // where it grows past storage
     uint8_t       storage[256];
 } fin_mod_code_t;
 
+// An inline field takes the slots of all the fields of its type, starting at
+// offset, instead of one slot referencing an object of its own.
 typedef struct fin_mod_field_t {
     fin_str_t* name;
     fin_str_t* type;
+    int32_t    offset;
+    bool       is_inline;
 } fin_mod_field_t;
 
 typedef struct fin_mod_type_t {
     fin_str_t*       name;
     fin_mod_field_t* fields;
     int32_t          fields_count;
+    fin_obj_type_t   layout;
 } fin_mod_type_t;
 
+// Its locals and code grow in the arena of the compilation, with the AST.
 typedef struct fin_mod_compiler_t {
+    fin_arena_t*    arena;
     fin_mod_t*      mod;
     fin_ast_func_t* func;
     fin_str_t*      ret_type;
-    fin_mod_code_t  code;
-    fin_mod_local_t locals[256];
-    uint8_t         scopes[256];
-    uint8_t         locals_count;
-    uint8_t         locals_max;
-    uint8_t         params_count;
-    uint8_t         scopes_count;
+    fin_mod_code_t   code;
+    fin_mod_local_t* locals;
+    int32_t          locals_size;
+    fin_mod_scalar_t* scalars;
+    int32_t          scalars_count;
+    int32_t          scopes[256];
+    int32_t          locals_count;
+    int32_t          locals_max;
+    int32_t          params_count;
+    int32_t          scopes_count;
+    int32_t          temps;
+    int32_t          temps_max;
+    int32_t          depth;
+    int32_t          depth_max;
+    bool             regs_overflow;
+    bool             branch_overflow;
+    bool             wide;
 } fin_mod_compiler_t;
 
+// A field access a.b.c resolved to the slot it reads, with the inline fields
+// on the way folded into offset. The slot is in the object obj evaluates to,
+// or, when the access starts at a scalar replaced local, obj is NULL and the
+// slot is offset past the first slot of the local, scalar.
+typedef struct fin_mod_path_t {
+    fin_ast_expr_t*  obj;
+    fin_mod_field_t* field;
+    int32_t          scalar;
+    int32_t          offset;
+} fin_mod_path_t;
+
+static fin_mod_local_t* fin_mod_local_add(fin_ctx_t* ctx, fin_mod_compiler_t* cmp) {
+    if (cmp->locals_count == cmp->locals_size) {
+        cmp->locals = (fin_mod_local_t*)fin_arena_realloc(cmp->arena, cmp->locals, sizeof(fin_mod_local_t) * cmp->locals_size, sizeof(fin_mod_local_t) * cmp->locals_size * 2);
+        cmp->locals_size *= 2;
+    }
+    return &cmp->locals[cmp->locals_count++];
+}
+
 static void fin_mod_scope_begin(fin_mod_compiler_t* cmp) {
     cmp->scopes[cmp->scopes_count++] = cmp->locals_count;
 }
@@ -68,31 +186,24 @@ static void fin_mod_scope_end(fin_mod_compiler_t* cmp) {
     cmp->locals_count = cmp->scopes[--cmp->scopes_count];
 }
 
-static void fin_mod_code_init(fin_mod_code_t* code) {
+// Tracks the operand stack depth of the emitted stack code.
+static void fin_mod_stack_adjust(fin_mod_compiler_t* cmp, int32_t count) {
+    cmp->depth += count;
+    if (cmp->depth_max < cmp->depth)
+        cmp->depth_max = cmp->depth;
+}
+
+static void fin_mod_code_init(fin_mod_code_t* code, fin_arena_t* arena) {
     code->top   = code->storage;
     code->begin = code->storage;
     code->end   = code->storage + sizeof(code->storage);
+    code->arena = arena;
 }
 
-static void fin_mod_code_reset(fin_ctx_t* ctx, fin_mod_code_t* code) {
-    if (code->begin != code->storage)
-        ctx->alloc(code->begin, 0);
-    fin_mod_code_init(code);
-}
-
-static void fin_mod_code_ensure(fin_ctx_t* ctx, fin_mod_code_t* code, int32_t size) {
+static void fin_mod_code_ensure(fin_mod_code_t* code, int32_t size) {
     if (code->top + size >= code->end) {
-        int32_t length;
-        uint8_t* buffer;
-        if (code->begin == code->storage) {
-            length = sizeof(code->storage) * 2;
-            buffer = ctx->alloc(NULL, length);
-            memcpy(buffer, code->begin, code->top - code->begin);
-        }
-        else {
-            length = (int32_t)(code->end - code->begin) * 2;
-            buffer = ctx->alloc(code->begin, length);
-        }
+        int32_t length = (int32_t)(code->end - code->begin) * 2;
+        uint8_t* buffer = (uint8_t*)fin_arena_realloc(code->arena, code->begin, (int32_t)(code->top - code->begin), length);
         code->top   = buffer + (code->top - code->begin);
         code->begin = buffer;
         code->end   = buffer + length;
@@ -100,39 +211,141 @@ static void fin_mod_code_ensure(fin_ctx_t* ctx, fin_mod_code_t* code, int32_t si
 }
 
 static void fin_mod_code_emit_uint8(fin_ctx_t* ctx, fin_mod_code_t* code, uint8_t val) {
-    fin_mod_code_ensure(ctx, code, 1);
+    fin_mod_code_ensure(code, 1);
     *code->top++ = val;
 }
 
 static void fin_mod_code_emit_uint16(fin_ctx_t* ctx, fin_mod_code_t* code, uint16_t val) {
-    fin_mod_code_ensure(ctx, code, 2);
+    fin_mod_code_ensure(code, 2);
     *code->top++ = val & 0xFF;
     *code->top++ = (val >> 8) & 0xFF;
 }
 
+static void fin_mod_code_emit_uint32(fin_ctx_t* ctx, fin_mod_code_t* code, uint32_t val) {
+    fin_mod_code_emit_uint16(ctx, code, val & 0xFFFF);
+    fin_mod_code_emit_uint16(ctx, code, (val >> 16) & 0xFFFF);
+}
+
+static int32_t fin_mod_code_pos(fin_mod_compiler_t* cmp) {
+    return (int32_t)(cmp->code.top - cmp->code.begin);
+}
+
+// Branch offsets are relative to the end of the offset. They take 16 bits, or
+// 32 bits in wide code. A function whose branches outgrow 16 bits is compiled
+// again, see fin_mod_compile_func.
+static void fin_mod_code_emit_offset(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, int32_t target) {
+    if (cmp->wide) {
+        fin_mod_code_emit_uint32(ctx, &cmp->code, (uint32_t)(target - fin_mod_code_pos(cmp) - 4));
+        return;
+    }
+    int32_t offset = target - fin_mod_code_pos(cmp) - 2;
+    if (offset != (int16_t)offset)
+        cmp->branch_overflow = true;
+    fin_mod_code_emit_uint16(ctx, &cmp->code, (uint16_t)offset);
+}
+
+// Emits a stack branch to target, or one to patch when target is -1. Returns
+// the position of the offset.
+static int32_t fin_mod_compile_branch(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_op_t op, int32_t target) {
+    if (cmp->wide)
+        fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_wide);
+    fin_mod_code_emit_uint8(ctx, &cmp->code, op);
+    int32_t pos = fin_mod_code_pos(cmp);
+    fin_mod_code_emit_offset(ctx, cmp, target < 0 ? pos : target);
+    return pos;
+}
+
+static void fin_mod_code_patch(fin_mod_compiler_t* cmp, int32_t pos) {
+    int32_t size = cmp->wide ? 4 : 2;
+    int32_t offset = fin_mod_code_pos(cmp) - pos - size;
+    if (offset != (int16_t)offset && !cmp->wide)
+        cmp->branch_overflow = true;
+    for (int32_t i=0; i<size; i++)
+        cmp->code.begin[pos + i] = (offset >> (i * 8)) & 0xFF;
+}
+
 static fin_str_t* fin_mod_resolve_type(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_expr_t* expr);
 
-static int16_t fin_mod_const_idx(fin_mod_compiler_t* cmp, fin_val_t val) {
+// The consts and binds of a module start with FIN_MOD_TABLE_SIZE entries and
+// double whenever they fill up.
+#define FIN_MOD_TABLE_SIZE 128
+
+static void* fin_mod_table_grow(fin_ctx_t* ctx, void* table, int32_t count, int32_t size) {
+    if (count < FIN_MOD_TABLE_SIZE || (count & (count - 1)))
+        return table;
+    return ctx->alloc(table, size * count * 2);
+}
+
+static int32_t fin_mod_const_idx(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_val_t val) {
     fin_mod_t* mod = cmp->mod;
     for (int32_t i=0; i<mod->consts_count; i++) {
         if (val.i == mod->consts[i].i)
             return i;
     }
+    mod->consts = (fin_val_t*)fin_mod_table_grow(ctx, mod->consts, mod->consts_count, sizeof(fin_val_t));
     mod->consts[mod->consts_count] = val;
     return mod->consts_count++;
 }
 
-static int16_t fin_mod_bind_idx(fin_mod_compiler_t* cmp, fin_str_t* sign) {
+static int32_t fin_mod_bind_idx(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_str_t* sign) {
     fin_mod_t* mod = cmp->mod;
     for (int32_t i=0; i<mod->binds_count; i++) {
         if (sign == mod->binds[i].sign)
             return i;
     }
+    if (mod->binds_count > 0xFFFF) {
+        printf("Too many functions called from module\n");
+        assert(mod->binds_count <= 0xFFFF);
+    }
+    mod->binds = (fin_mod_func_bind_t*)fin_mod_table_grow(ctx, mod->binds, mod->binds_count, sizeof(fin_mod_func_bind_t));
     mod->binds[mod->binds_count].sign = fin_str_clone(sign);
     mod->binds[mod->binds_count].func = NULL;
     return mod->binds_count++;
 }
 
+static int32_t fin_mod_obj_type_idx(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_mod_type_t* type) {
+    fin_mod_t* mod = cmp->mod;
+    for (int32_t i=0; i<mod->obj_types_count; i++) {
+        if (&type->layout == mod->obj_types[i])
+            return i;
+    }
+    if (mod->obj_types_count > 0xFFFF) {
+        printf("Too many structs created in module\n");
+        assert(mod->obj_types_count <= 0xFFFF);
+    }
+    mod->obj_types = (const fin_obj_type_t**)fin_mod_table_grow(ctx, mod->obj_types, mod->obj_types_count, sizeof(fin_obj_type_t*));
+    mod->obj_types[mod->obj_types_count] = &type->layout;
+    return mod->obj_types_count++;
+}
+
+// Loads the constant at idx, indices past 0xFFFF need wide.
+static void fin_mod_compile_const(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, int32_t idx) {
+    fin_mod_stack_adjust(cmp, 1);
+    if (idx > 0xFFFF) {
+        fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_wide);
+        fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_const);
+        fin_mod_code_emit_uint32(ctx, &cmp->code, idx);
+    }
+    else {
+        fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_const);
+        fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
+    }
+}
+
+// Loads or stores an arg or local, locals past the first 256 need wide.
+static void fin_mod_compile_slot(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_op_t op, int32_t idx) {
+    if (idx > 0xFF) {
+        assert(idx <= 0xFFFF);
+        fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_wide);
+        fin_mod_code_emit_uint8(ctx, &cmp->code, op);
+        fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
+    }
+    else {
+        fin_mod_code_emit_uint8(ctx, &cmp->code, op);
+        fin_mod_code_emit_uint8(ctx, &cmp->code, idx);
+    }
+}
+
 static fin_mod_type_t* fin_mod_find_type(fin_ctx_t* ctx, fin_mod_t* mod, fin_str_t* name) {
     for (int32_t i=0; i<mod->types_count; i++) {
         if (mod->types[i].name == name)
@@ -165,13 +378,46 @@ static fin_mod_func_t* fin_mod_find_func(fin_ctx_t* ctx, fin_mod_t* mod, fin_str
     return NULL;
 }
 
-static int32_t fin_mod_resolve_field(fin_ctx_t* ctx, fin_mod_t* mod, fin_str_t* type_name, fin_str_t* field_name) {
+// Operators implemented by the std module compile to dedicated opcodes. A user
+// overload shadows the native one in fin_mod_find_func and goes through call.
+static int32_t fin_mod_find_intrinsic(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_str_t* sign) {
+    fin_mod_func_t* func = fin_mod_find_func(ctx, cmp->mod, sign);
+    if (!func || !func->is_native)
+        return -1;
+    for (int32_t i=0; i<FIN_COUNT_OF(fin_mod_intrinsics); i++) {
+        if (strcmp(fin_str_cstr(sign), fin_mod_intrinsics[i].sign) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void fin_mod_compile_call(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_str_t* sign, int32_t args) {
+    int32_t intrinsic = fin_mod_find_intrinsic(ctx, cmp, sign);
+    if (intrinsic >= 0) {
+        fin_op_t op = fin_mod_intrinsics[intrinsic].op;
+        fin_mod_stack_adjust(cmp, 1 - args);
+        fin_mod_code_emit_uint8(ctx, &cmp->code, op);
+        FIN_LOG("\t%-10s            // %s\n", fin_mod_op_names[op], fin_str_cstr(sign));
+        return;
+    }
+    // Unresolved functions are bound after compilation, assume they return.
+    fin_mod_func_t* func = fin_mod_find_func(ctx, cmp->mod, sign);
+    fin_mod_stack_adjust(cmp, (!func || func->ret_type ? 1 : 0) - args);
+    int32_t idx = fin_mod_bind_idx(ctx, cmp, sign);
+    fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_call);
+    fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
+    FIN_LOG("\tcall       %2d         // %s\n", idx, fin_str_cstr(sign));
+}
+
+static fin_mod_field_t* fin_mod_resolve_field(fin_ctx_t* ctx, fin_mod_t* mod, fin_str_t* type_name, fin_str_t* field_name) {
     fin_mod_type_t* type = fin_mod_find_type(ctx, mod, type_name);
     for (int32_t i=0; i<type->fields_count; i++) {
         if (type->fields[i].name == field_name)
-            return i;
+            return &type->fields[i];
     }
-    return -1;
+    printf("Unresolved field %s\n", fin_str_cstr(field_name));
+    assert(0);
+    return NULL;
 }
 
 static fin_mod_local_t* fin_mod_resolve_local(fin_mod_compiler_t* cmp, fin_str_t* id) {
@@ -181,6 +427,192 @@ static fin_mod_local_t* fin_mod_resolve_local(fin_mod_compiler_t* cmp, fin_str_t
     return NULL;
 }
 
+// Escape analysis. A struct local that only ever has its fields read and
+// written never escapes the frame, so it is scalar replaced: its fields live
+// in slots of their own, there is no new, and field access is local access.
+// Locals are tracked by name, a name qualifies when all its declarations
+// initialize a struct with { ... } and all its uses are v.field. Anything
+// else, passing v, returning it, storing it or assigning to it, escapes.
+static void fin_mod_scalar_mark(fin_mod_compiler_t* cmp, fin_str_t* name, bool escapes) {
+    for (int32_t i=0; i<cmp->scalars_count; i++) {
+        if (cmp->scalars[i].name == name) {
+            cmp->scalars[i].escapes |= escapes;
+            return;
+        }
+    }
+    cmp->scalars = (fin_mod_scalar_t*)fin_arena_realloc(cmp->arena, cmp->scalars, sizeof(fin_mod_scalar_t) * cmp->scalars_count, sizeof(fin_mod_scalar_t) * (cmp->scalars_count + 1));
+    cmp->scalars[cmp->scalars_count].name = name;
+    cmp->scalars[cmp->scalars_count].escapes = escapes;
+    cmp->scalars_count++;
+}
+
+// The local v of an access v.field, NULL for other ids.
+static fin_ast_id_expr_t* fin_mod_field_owner(fin_ast_id_expr_t* id_expr) {
+    if (!id_expr->primary || id_expr->primary->type != fin_ast_expr_type_id)
+        return NULL;
+    fin_ast_id_expr_t* owner = (fin_ast_id_expr_t*)id_expr->primary;
+    return owner->primary ? NULL : owner;
+}
+
+static void fin_mod_escape_expr(fin_mod_compiler_t* cmp, fin_ast_expr_t* expr) {
+    if (!expr)
+        return;
+    switch (expr->type) {
+        case fin_ast_expr_type_id: {
+            fin_ast_id_expr_t* id_expr = (fin_ast_id_expr_t*)expr;
+            if (!id_expr->primary)
+                fin_mod_scalar_mark(cmp, id_expr->name, true);
+            else if (!fin_mod_field_owner(id_expr))
+                fin_mod_escape_expr(cmp, id_expr->primary);
+            break;
+        }
+        case fin_ast_expr_type_str_interp: {
+            fin_ast_str_interp_expr_t* interp_expr = (fin_ast_str_interp_expr_t*)expr;
+            fin_mod_escape_expr(cmp, interp_expr->expr);
+            if (interp_expr->next)
+                fin_mod_escape_expr(cmp, &interp_expr->next->base);
+            break;
+        }
+        case fin_ast_expr_type_unary:
+            fin_mod_escape_expr(cmp, ((fin_ast_unary_expr_t*)expr)->expr);
+            break;
+        case fin_ast_expr_type_binary:
+            fin_mod_escape_expr(cmp, ((fin_ast_binary_expr_t*)expr)->lhs);
+            fin_mod_escape_expr(cmp, ((fin_ast_binary_expr_t*)expr)->rhs);
+            break;
+        case fin_ast_expr_type_cond: {
+            fin_ast_cond_expr_t* cond_expr = (fin_ast_cond_expr_t*)expr;
+            fin_mod_escape_expr(cmp, cond_expr->cond);
+            fin_mod_escape_expr(cmp, cond_expr->true_expr);
+            fin_mod_escape_expr(cmp, cond_expr->false_expr);
+            break;
+        }
+        case fin_ast_expr_type_arg:
+            fin_mod_escape_expr(cmp, ((fin_ast_arg_expr_t*)expr)->expr);
+            break;
+        case fin_ast_expr_type_invoke: {
+            for (fin_ast_arg_expr_t* e = ((fin_ast_invoke_expr_t*)expr)->args; e; e = e->next)
+                fin_mod_escape_expr(cmp, e->expr);
+            break;
+        }
+        case fin_ast_expr_type_init: {
+            for (fin_ast_arg_expr_t* e = ((fin_ast_init_expr_t*)expr)->args; e; e = e->next)
+                fin_mod_escape_expr(cmp, e->expr);
+            break;
+        }
+        case fin_ast_expr_type_assign: {
+            fin_ast_assign_expr_t* assign_expr = (fin_ast_assign_expr_t*)expr;
+            fin_ast_id_expr_t* id_expr = (fin_ast_id_expr_t*)assign_expr->lhs;
+            if (!id_expr->primary)
+                fin_mod_scalar_mark(cmp, id_expr->name, true);
+            else if (!fin_mod_field_owner(id_expr))
+                fin_mod_escape_expr(cmp, id_expr->primary);
+            fin_mod_escape_expr(cmp, assign_expr->rhs);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void fin_mod_escape_stmt(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_stmt_t* stmt) {
+    if (!stmt)
+        return;
+    switch (stmt->type) {
+        case fin_ast_stmt_type_expr:
+            fin_mod_escape_expr(cmp, ((fin_ast_expr_stmt_t*)stmt)->expr);
+            break;
+        case fin_ast_stmt_type_ret:
+            fin_mod_escape_expr(cmp, ((fin_ast_ret_stmt_t*)stmt)->expr);
+            break;
+        case fin_ast_stmt_type_if: {
+            fin_ast_if_stmt_t* if_stmt = (fin_ast_if_stmt_t*)stmt;
+            fin_mod_escape_expr(cmp, if_stmt->cond);
+            fin_mod_escape_stmt(ctx, cmp, if_stmt->true_stmt);
+            fin_mod_escape_stmt(ctx, cmp, if_stmt->false_stmt);
+            break;
+        }
+        case fin_ast_stmt_type_for: {
+            fin_ast_for_stmt_t* for_stmt = (fin_ast_for_stmt_t*)stmt;
+            fin_mod_escape_expr(cmp, for_stmt->init);
+            fin_mod_escape_expr(cmp, for_stmt->cond);
+            fin_mod_escape_expr(cmp, for_stmt->loop);
+            fin_mod_escape_stmt(ctx, cmp, for_stmt->stmt);
+            break;
+        }
+        case fin_ast_stmt_type_while: {
+            fin_ast_while_stmt_t* while_stmt = (fin_ast_while_stmt_t*)stmt;
+            fin_mod_escape_expr(cmp, while_stmt->cond);
+            fin_mod_escape_stmt(ctx, cmp, while_stmt->stmt);
+            break;
+        }
+        case fin_ast_stmt_type_do: {
+            fin_ast_do_stmt_t* do_stmt = (fin_ast_do_stmt_t*)stmt;
+            fin_mod_escape_stmt(ctx, cmp, do_stmt->stmt);
+            fin_mod_escape_expr(cmp, do_stmt->cond);
+            break;
+        }
+        case fin_ast_stmt_type_decl: {
+            fin_ast_decl_stmt_t* decl_stmt = (fin_ast_decl_stmt_t*)stmt;
+            fin_mod_type_t* type = fin_mod_find_type(ctx, cmp->mod, decl_stmt->type->name);
+            bool scalar = type && type->layout.fields_count > 0 && decl_stmt->init && decl_stmt->init->type == fin_ast_expr_type_init;
+            fin_mod_scalar_mark(cmp, decl_stmt->name, !scalar);
+            fin_mod_escape_expr(cmp, decl_stmt->init);
+            break;
+        }
+        case fin_ast_stmt_type_block: {
+            for (fin_ast_stmt_t* s = ((fin_ast_block_stmt_t*)stmt)->stmts; s; s = s->next)
+                fin_mod_escape_stmt(ctx, cmp, s);
+            break;
+        }
+    }
+}
+
+// Declares the local of decl_stmt, with a slot per field when it is scalar
+// replaced.
+static fin_mod_local_t* fin_mod_local_decl(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_decl_stmt_t* decl_stmt) {
+    assert(!fin_mod_resolve_local(cmp, decl_stmt->name));
+    int32_t fields = 0;
+    for (int32_t i=0; i<cmp->scalars_count; i++) {
+        if (cmp->scalars[i].name == decl_stmt->name && !cmp->scalars[i].escapes)
+            fields = fin_mod_find_type(ctx, cmp->mod, decl_stmt->type->name)->layout.fields_count;
+    }
+    int32_t first = cmp->locals_count;
+    for (int32_t i=0; i<(fields ? fields : 1); i++) {
+        fin_mod_local_t* local = fin_mod_local_add(ctx, cmp);
+        local->name = i ? NULL : decl_stmt->name;
+        local->type = i ? NULL : decl_stmt->type->name;
+        local->idx = cmp->locals_count - cmp->params_count - 1;
+        local->fields = i ? 0 : fields;
+        local->is_param = false;
+    }
+    return &cmp->locals[first];
+}
+
+// Resolves the field access id_expr, false when it is a plain local.
+static bool fin_mod_resolve_path(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_id_expr_t* id_expr, fin_mod_path_t* path) {
+    if (!id_expr->primary)
+        return false;
+    fin_ast_expr_t* primary = id_expr->primary;
+    fin_str_t* type_name = NULL;
+    if (primary->type == fin_ast_expr_type_id && fin_mod_resolve_path(ctx, cmp, (fin_ast_id_expr_t*)primary, path) && path->field->is_inline) {
+        type_name = fin_str_clone(path->field->type);
+    }
+    else {
+        fin_mod_local_t* local = NULL;
+        if (primary->type == fin_ast_expr_type_id && !((fin_ast_id_expr_t*)primary)->primary)
+            local = fin_mod_resolve_local(cmp, ((fin_ast_id_expr_t*)primary)->name);
+        path->obj = local && local->fields ? NULL : primary;
+        path->scalar = local && local->fields ? local->idx : -1;
+        path->offset = 0;
+        type_name = fin_mod_resolve_type(ctx, cmp, primary);
+    }
+    path->field = fin_mod_resolve_field(ctx, cmp->mod, type_name, id_expr->name);
+    path->offset += path->field->offset;
+    fin_str_destroy(ctx, type_name);
+    return true;
+}
+
 static fin_str_t* fin_mod_invoke_get_signature(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_invoke_expr_t* expr) {
     char signature[128];
     signature[0] = '\0';
@@ -326,27 +758,112 @@ static fin_str_t* fin_mod_resolve_type(fin_ctx_t* ctx, fin_mod_compiler_t* cmp,
     }
 }
 
+static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_expr_t* expr);
+
+static void fin_mod_compile_new(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_mod_type_t* type) {
+    int32_t obj_type = fin_mod_obj_type_idx(ctx, cmp, type);
+    fin_mod_stack_adjust(cmp, 1 - type->layout.fields_count);
+    fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_new);
+    fin_mod_code_emit_uint16(ctx, &cmp->code, obj_type);
+    FIN_LOG("\tnew        %2d         // %s\n", obj_type, fin_str_cstr(type->name));
+}
+
+// Evaluates expr into a hidden local so its value can be pushed repeatedly,
+// returns -1 without emitting anything when expr is a local or an arg.
+static int32_t fin_mod_compile_temp(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_expr_t* expr) {
+    if (expr->type == fin_ast_expr_type_id && !((fin_ast_id_expr_t*)expr)->primary)
+        return -1;
+    fin_mod_compile_expr(ctx, cmp, expr);
+    fin_mod_local_t* local = fin_mod_local_add(ctx, cmp);
+    local->name = NULL;
+    local->type = NULL;
+    local->idx = cmp->locals_count - cmp->params_count - 1;
+    local->fields = 0;
+    local->is_param = false;
+    fin_mod_stack_adjust(cmp, -1);
+    fin_mod_compile_slot(ctx, cmp, fin_op_store_local, local->idx);
+    FIN_LOG("\tstore_loc  %2d\n", local->idx);
+    return local->idx;
+}
+
+static void fin_mod_compile_reload(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_expr_t* expr, int32_t temp) {
+    if (temp < 0) {
+        fin_mod_compile_expr(ctx, cmp, expr);
+        return;
+    }
+    fin_mod_stack_adjust(cmp, 1);
+    fin_mod_compile_slot(ctx, cmp, fin_op_load_local, temp);
+    FIN_LOG("\tload_loc   %2d\n", temp);
+}
+
+// Loads or stores a slot of path, after fin_mod_compile_path_obj pushed the
+// object holding it.
+static void fin_mod_compile_path_slot(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_mod_path_t* path, bool store, int32_t slot) {
+    if (!path->obj) {
+        fin_mod_stack_adjust(cmp, store ? -1 : 1);
+        fin_mod_compile_slot(ctx, cmp, store ? fin_op_store_local : fin_op_load_local, path->scalar + slot);
+        FIN_LOG("\t%s  %2d         // %s\n", store ? "store_loc" : "load_loc ", path->scalar + slot, fin_str_cstr(path->field->name));
+        return;
+    }
+    if (store) {
+        fin_mod_stack_adjust(cmp, -2);
+        fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_store_field);
+    }
+    else
+        fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_field);
+    fin_mod_code_emit_uint8(ctx, &cmp->code, slot);
+    FIN_LOG("\t%s  %2d         // %s\n", store ? "store_fld" : "load_fld ", slot, fin_str_cstr(path->field->name));
+}
+
+static void fin_mod_compile_path_obj(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_mod_path_t* path, int32_t temp) {
+    if (path->obj)
+        fin_mod_compile_reload(ctx, cmp, path->obj, temp);
+}
+
+// Reading an inline field whole copies its slots into a new object.
+static void fin_mod_compile_path_copy(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_mod_path_t* path) {
+    fin_mod_type_t* type = fin_mod_find_type(ctx, cmp->mod, path->field->type);
+    int32_t temp = path->obj ? fin_mod_compile_temp(ctx, cmp, path->obj) : -1;
+    for (int32_t i=0; i<type->layout.fields_count; i++) {
+        fin_mod_compile_path_obj(ctx, cmp, path, temp);
+        fin_mod_compile_path_slot(ctx, cmp, path, false, path->offset + i);
+    }
+    fin_mod_compile_new(ctx, cmp, type);
+}
+
+// Assigning an inline field copies the slots of the object rhs evaluates to.
+static void fin_mod_compile_path_store(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_mod_path_t* path, fin_ast_expr_t* rhs) {
+    fin_mod_type_t* type = fin_mod_find_type(ctx, cmp->mod, path->field->type);
+    int32_t temp = path->obj ? fin_mod_compile_temp(ctx, cmp, path->obj) : -1;
+    int32_t val = fin_mod_compile_temp(ctx, cmp, rhs);
+    for (int32_t i=0; i<type->layout.fields_count; i++) {
+        fin_mod_compile_path_obj(ctx, cmp, path, temp);
+        fin_mod_compile_reload(ctx, cmp, rhs, val);
+        fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_field);
+        fin_mod_code_emit_uint8(ctx, &cmp->code, i);
+        FIN_LOG("\tload_fld   %2d\n", i);
+        fin_mod_compile_path_slot(ctx, cmp, path, true, path->offset + i);
+    }
+}
+
 static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_expr_t* expr) {
     switch (expr->type) {
         case fin_ast_expr_type_id: {
             fin_ast_id_expr_t* id_expr = (fin_ast_id_expr_t*)expr;
-            if (id_expr->primary) {
-                fin_mod_compile_expr(ctx, cmp, id_expr->primary);
-                fin_str_t* type_name = fin_mod_resolve_type(ctx, cmp, id_expr->primary);
-                int32_t field_idx = fin_mod_resolve_field(ctx, cmp->mod, type_name, id_expr->name);
-                fin_str_destroy(ctx, type_name);
-                if (field_idx >= 0) {
-                    fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_field);
-                    fin_mod_code_emit_uint8(ctx, &cmp->code, field_idx);
-                    FIN_LOG("\tload_fld   %2d         // %s\n", field_idx, fin_str_cstr(id_expr->name));
-                    break;
+            fin_mod_path_t path;
+            if (fin_mod_resolve_path(ctx, cmp, id_expr, &path)) {
+                if (path.field->is_inline)
+                    fin_mod_compile_path_copy(ctx, cmp, &path);
+                else {
+                    fin_mod_compile_path_obj(ctx, cmp, &path, -1);
+                    fin_mod_compile_path_slot(ctx, cmp, &path, false, path.offset);
                 }
             }
             else {
                 fin_mod_local_t* local = fin_mod_resolve_local(cmp, id_expr->name);
                 assert(local);
-                fin_mod_code_emit_uint8(ctx, &cmp->code, local->is_param ? fin_op_load_arg : fin_op_load_local);
-                fin_mod_code_emit_uint8(ctx, &cmp->code, local->idx);
+                fin_mod_stack_adjust(cmp, 1);
+                fin_mod_compile_slot(ctx, cmp, local->is_param ? fin_op_load_arg : fin_op_load_local, local->idx);
                 FIN_LOG("\t%s   %2d         // %s\n",
                     local->is_param ? "load_arg" : "load_loc", local->idx, fin_str_cstr(local->name));
             }
@@ -355,27 +872,24 @@ static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
         case fin_ast_expr_type_bool: {
             fin_ast_bool_expr_t* bool_expr = (fin_ast_bool_expr_t*)expr;
             fin_val_t val = { .b = bool_expr->value };
-            int16_t idx = fin_mod_const_idx(cmp, val);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_const);
-            fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
+            int32_t idx = fin_mod_const_idx(ctx, cmp, val);
+            fin_mod_compile_const(ctx, cmp, idx);
             FIN_LOG("\tload_const %2d         // %s\n", idx, bool_expr->value ? "true" : "false");
             break;
         }
         case fin_ast_expr_type_int: {
             fin_ast_int_expr_t* int_expr = (fin_ast_int_expr_t*)expr;
             fin_val_t val = { .i = int_expr->value };
-            int16_t idx = fin_mod_const_idx(cmp, val);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_const);
-            fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
+            int32_t idx = fin_mod_const_idx(ctx, cmp, val);
+            fin_mod_compile_const(ctx, cmp, idx);
             FIN_LOG("\tload_const %2d         // %d\n", idx, (int32_t)int_expr->value);
             break;
         }
         case fin_ast_expr_type_float: {
             fin_ast_float_expr_t* float_expr = (fin_ast_float_expr_t*)expr;
             fin_val_t val = { .f = float_expr->value };
-            int16_t idx = fin_mod_const_idx(cmp, val);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_const);
-            fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
+            int32_t idx = fin_mod_const_idx(ctx, cmp, val);
+            fin_mod_compile_const(ctx, cmp, idx);
             FIN_LOG("\tload_const %2d         // %f\n", idx, float_expr->value);
             break;
         }
@@ -384,9 +898,8 @@ static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
             fin_val_t val = { .s = str_expr->value };
             if (val.s)
                 val.s = fin_str_clone(val.s);
-            int16_t idx = fin_mod_const_idx(cmp, val);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_const);
-            fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
+            int32_t idx = fin_mod_const_idx(ctx, cmp, val);
+            fin_mod_compile_const(ctx, cmp, idx);
             FIN_LOG("\tload_const %2d         // \"%s\"\n", idx, fin_str_cstr(str_expr->value));
             break;
         }
@@ -401,20 +914,14 @@ static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
                 strcat(signature, fin_str_cstr(type));
                 strcat(signature, ")");
                 fin_str_t* sign = fin_str_create(ctx, signature, -1);
-                int16_t idx = fin_mod_bind_idx(cmp, sign);
-                fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_call);
-                fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
-                FIN_LOG("\tcall       %2d         // %s\n", idx, fin_str_cstr(sign));
+                fin_mod_compile_call(ctx, cmp, sign, 1);
                 fin_str_destroy(ctx, sign);
             }
             fin_str_destroy(ctx, type);
             if (interp_expr->next) {
                 fin_mod_compile_expr(ctx, cmp, &interp_expr->next->base);
                 fin_str_t* sign = fin_str_create(ctx, "__op_add(string,string)", -1);
-                int16_t idx = fin_mod_bind_idx(cmp, sign);
-                fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_call);
-                fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
-                FIN_LOG("\tcall       %2d         // %s\n", idx, fin_str_cstr(sign));
+                fin_mod_compile_call(ctx, cmp, sign, 2);
                 fin_str_destroy(ctx, sign);
             }
             break;
@@ -424,10 +931,7 @@ static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
             fin_mod_compile_expr(ctx, cmp, unary_expr->expr);
 
             fin_str_t* sign = fin_mod_unary_get_signature(ctx, cmp, unary_expr);
-            int16_t idx = fin_mod_bind_idx(cmp, sign);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_call);
-            fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
-            FIN_LOG("\tcall       %2d         // %s\n", idx, fin_str_cstr(sign));
+            fin_mod_compile_call(ctx, cmp, sign, 1);
             fin_str_destroy(ctx, sign);
             break;
         }
@@ -437,41 +941,30 @@ static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
             fin_mod_compile_expr(ctx, cmp, bin_expr->rhs);
 
             fin_str_t* sign = fin_mod_binary_get_signature(ctx, cmp, bin_expr);
-            int16_t idx = fin_mod_bind_idx(cmp, sign);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_call);
-            fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
-            FIN_LOG("\tcall       %2d         // %s\n", idx, fin_str_cstr(sign));
+            fin_mod_compile_call(ctx, cmp, sign, 2);
             fin_str_destroy(ctx, sign);
             break;
         }
         case fin_ast_expr_type_cond: {
             fin_ast_cond_expr_t* cond_expr = (fin_ast_cond_expr_t*)expr;
             fin_mod_compile_expr(ctx, cmp, cond_expr->cond);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_branch_if_n);
-            uint8_t* lbl_else = cmp->code.top;
-            fin_mod_code_emit_uint16(ctx, &cmp->code, 0);
-            FIN_LOG("\tbr_if_n     lbl_%d\n", (int32_t)(lbl_else - cmp->code.begin));
+            fin_mod_stack_adjust(cmp, -1);
+            int32_t lbl_else = fin_mod_compile_branch(ctx, cmp, fin_op_branch_if_n, -1);
+            FIN_LOG("\tbr_if_n     lbl_%d\n", lbl_else);
             fin_mod_compile_expr(ctx, cmp, cond_expr->true_expr);
             if (cond_expr->false_expr) {
-                fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_branch);
-                uint8_t* lbl_end = cmp->code.top;
-                fin_mod_code_emit_uint16(ctx, &cmp->code, 0);
-                FIN_LOG("\tbr          lbl_%d\n", (int32_t)(lbl_end - cmp->code.begin));
-                FIN_LOG("lbl_%d:\n", (int32_t)(lbl_else - cmp->code.begin));
-                uint16_t offset = cmp->code.top - lbl_else - 2;
-                *lbl_else++ = offset & 0xFF;
-                *lbl_else++ = (offset >> 8) & 0xFF;
+                int32_t lbl_end = fin_mod_compile_branch(ctx, cmp, fin_op_branch, -1);
+                FIN_LOG("\tbr          lbl_%d\n", lbl_end);
+                FIN_LOG("lbl_%d:\n", lbl_else);
+                fin_mod_code_patch(cmp, lbl_else);
+                fin_mod_stack_adjust(cmp, -1);
                 fin_mod_compile_expr(ctx, cmp, cond_expr->false_expr);
-                FIN_LOG("lbl_%d:\n", (int32_t)(lbl_end - cmp->code.begin));
-                offset = cmp->code.top - lbl_end - 2;
-                *lbl_end++ = offset & 0xFF;
-                *lbl_end++ = (offset >> 8) & 0xFF;
+                FIN_LOG("lbl_%d:\n", lbl_end);
+                fin_mod_code_patch(cmp, lbl_end);
             }
             else {
-                FIN_LOG("lbl_%d:\n", (int32_t)(lbl_else - cmp->code.begin));
-                uint16_t offset = cmp->code.top - lbl_else - 2;
-                *lbl_else++ = offset & 0xFF;
-                *lbl_else++ = (offset >> 8) & 0xFF;
+                FIN_LOG("lbl_%d:\n", lbl_else);
+                fin_mod_code_patch(cmp, lbl_else);
             }
             break;
         }
@@ -482,13 +975,11 @@ static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
         }
         case fin_ast_expr_type_invoke: {
             fin_ast_invoke_expr_t* invoke_expr = (fin_ast_invoke_expr_t*)expr;
-            for (fin_ast_arg_expr_t* e = invoke_expr->args; e; e = e->next)
+            int32_t args = 0;
+            for (fin_ast_arg_expr_t* e = invoke_expr->args; e; e = e->next, args++)
                 fin_mod_compile_expr(ctx, cmp, &e->base);
             fin_str_t* sign = fin_mod_invoke_get_signature(ctx, cmp, invoke_expr);
-            int16_t idx = fin_mod_bind_idx(cmp, sign);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_call);
-            fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
-            FIN_LOG("\tcall       %2d         // %s\n", idx, fin_str_cstr(sign));
+            fin_mod_compile_call(ctx, cmp, sign, args);
             fin_str_destroy(ctx, sign);
             break;
         }
@@ -497,25 +988,22 @@ static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
             assert(assign_expr->op == fin_ast_assign_type_assign); // rest not supported yet
             assert(assign_expr->lhs->type == fin_ast_expr_type_id);
             fin_ast_id_expr_t* id_expr = (fin_ast_id_expr_t*)assign_expr->lhs;
-            if (id_expr->primary)
-                fin_mod_compile_expr(ctx, cmp, id_expr->primary);
-            fin_mod_compile_expr(ctx, cmp, assign_expr->rhs);
-            if (id_expr->primary) {
-                fin_str_t* type_name = fin_mod_resolve_type(ctx, cmp, id_expr->primary);
-                int32_t field_idx = fin_mod_resolve_field(ctx, cmp->mod, type_name, id_expr->name);
-                fin_str_destroy(ctx, type_name);
-                if (field_idx >= 0) {
-                    fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_store_field);
-                    fin_mod_code_emit_uint8(ctx, &cmp->code, field_idx);
-                    FIN_LOG("\tstore_fld  %2d         // %s\n", field_idx, fin_str_cstr(id_expr->name));
-                    break;
+            fin_mod_path_t path;
+            if (fin_mod_resolve_path(ctx, cmp, id_expr, &path)) {
+                if (path.field->is_inline)
+                    fin_mod_compile_path_store(ctx, cmp, &path, assign_expr->rhs);
+                else {
+                    fin_mod_compile_path_obj(ctx, cmp, &path, -1);
+                    fin_mod_compile_expr(ctx, cmp, assign_expr->rhs);
+                    fin_mod_compile_path_slot(ctx, cmp, &path, true, path.offset);
                 }
             }
             else {
+                fin_mod_compile_expr(ctx, cmp, assign_expr->rhs);
                 fin_mod_local_t* local = fin_mod_resolve_local(cmp, id_expr->name);
                 assert(local);
-                fin_mod_code_emit_uint8(ctx, &cmp->code, local->is_param ? fin_op_store_arg : fin_op_store_local);
-                fin_mod_code_emit_uint8(ctx, &cmp->code, local->idx);
+                fin_mod_stack_adjust(cmp, -1);
+                fin_mod_compile_slot(ctx, cmp, local->is_param ? fin_op_store_arg : fin_op_store_local, local->idx);
                 FIN_LOG("\t%s  %2d         // %s\n",
                 local->is_param ? "store_arg" : "store_loc", local->idx, fin_str_cstr(local->name));
             }
@@ -526,35 +1014,80 @@ static void fin_mod_compile_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
     }
 }
 
-static void fin_mod_compile_init_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_init_expr_t* expr, fin_str_t* type_name) {
+// A returned call to a script function compiles to a call instruction whose
+// opcode is then replaced by tail_call, which reuses the frame of the caller.
+static bool fin_mod_is_tail_call(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_expr_t* expr) {
+    if (!expr || expr->type != fin_ast_expr_type_invoke)
+        return false;
+    fin_str_t* sign = fin_mod_invoke_get_signature(ctx, cmp, (fin_ast_invoke_expr_t*)expr);
+    fin_mod_func_t* func = fin_mod_find_func(ctx, cmp->mod, sign);
+    fin_str_destroy(ctx, sign);
+    return func && !func->is_native;
+}
+
+// Pushes the slots of a struct initializer, an arg for an inline field
+// pushes every field of its object.
+static fin_mod_type_t* fin_mod_compile_init_args(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_init_expr_t* expr, fin_str_t* type_name) {
     fin_mod_type_t* type = fin_mod_find_type(ctx, cmp->mod, type_name);
     assert(type);
     int32_t args_count = 0;
     for (fin_ast_arg_expr_t* e = expr->args; e; e = e->next)
         args_count++;
     assert(args_count == type->fields_count);
-    int32_t idx = 0;
-    for (fin_ast_arg_expr_t* e = expr->args; e; e = e->next) {
+    fin_mod_field_t* field = type->fields;
+    for (fin_ast_arg_expr_t* e = expr->args; e; e = e->next, field++) {
         fin_str_t* arg_type = fin_mod_resolve_type(ctx, cmp, e->expr);
-        assert(arg_type == type->fields[idx].type);
+        assert(arg_type == field->type);
         fin_str_destroy(ctx, arg_type);
-        fin_mod_compile_expr(ctx, cmp, e->expr);
-        idx++;
+        if (!field->is_inline) {
+            fin_mod_compile_expr(ctx, cmp, e->expr);
+            continue;
+        }
+        int32_t temp = fin_mod_compile_temp(ctx, cmp, e->expr);
+        int32_t slots = fin_mod_find_type(ctx, cmp->mod, field->type)->layout.fields_count;
+        for (int32_t i=0; i<slots; i++) {
+            fin_mod_compile_reload(ctx, cmp, e->expr, temp);
+            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_load_field);
+            fin_mod_code_emit_uint8(ctx, &cmp->code, i);
+            FIN_LOG("\tload_fld   %2d\n", i);
+        }
+    }
+    return type;
+}
+
+static void fin_mod_compile_init_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_init_expr_t* expr, fin_str_t* type_name) {
+    fin_mod_type_t* type = fin_mod_compile_init_args(ctx, cmp, expr, type_name);
+    fin_mod_compile_new(ctx, cmp, type);
+}
+
+// Evaluates expr for its side effects and pops the value it leaves, if any.
+static void fin_mod_compile_discard(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_expr_t* expr) {
+    int32_t depth = cmp->depth;
+    fin_mod_compile_expr(ctx, cmp, expr);
+    while (cmp->depth > depth) {
+        fin_mod_stack_adjust(cmp, -1);
+        fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_pop);
+        FIN_LOG("\tpop\n");
     }
-    fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_new);
-    fin_mod_code_emit_uint8(ctx, &cmp->code, type->fields_count);
-    FIN_LOG("\tnew        %2d         // %s\n", type->fields_count, fin_str_cstr(type->name));
 }
 
 static void fin_mod_compile_stmt(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_stmt_t* stmt) {
     switch (stmt->type) {
         case fin_ast_stmt_type_expr: {
             fin_ast_expr_stmt_t* expr_stmt = (fin_ast_expr_stmt_t*)stmt;
-            fin_mod_compile_expr(ctx, cmp, expr_stmt->expr);
+            fin_mod_compile_discard(ctx, cmp, expr_stmt->expr);
             break;
         }
         case fin_ast_stmt_type_ret: {
             fin_ast_ret_stmt_t* ret_stmt = (fin_ast_ret_stmt_t*)stmt;
+            int32_t depth = cmp->depth;
+            if (fin_mod_is_tail_call(ctx, cmp, ret_stmt->expr)) {
+                fin_mod_compile_expr(ctx, cmp, ret_stmt->expr);
+                cmp->code.top[-3] = fin_op_tail_call;
+                cmp->depth = depth;
+                FIN_LOG("\t// tail call\n");
+                break;
+            }
             if (ret_stmt->expr) {
                 if (ret_stmt->expr->type == fin_ast_expr_type_init)
                     fin_mod_compile_init_expr(ctx, cmp, (fin_ast_init_expr_t*)ret_stmt->expr, cmp->ret_type);
@@ -562,124 +1095,111 @@ static void fin_mod_compile_stmt(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
                     fin_mod_compile_expr(ctx, cmp, ret_stmt->expr);
             }
             fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_return);
+            cmp->depth = depth;
             FIN_LOG("\tret\n");
             break;
         }
         case fin_ast_stmt_type_if: {
             fin_ast_if_stmt_t* if_stmt = (fin_ast_if_stmt_t*)stmt;
             fin_mod_compile_expr(ctx, cmp, if_stmt->cond);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_branch_if_n);
-            uint8_t* lbl_else = cmp->code.top;
-            fin_mod_code_emit_uint16(ctx, &cmp->code, 0);
-            FIN_LOG("\tbr_if_n     lbl_%d\n", (int32_t)(lbl_else - cmp->code.begin));
+            fin_mod_stack_adjust(cmp, -1);
+            int32_t lbl_else = fin_mod_compile_branch(ctx, cmp, fin_op_branch_if_n, -1);
+            FIN_LOG("\tbr_if_n     lbl_%d\n", lbl_else);
             fin_mod_scope_begin(cmp);
             fin_mod_compile_stmt(ctx, cmp, if_stmt->true_stmt);
             fin_mod_scope_end(cmp);
             if (if_stmt->false_stmt) {
-                fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_branch);
-                uint8_t* lbl_end = cmp->code.top;
-                fin_mod_code_emit_uint16(ctx, &cmp->code, 0);
-                FIN_LOG("\tbr          lbl_%d\n", (int32_t)(lbl_end - cmp->code.begin));
-                FIN_LOG("lbl_%d:\n", (int32_t)(lbl_else - cmp->code.begin));
-                uint16_t offset = cmp->code.top - lbl_else - 2;
-                *lbl_else++ = offset & 0xFF;
-                *lbl_else++ = (offset >> 8) & 0xFF;
+                int32_t lbl_end = fin_mod_compile_branch(ctx, cmp, fin_op_branch, -1);
+                FIN_LOG("\tbr          lbl_%d\n", lbl_end);
+                FIN_LOG("lbl_%d:\n", lbl_else);
+                fin_mod_code_patch(cmp, lbl_else);
                 fin_mod_scope_begin(cmp);
                 fin_mod_compile_stmt(ctx, cmp, if_stmt->false_stmt);
                 fin_mod_scope_end(cmp);
-                FIN_LOG("lbl_%d:\n", (int32_t)(lbl_end - cmp->code.begin));
-                offset = cmp->code.top - lbl_end - 2;
-                *lbl_end++ = offset & 0xFF;
-                *lbl_end++ = (offset >> 8) & 0xFF;
+                FIN_LOG("lbl_%d:\n", lbl_end);
+                fin_mod_code_patch(cmp, lbl_end);
             }
             else {
-                FIN_LOG("lbl_%d:\n", (int32_t)(lbl_else - cmp->code.begin));
-                uint16_t offset = cmp->code.top - lbl_else - 2;
-                *lbl_else++ = offset & 0xFF;
-                *lbl_else++ = (offset >> 8) & 0xFF;
+                FIN_LOG("lbl_%d:\n", lbl_else);
+                fin_mod_code_patch(cmp, lbl_else);
             }
             break;
         }
         case fin_ast_stmt_type_for: {
             fin_ast_for_stmt_t* for_stmt = (fin_ast_for_stmt_t*)stmt;
             fin_mod_scope_begin(cmp);
-            fin_mod_compile_expr(ctx, cmp, for_stmt->init);
-            uint8_t* lbl_loop = cmp->code.top;
-            FIN_LOG("lbl_%d:\n", (int32_t)(lbl_loop - cmp->code.begin));
+            fin_mod_compile_discard(ctx, cmp, for_stmt->init);
+            int32_t lbl_loop = fin_mod_code_pos(cmp);
+            FIN_LOG("lbl_%d:\n", lbl_loop);
             fin_mod_compile_expr(ctx, cmp, for_stmt->cond);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_branch_if_n);
-            uint8_t* lbl_end = cmp->code.top;
-            fin_mod_code_emit_uint16(ctx, &cmp->code, 0);
-            FIN_LOG("\tbr_if_n     lbl_%d\n", (int32_t)(lbl_end - cmp->code.begin));
+            fin_mod_stack_adjust(cmp, -1);
+            int32_t lbl_end = fin_mod_compile_branch(ctx, cmp, fin_op_branch_if_n, -1);
+            FIN_LOG("\tbr_if_n     lbl_%d\n", lbl_end);
             fin_mod_scope_begin(cmp);
             fin_mod_compile_stmt(ctx, cmp, for_stmt->stmt);
             fin_mod_scope_end(cmp);
-            fin_mod_compile_expr(ctx, cmp, for_stmt->loop);
-            uint16_t offset = lbl_loop - cmp->code.top - 3;
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_branch);
-            fin_mod_code_emit_uint16(ctx, &cmp->code, offset);
-            FIN_LOG("\tbr          lbl_%d\n", (int32_t)(lbl_loop - cmp->code.begin));
-            FIN_LOG("lbl_%d:\n", (int32_t)(lbl_end - cmp->code.begin));
-            offset = cmp->code.top - lbl_end - 2;
-            *lbl_end++ = offset & 0xFF;
-            *lbl_end++ = (offset >> 8) & 0xFF;
+            fin_mod_compile_discard(ctx, cmp, for_stmt->loop);
+            fin_mod_compile_branch(ctx, cmp, fin_op_branch, lbl_loop);
+            FIN_LOG("\tbr          lbl_%d\n", lbl_loop);
+            FIN_LOG("lbl_%d:\n", lbl_end);
+            fin_mod_code_patch(cmp, lbl_end);
             fin_mod_scope_end(cmp);
             break;
         }
         case fin_ast_stmt_type_while: {
             fin_ast_while_stmt_t* while_stmt = (fin_ast_while_stmt_t*)stmt;
             fin_mod_scope_begin(cmp);
-            uint8_t* lbl_loop = cmp->code.top;
-            FIN_LOG("lbl_%d:\n", (int32_t)(lbl_loop - cmp->code.begin));
+            int32_t lbl_loop = fin_mod_code_pos(cmp);
+            FIN_LOG("lbl_%d:\n", lbl_loop);
             fin_mod_compile_expr(ctx, cmp, while_stmt->cond);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_branch_if_n);
-            uint8_t* lbl_end = cmp->code.top;
-            fin_mod_code_emit_uint16(ctx, &cmp->code, 0);
-            FIN_LOG("\tbr_if_n     lbl_%d\n", (int32_t)(lbl_end - cmp->code.begin));
+            fin_mod_stack_adjust(cmp, -1);
+            int32_t lbl_end = fin_mod_compile_branch(ctx, cmp, fin_op_branch_if_n, -1);
+            FIN_LOG("\tbr_if_n     lbl_%d\n", lbl_end);
             fin_mod_scope_begin(cmp);
             fin_mod_compile_stmt(ctx, cmp, while_stmt->stmt);
             fin_mod_scope_end(cmp);
-            uint16_t offset = lbl_loop - cmp->code.top - 3;
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_branch);
-            fin_mod_code_emit_uint16(ctx, &cmp->code, offset);
-            FIN_LOG("\tbr          lbl_%d\n", (int32_t)(lbl_loop - cmp->code.begin));
-            FIN_LOG("lbl_%d:\n", (int32_t)(lbl_end - cmp->code.begin));
-            offset = cmp->code.top - lbl_end - 2;
-            *lbl_end++ = offset & 0xFF;
-            *lbl_end++ = (offset >> 8) & 0xFF;
+            fin_mod_compile_branch(ctx, cmp, fin_op_branch, lbl_loop);
+            FIN_LOG("\tbr          lbl_%d\n", lbl_loop);
+            FIN_LOG("lbl_%d:\n", lbl_end);
+            fin_mod_code_patch(cmp, lbl_end);
             fin_mod_scope_end(cmp);
             break;
         }
         case fin_ast_stmt_type_do: {
             fin_ast_do_stmt_t* do_stmt = (fin_ast_do_stmt_t*)stmt;
-            uint8_t* lbl_loop = cmp->code.top;
-            FIN_LOG("lbl_%d:\n", (int32_t)(lbl_loop - cmp->code.begin));
+            int32_t lbl_loop = fin_mod_code_pos(cmp);
+            FIN_LOG("lbl_%d:\n", lbl_loop);
             fin_mod_scope_begin(cmp);
             fin_mod_compile_stmt(ctx, cmp, do_stmt->stmt);
             fin_mod_scope_end(cmp);
             fin_mod_compile_expr(ctx, cmp, do_stmt->cond);
-            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_branch_if);
-            FIN_LOG("\tbr_if       lbl_%d\n", (int32_t)(lbl_loop - cmp->code.begin));
-            uint16_t offset = lbl_loop - cmp->code.top - 2;
-            fin_mod_code_emit_uint16(ctx, &cmp->code, offset);
+            fin_mod_stack_adjust(cmp, -1);
+            fin_mod_compile_branch(ctx, cmp, fin_op_branch_if, lbl_loop);
+            FIN_LOG("\tbr_if       lbl_%d\n", lbl_loop);
             break;
         }
         case fin_ast_stmt_type_decl: {
             fin_ast_decl_stmt_t* decl_stmt = (fin_ast_decl_stmt_t*)stmt;
-            assert(!fin_mod_resolve_local(cmp, decl_stmt->name));
-            fin_mod_local_t* local = &cmp->locals[cmp->locals_count++];
-            local->name = decl_stmt->name;
-            local->type = decl_stmt->type->name;
-            local->idx = cmp->locals_count - cmp->params_count - 1;
-            local->is_param = false;
-            if (decl_stmt->init) {
+            fin_mod_local_t* local = fin_mod_local_decl(ctx, cmp, decl_stmt);
+            // Inline fields may add hidden locals during the init, moving local.
+            int32_t idx = local->idx;
+            int32_t fields = local->fields;
+            if (fields) {
+                fin_mod_compile_init_args(ctx, cmp, (fin_ast_init_expr_t*)decl_stmt->init, decl_stmt->type->name);
+                for (int32_t i=fields-1; i>=0; i--) {
+                    fin_mod_stack_adjust(cmp, -1);
+                    fin_mod_compile_slot(ctx, cmp, fin_op_store_local, idx + i);
+                    FIN_LOG("\tstore_loc  %2d\n", idx + i);
+                }
+            }
+            else if (decl_stmt->init) {
                 if (decl_stmt->init->type == fin_ast_expr_type_init)
                     fin_mod_compile_init_expr(ctx, cmp, (fin_ast_init_expr_t*)decl_stmt->init, decl_stmt->type->name);
                 else
                     fin_mod_compile_expr(ctx, cmp, decl_stmt->init);
-                fin_mod_code_emit_uint8(ctx, &cmp->code, fin_op_store_local);
-                fin_mod_code_emit_uint8(ctx, &cmp->code, local->idx);
-                FIN_LOG("\tstore_loc  %2d\n", local->idx);
+                fin_mod_stack_adjust(cmp, -1);
+                fin_mod_compile_slot(ctx, cmp, fin_op_store_local, idx);
+                FIN_LOG("\tstore_loc  %2d\n", idx);
             }
             break;
         }
@@ -694,40 +1214,605 @@ static void fin_mod_compile_stmt(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_as
     }
 }
 
-static void fin_mod_compile_func(fin_mod_func_t* out_func, fin_ctx_t* ctx, fin_mod_t* mod, fin_ast_func_t* func) {
+static int32_t fin_mod_reg_alloc(fin_mod_compiler_t* cmp, int32_t count) {
+    int32_t reg = cmp->temps;
+    cmp->temps += count;
+    if (cmp->temps_max < cmp->temps)
+        cmp->temps_max = cmp->temps;
+    if (cmp->temps > FIN_REG_COUNT)
+        cmp->regs_overflow = true;
+    return reg;
+}
+
+static int32_t fin_mod_reg_local(fin_mod_compiler_t* cmp, fin_mod_local_t* local) {
+    return local->is_param ? local->idx : cmp->params_count + local->idx;
+}
+
+static void fin_mod_reg_emit(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_reg_op_t op, int32_t a, int32_t b, int32_t c, int32_t count) {
+    fin_mod_code_emit_uint8(ctx, &cmp->code, op);
+    if (count > 0)
+        fin_mod_code_emit_uint8(ctx, &cmp->code, a);
+    if (count > 1)
+        fin_mod_code_emit_uint8(ctx, &cmp->code, b);
+    if (count > 2)
+        fin_mod_code_emit_uint8(ctx, &cmp->code, c);
+}
+
+static int32_t fin_mod_reg_move(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, int32_t dst, int32_t src) {
+    if (dst < 0 || dst == src)
+        return src;
+    fin_mod_reg_emit(ctx, cmp, fin_reg_op_move, dst, src, 0, 2);
+    FIN_LOG("\tmove       r%d, %c%d\n", dst, FIN_LOG_RK(src));
+    return dst;
+}
+
+static int32_t fin_mod_reg_const(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_val_t val, int32_t dst) {
+    int32_t idx = fin_mod_const_idx(ctx, cmp, val);
+    if (idx > 0xFFFF)
+        cmp->regs_overflow = true;
+    if (idx < FIN_REG_K)
+        return fin_mod_reg_move(ctx, cmp, dst, FIN_REG_K | idx);
+    if (dst < 0)
+        dst = fin_mod_reg_alloc(cmp, 1);
+    fin_mod_code_emit_uint8(ctx, &cmp->code, fin_reg_op_load_k);
+    fin_mod_code_emit_uint8(ctx, &cmp->code, dst);
+    fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
+    FIN_LOG("\tload_k     r%d, %d\n", dst, idx);
+    return dst;
+}
+
+static void fin_mod_reg_emit_bind(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_str_t* sign, int32_t base) {
+    int32_t idx = fin_mod_bind_idx(ctx, cmp, sign);
+    fin_mod_code_emit_uint8(ctx, &cmp->code, fin_reg_op_call);
+    fin_mod_code_emit_uint8(ctx, &cmp->code, base);
+    fin_mod_code_emit_uint16(ctx, &cmp->code, idx);
+    FIN_LOG("\tcall       r%d, %d      // %s\n", base, idx, fin_str_cstr(sign));
+}
+
+static int32_t fin_mod_compile_reg_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_expr_t* expr, int32_t dst);
+
+// Intrinsics read their operands wherever they live, calls get them copied
+// into consecutive temporaries which the callee sees as its args.
+static int32_t fin_mod_compile_reg_call(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_str_t* sign, fin_ast_expr_t** args, int32_t count, int32_t dst) {
+    int32_t mark = cmp->temps;
+    int32_t intrinsic = count <= 2 ? fin_mod_find_intrinsic(ctx, cmp, sign) : -1;
+    if (intrinsic >= 0) {
+        int32_t rk[2] = { 0, 0 };
+        for (int32_t i=0; i<count; i++)
+            rk[i] = fin_mod_compile_reg_expr(ctx, cmp, args[i], -1);
+        cmp->temps = mark;
+        if (dst < 0)
+            dst = fin_mod_reg_alloc(cmp, 1);
+        fin_reg_op_t op = fin_mod_intrinsics[intrinsic].reg_op;
+        fin_mod_reg_emit(ctx, cmp, op, dst, rk[0], rk[1], count + 1);
+        FIN_LOG("\t%-10s r%d, %c%d, %c%d\n", fin_mod_reg_op_names[op], dst, FIN_LOG_RK(rk[0]), FIN_LOG_RK(rk[1]));
+        return dst;
+    }
+    int32_t base = cmp->temps;
+    for (int32_t i=0; i<count; i++) {
+        fin_mod_compile_reg_expr(ctx, cmp, args[i], base + i);
+        cmp->temps = base + i;
+        fin_mod_reg_alloc(cmp, 1);
+    }
+    if (!count)
+        fin_mod_reg_alloc(cmp, 1);
+    fin_mod_reg_emit_bind(ctx, cmp, sign, base);
+    if (dst < 0) {
+        cmp->temps = base + 1;
+        return base;
+    }
+    cmp->temps = mark;
+    return fin_mod_reg_move(ctx, cmp, dst, base);
+}
+
+// Fills base and the registers after it with the slots of a struct
+// initializer, an arg for an inline field fills one per field of its object.
+static fin_mod_type_t* fin_mod_compile_reg_init_args(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_init_expr_t* expr, fin_str_t* type_name, int32_t base) {
+    fin_mod_type_t* type = fin_mod_find_type(ctx, cmp->mod, type_name);
+    assert(type);
+    int32_t mark = cmp->temps;
+    fin_mod_field_t* field = type->fields;
+    for (fin_ast_arg_expr_t* e = expr->args; e; e = e->next, field++) {
+        assert(field < type->fields + type->fields_count);
+        fin_str_t* arg_type = fin_mod_resolve_type(ctx, cmp, e->expr);
+        assert(arg_type == field->type);
+        fin_str_destroy(ctx, arg_type);
+        if (!field->is_inline) {
+            fin_mod_compile_reg_expr(ctx, cmp, e->expr, base + field->offset);
+            cmp->temps = mark;
+            continue;
+        }
+        int32_t obj = fin_mod_compile_reg_expr(ctx, cmp, e->expr, -1);
+        assert(!(obj & FIN_REG_K));
+        int32_t slots = fin_mod_find_type(ctx, cmp->mod, field->type)->layout.fields_count;
+        for (int32_t i=0; i<slots; i++) {
+            fin_mod_reg_emit(ctx, cmp, fin_reg_op_load_field, base + field->offset + i, obj, i, 3);
+            FIN_LOG("\tload_fld   r%d, r%d, %d\n", base + field->offset + i, obj, i);
+        }
+        cmp->temps = mark;
+    }
+    assert(field == type->fields + type->fields_count);
+    return type;
+}
+
+static int32_t fin_mod_compile_reg_init_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_init_expr_t* expr, fin_str_t* type_name, int32_t dst) {
+    fin_mod_type_t* type = fin_mod_find_type(ctx, cmp->mod, type_name);
+    assert(type);
+    int32_t base = fin_mod_reg_alloc(cmp, type->layout.fields_count);
+    fin_mod_compile_reg_init_args(ctx, cmp, expr, type_name, base);
+    cmp->temps = base;
+    if (dst < 0)
+        dst = fin_mod_reg_alloc(cmp, 1);
+    int32_t obj_type = fin_mod_obj_type_idx(ctx, cmp, type);
+    fin_mod_reg_emit(ctx, cmp, fin_reg_op_new, dst, base, 0, 2);
+    fin_mod_code_emit_uint16(ctx, &cmp->code, obj_type);
+    FIN_LOG("\tnew        r%d, r%d, %d  // %s\n", dst, base, obj_type, fin_str_cstr(type->name));
+    return dst;
+}
+
+// Reading an inline field whole copies its slots into a new object, obj is
+// the register holding path->obj.
+static int32_t fin_mod_compile_reg_path_copy(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_mod_path_t* path, int32_t obj, int32_t mark, int32_t dst) {
+    fin_mod_type_t* type = fin_mod_find_type(ctx, cmp->mod, path->field->type);
+    int32_t base = fin_mod_reg_alloc(cmp, type->layout.fields_count);
+    for (int32_t i=0; i<type->layout.fields_count; i++) {
+        int32_t slot = path->offset + i;
+        if (!path->obj) {
+            fin_mod_reg_move(ctx, cmp, base + i, cmp->params_count + path->scalar + slot);
+            continue;
+        }
+        fin_mod_reg_emit(ctx, cmp, fin_reg_op_load_field, base + i, obj, slot, 3);
+        FIN_LOG("\tload_fld   r%d, r%d, %d  // %s\n", base + i, obj, slot, fin_str_cstr(path->field->name));
+    }
+    cmp->temps = mark;
+    if (dst < 0)
+        dst = fin_mod_reg_alloc(cmp, 1);
+    int32_t obj_type = fin_mod_obj_type_idx(ctx, cmp, type);
+    fin_mod_reg_emit(ctx, cmp, fin_reg_op_new, dst, base, 0, 2);
+    fin_mod_code_emit_uint16(ctx, &cmp->code, obj_type);
+    FIN_LOG("\tnew        r%d, r%d, %d  // %s\n", dst, base, obj_type, fin_str_cstr(type->name));
+    return dst;
+}
+
+// Assigning an inline field copies the slots of the object in val.
+static void fin_mod_compile_reg_path_store(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_mod_path_t* path, int32_t obj, int32_t val) {
+    fin_mod_type_t* type = fin_mod_find_type(ctx, cmp->mod, path->field->type);
+    for (int32_t i=0; i<type->layout.fields_count; i++) {
+        int32_t slot = path->offset + i;
+        if (!path->obj) {
+            fin_mod_reg_emit(ctx, cmp, fin_reg_op_load_field, cmp->params_count + path->scalar + slot, val, i, 3);
+            FIN_LOG("\tload_fld   r%d, r%d, %d\n", cmp->params_count + path->scalar + slot, val, i);
+            continue;
+        }
+        int32_t tmp = fin_mod_reg_alloc(cmp, 1);
+        fin_mod_reg_emit(ctx, cmp, fin_reg_op_load_field, tmp, val, i, 3);
+        FIN_LOG("\tload_fld   r%d, r%d, %d\n", tmp, val, i);
+        fin_mod_reg_emit(ctx, cmp, fin_reg_op_store_field, obj, slot, tmp, 3);
+        FIN_LOG("\tstore_fld  r%d, %d, r%d  // %s\n", obj, slot, tmp, fin_str_cstr(path->field->name));
+        cmp->temps = tmp;
+    }
+}
+
+// Compiles expr to a register operand. With dst >= 0 the value ends up in that
+// register, otherwise the result may be a local, a constant or a temporary.
+// A dst equal to the first free temporary may be used as scratch before the
+// final write, which lets nested calls build their args in place.
+static int32_t fin_mod_compile_reg_expr(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_expr_t* expr, int32_t dst) {
+    switch (expr->type) {
+        case fin_ast_expr_type_id: {
+            fin_ast_id_expr_t* id_expr = (fin_ast_id_expr_t*)expr;
+            fin_mod_path_t path;
+            if (fin_mod_resolve_path(ctx, cmp, id_expr, &path)) {
+                if (!path.obj && !path.field->is_inline)
+                    return fin_mod_reg_move(ctx, cmp, dst, cmp->params_count + path.scalar + path.offset);
+                int32_t mark = cmp->temps;
+                int32_t obj = path.obj ? fin_mod_compile_reg_expr(ctx, cmp, path.obj, -1) : 0;
+                assert(!(obj & FIN_REG_K));
+                if (path.field->is_inline)
+                    return fin_mod_compile_reg_path_copy(ctx, cmp, &path, obj, mark, dst);
+                cmp->temps = mark;
+                if (dst < 0)
+                    dst = fin_mod_reg_alloc(cmp, 1);
+                fin_mod_reg_emit(ctx, cmp, fin_reg_op_load_field, dst, obj, path.offset, 3);
+                FIN_LOG("\tload_fld   r%d, r%d, %d  // %s\n", dst, obj, path.offset, fin_str_cstr(id_expr->name));
+                return dst;
+            }
+            fin_mod_local_t* local = fin_mod_resolve_local(cmp, id_expr->name);
+            assert(local);
+            return fin_mod_reg_move(ctx, cmp, dst, fin_mod_reg_local(cmp, local));
+        }
+        case fin_ast_expr_type_bool: {
+            fin_val_t val = { .b = ((fin_ast_bool_expr_t*)expr)->value };
+            return fin_mod_reg_const(ctx, cmp, val, dst);
+        }
+        case fin_ast_expr_type_int: {
+            fin_val_t val = { .i = ((fin_ast_int_expr_t*)expr)->value };
+            return fin_mod_reg_const(ctx, cmp, val, dst);
+        }
+        case fin_ast_expr_type_float: {
+            fin_val_t val = { .f = ((fin_ast_float_expr_t*)expr)->value };
+            return fin_mod_reg_const(ctx, cmp, val, dst);
+        }
+        case fin_ast_expr_type_str: {
+            fin_val_t val = { .s = ((fin_ast_str_expr_t*)expr)->value };
+            if (val.s)
+                val.s = fin_str_clone(val.s);
+            return fin_mod_reg_const(ctx, cmp, val, dst);
+        }
+        case fin_ast_expr_type_str_interp: {
+            fin_ast_str_interp_expr_t* interp_expr = (fin_ast_str_interp_expr_t*)expr;
+            int32_t mark = cmp->temps;
+            int32_t val;
+            fin_str_t* type = fin_mod_resolve_type(ctx, cmp, interp_expr->expr);
+            if (strcmp(fin_str_cstr(type), "string") != 0) {
+                char signature[256];
+                signature[0] = '\0';
+                strcat(signature, "string(");
+                strcat(signature, fin_str_cstr(type));
+                strcat(signature, ")");
+                fin_str_t* sign = fin_str_create(ctx, signature, -1);
+                val = fin_mod_compile_reg_call(ctx, cmp, sign, &interp_expr->expr, 1, -1);
+                fin_str_destroy(ctx, sign);
+            }
+            else
+                val = fin_mod_compile_reg_expr(ctx, cmp, interp_expr->expr, -1);
+            fin_str_destroy(ctx, type);
+            if (!interp_expr->next)
+                return fin_mod_reg_move(ctx, cmp, dst, val);
+            int32_t next = fin_mod_compile_reg_expr(ctx, cmp, &interp_expr->next->base, -1);
+            fin_str_t* sign = fin_str_create(ctx, "__op_add(string,string)", -1);
+            if (fin_mod_find_intrinsic(ctx, cmp, sign) >= 0) {
+                cmp->temps = mark;
+                if (dst < 0)
+                    dst = fin_mod_reg_alloc(cmp, 1);
+                fin_mod_reg_emit(ctx, cmp, fin_reg_op_add_s, dst, val, next, 3);
+                FIN_LOG("\tadd_s      r%d, %c%d, %c%d\n", dst, FIN_LOG_RK(val), FIN_LOG_RK(next));
+            }
+            else {
+                int32_t base = fin_mod_reg_alloc(cmp, 2);
+                fin_mod_reg_move(ctx, cmp, base, val);
+                fin_mod_reg_move(ctx, cmp, base + 1, next);
+                fin_mod_reg_emit_bind(ctx, cmp, sign, base);
+                cmp->temps = mark;
+                dst = dst < 0 ? fin_mod_reg_alloc(cmp, 1) : dst;
+                fin_mod_reg_move(ctx, cmp, dst, base);
+            }
+            fin_str_destroy(ctx, sign);
+            return dst;
+        }
+        case fin_ast_expr_type_unary: {
+            fin_ast_unary_expr_t* unary_expr = (fin_ast_unary_expr_t*)expr;
+            fin_str_t* sign = fin_mod_unary_get_signature(ctx, cmp, unary_expr);
+            dst = fin_mod_compile_reg_call(ctx, cmp, sign, &unary_expr->expr, 1, dst);
+            fin_str_destroy(ctx, sign);
+            return dst;
+        }
+        case fin_ast_expr_type_binary: {
+            fin_ast_binary_expr_t* bin_expr = (fin_ast_binary_expr_t*)expr;
+            fin_ast_expr_t* args[2] = { bin_expr->lhs, bin_expr->rhs };
+            fin_str_t* sign = fin_mod_binary_get_signature(ctx, cmp, bin_expr);
+            dst = fin_mod_compile_reg_call(ctx, cmp, sign, args, 2, dst);
+            fin_str_destroy(ctx, sign);
+            return dst;
+        }
+        case fin_ast_expr_type_cond: {
+            fin_ast_cond_expr_t* cond_expr = (fin_ast_cond_expr_t*)expr;
+            assert(cond_expr->false_expr);
+            int32_t mark = cmp->temps;
+            int32_t cond = fin_mod_compile_reg_expr(ctx, cmp, cond_expr->cond, -1);
+            cmp->temps = mark;
+            if (dst < 0)
+                dst = fin_mod_reg_alloc(cmp, 1);
+            fin_mod_reg_emit(ctx, cmp, fin_reg_op_branch_if_n, cond, 0, 0, 1);
+            int32_t lbl_else = (int32_t)(cmp->code.top - cmp->code.begin);
+            fin_mod_code_emit_uint16(ctx, &cmp->code, 0);
+            FIN_LOG("\tbr_if_n    %c%d, lbl_%d\n", FIN_LOG_RK(cond), lbl_else);
+            fin_mod_compile_reg_expr(ctx, cmp, cond_expr->true_expr, dst);
+            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_reg_op_branch);
+            int32_t lbl_end = (int32_t)(cmp->code.top - cmp->code.begin);
+            fin_mod_code_emit_uint16(ctx, &cmp->code, 0);
+            FIN_LOG("\tbr         lbl_%d\n", lbl_end);
+            FIN_LOG("lbl_%d:\n", lbl_else);
+            fin_mod_code_patch(cmp, lbl_else);
+            fin_mod_compile_reg_expr(ctx, cmp, cond_expr->false_expr, dst);
+            FIN_LOG("lbl_%d:\n", lbl_end);
+            fin_mod_code_patch(cmp, lbl_end);
+            return dst;
+        }
+        case fin_ast_expr_type_arg: {
+            fin_ast_arg_expr_t* arg_expr = (fin_ast_arg_expr_t*)expr;
+            return fin_mod_compile_reg_expr(ctx, cmp, arg_expr->expr, dst);
+        }
+        case fin_ast_expr_type_invoke: {
+            fin_ast_invoke_expr_t* invoke_expr = (fin_ast_invoke_expr_t*)expr;
+            fin_ast_expr_t* args[64];
+            int32_t count = 0;
+            for (fin_ast_arg_expr_t* e = invoke_expr->args; e; e = e->next) {
+                assert(count < FIN_COUNT_OF(args));
+                args[count++] = &e->base;
+            }
+            fin_str_t* sign = fin_mod_invoke_get_signature(ctx, cmp, invoke_expr);
+            dst = fin_mod_compile_reg_call(ctx, cmp, sign, args, count, dst);
+            fin_str_destroy(ctx, sign);
+            return dst;
+        }
+        case fin_ast_expr_type_assign: {
+            fin_ast_assign_expr_t* assign_expr = (fin_ast_assign_expr_t*)expr;
+            assert(assign_expr->op == fin_ast_assign_type_assign); // rest not supported yet
+            assert(assign_expr->lhs->type == fin_ast_expr_type_id);
+            fin_ast_id_expr_t* id_expr = (fin_ast_id_expr_t*)assign_expr->lhs;
+            fin_mod_path_t path;
+            if (fin_mod_resolve_path(ctx, cmp, id_expr, &path)) {
+                if (!path.obj && !path.field->is_inline) {
+                    int32_t reg = fin_mod_compile_reg_expr(ctx, cmp, assign_expr->rhs, cmp->params_count + path.scalar + path.offset);
+                    return fin_mod_reg_move(ctx, cmp, dst, reg);
+                }
+                int32_t obj = path.obj ? fin_mod_compile_reg_expr(ctx, cmp, path.obj, -1) : 0;
+                int32_t val = fin_mod_compile_reg_expr(ctx, cmp, assign_expr->rhs, -1);
+                assert(!(obj & FIN_REG_K));
+                if (path.field->is_inline)
+                    fin_mod_compile_reg_path_store(ctx, cmp, &path, obj, val);
+                else {
+                    fin_mod_reg_emit(ctx, cmp, fin_reg_op_store_field, obj, path.offset, val, 3);
+                    FIN_LOG("\tstore_fld  r%d, %d, %c%d  // %s\n", obj, path.offset, FIN_LOG_RK(val), fin_str_cstr(id_expr->name));
+                }
+                return fin_mod_reg_move(ctx, cmp, dst, val);
+            }
+            fin_mod_local_t* local = fin_mod_resolve_local(cmp, id_expr->name);
+            assert(local);
+            int32_t reg = fin_mod_compile_reg_expr(ctx, cmp, assign_expr->rhs, fin_mod_reg_local(cmp, local));
+            return fin_mod_reg_move(ctx, cmp, dst, reg);
+        }
+        default:
+            assert(0);
+            return dst;
+    }
+}
+
+static void fin_mod_compile_reg_cond_branch(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_reg_op_t op, fin_ast_expr_t* expr, int32_t target) {
+    int32_t cond = fin_mod_compile_reg_expr(ctx, cmp, expr, -1);
+    cmp->temps = cmp->locals_count;
+    fin_mod_reg_emit(ctx, cmp, op, cond, 0, 0, 1);
+    fin_mod_code_emit_offset(ctx, cmp, target);
+    FIN_LOG("\t%-10s %c%d, lbl_%d\n", op == fin_reg_op_branch_if ? "br_if" : "br_if_n", FIN_LOG_RK(cond), target);
+}
+
+static void fin_mod_compile_reg_stmt(fin_ctx_t* ctx, fin_mod_compiler_t* cmp, fin_ast_stmt_t* stmt) {
+    cmp->temps = cmp->locals_count;
+    switch (stmt->type) {
+        case fin_ast_stmt_type_expr: {
+            fin_ast_expr_stmt_t* expr_stmt = (fin_ast_expr_stmt_t*)stmt;
+            fin_mod_compile_reg_expr(ctx, cmp, expr_stmt->expr, -1);
+            break;
+        }
+        case fin_ast_stmt_type_ret: {
+            fin_ast_ret_stmt_t* ret_stmt = (fin_ast_ret_stmt_t*)stmt;
+            if (fin_mod_is_tail_call(ctx, cmp, ret_stmt->expr)) {
+                fin_mod_compile_reg_expr(ctx, cmp, ret_stmt->expr, -1);
+                cmp->code.top[-4] = fin_reg_op_tail_call;
+                FIN_LOG("\t// tail call\n");
+                break;
+            }
+            if (ret_stmt->expr) {
+                int32_t val;
+                if (ret_stmt->expr->type == fin_ast_expr_type_init)
+                    val = fin_mod_compile_reg_init_expr(ctx, cmp, (fin_ast_init_expr_t*)ret_stmt->expr, cmp->ret_type, -1);
+                else
+                    val = fin_mod_compile_reg_expr(ctx, cmp, ret_stmt->expr, -1);
+                fin_mod_reg_emit(ctx, cmp, fin_reg_op_return, val, 0, 0, 1);
+                FIN_LOG("\tret        %c%d\n", FIN_LOG_RK(val));
+            }
+            else {
+                fin_mod_reg_emit(ctx, cmp, fin_reg_op_return_v, 0, 0, 0, 0);
+                FIN_LOG("\tret_v\n");
+            }
+            break;
+        }
+        case fin_ast_stmt_type_if: {
+            fin_ast_if_stmt_t* if_stmt = (fin_ast_if_stmt_t*)stmt;
+            fin_mod_compile_reg_cond_branch(ctx, cmp, fin_reg_op_branch_if_n, if_stmt->cond, 0);
+            int32_t lbl_else = (int32_t)(cmp->code.top - cmp->code.begin) - 2;
+            fin_mod_scope_begin(cmp);
+            fin_mod_compile_reg_stmt(ctx, cmp, if_stmt->true_stmt);
+            fin_mod_scope_end(cmp);
+            if (if_stmt->false_stmt) {
+                fin_mod_code_emit_uint8(ctx, &cmp->code, fin_reg_op_branch);
+                int32_t lbl_end = (int32_t)(cmp->code.top - cmp->code.begin);
+                fin_mod_code_emit_uint16(ctx, &cmp->code, 0);
+                FIN_LOG("\tbr         lbl_%d\n", lbl_end);
+                FIN_LOG("lbl_%d:\n", lbl_else);
+                fin_mod_code_patch(cmp, lbl_else);
+                fin_mod_scope_begin(cmp);
+                fin_mod_compile_reg_stmt(ctx, cmp, if_stmt->false_stmt);
+                fin_mod_scope_end(cmp);
+                FIN_LOG("lbl_%d:\n", lbl_end);
+                fin_mod_code_patch(cmp, lbl_end);
+            }
+            else {
+                FIN_LOG("lbl_%d:\n", lbl_else);
+                fin_mod_code_patch(cmp, lbl_else);
+            }
+            break;
+        }
+        case fin_ast_stmt_type_for: {
+            fin_ast_for_stmt_t* for_stmt = (fin_ast_for_stmt_t*)stmt;
+            fin_mod_scope_begin(cmp);
+            fin_mod_compile_reg_expr(ctx, cmp, for_stmt->init, -1);
+            cmp->temps = cmp->locals_count;
+            int32_t lbl_loop = (int32_t)(cmp->code.top - cmp->code.begin);
+            FIN_LOG("lbl_%d:\n", lbl_loop);
+            fin_mod_compile_reg_cond_branch(ctx, cmp, fin_reg_op_branch_if_n, for_stmt->cond, 0);
+            int32_t lbl_end = (int32_t)(cmp->code.top - cmp->code.begin) - 2;
+            fin_mod_scope_begin(cmp);
+            fin_mod_compile_reg_stmt(ctx, cmp, for_stmt->stmt);
+            fin_mod_scope_end(cmp);
+            cmp->temps = cmp->locals_count;
+            fin_mod_compile_reg_expr(ctx, cmp, for_stmt->loop, -1);
+            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_reg_op_branch);
+            fin_mod_code_emit_offset(ctx, cmp, lbl_loop);
+            FIN_LOG("\tbr         lbl_%d\n", lbl_loop);
+            FIN_LOG("lbl_%d:\n", lbl_end);
+            fin_mod_code_patch(cmp, lbl_end);
+            fin_mod_scope_end(cmp);
+            break;
+        }
+        case fin_ast_stmt_type_while: {
+            fin_ast_while_stmt_t* while_stmt = (fin_ast_while_stmt_t*)stmt;
+            fin_mod_scope_begin(cmp);
+            int32_t lbl_loop = (int32_t)(cmp->code.top - cmp->code.begin);
+            FIN_LOG("lbl_%d:\n", lbl_loop);
+            fin_mod_compile_reg_cond_branch(ctx, cmp, fin_reg_op_branch_if_n, while_stmt->cond, 0);
+            int32_t lbl_end = (int32_t)(cmp->code.top - cmp->code.begin) - 2;
+            fin_mod_scope_begin(cmp);
+            fin_mod_compile_reg_stmt(ctx, cmp, while_stmt->stmt);
+            fin_mod_scope_end(cmp);
+            fin_mod_code_emit_uint8(ctx, &cmp->code, fin_reg_op_branch);
+            fin_mod_code_emit_offset(ctx, cmp, lbl_loop);
+            FIN_LOG("\tbr         lbl_%d\n", lbl_loop);
+            FIN_LOG("lbl_%d:\n", lbl_end);
+            fin_mod_code_patch(cmp, lbl_end);
+            fin_mod_scope_end(cmp);
+            break;
+        }
+        case fin_ast_stmt_type_do: {
+            fin_ast_do_stmt_t* do_stmt = (fin_ast_do_stmt_t*)stmt;
+            int32_t lbl_loop = (int32_t)(cmp->code.top - cmp->code.begin);
+            FIN_LOG("lbl_%d:\n", lbl_loop);
+            fin_mod_scope_begin(cmp);
+            fin_mod_compile_reg_stmt(ctx, cmp, do_stmt->stmt);
+            fin_mod_scope_end(cmp);
+            cmp->temps = cmp->locals_count;
+            fin_mod_compile_reg_cond_branch(ctx, cmp, fin_reg_op_branch_if, do_stmt->cond, lbl_loop);
+            break;
+        }
+        case fin_ast_stmt_type_decl: {
+            fin_ast_decl_stmt_t* decl_stmt = (fin_ast_decl_stmt_t*)stmt;
+            fin_mod_local_t* local = fin_mod_local_decl(ctx, cmp, decl_stmt);
+            int32_t reg = fin_mod_reg_local(cmp, local);
+            if (reg + (local->fields ? local->fields - 1 : 0) >= FIN_REG_COUNT)
+                cmp->regs_overflow = true;
+            cmp->temps = reg;
+            if (local->fields) {
+                cmp->temps = reg + local->fields;
+                fin_mod_compile_reg_init_args(ctx, cmp, (fin_ast_init_expr_t*)decl_stmt->init, decl_stmt->type->name, reg);
+            }
+            else if (decl_stmt->init) {
+                if (decl_stmt->init->type == fin_ast_expr_type_init)
+                    fin_mod_compile_reg_init_expr(ctx, cmp, (fin_ast_init_expr_t*)decl_stmt->init, decl_stmt->type->name, reg);
+                else
+                    fin_mod_compile_reg_expr(ctx, cmp, decl_stmt->init, reg);
+            }
+            break;
+        }
+        case fin_ast_stmt_type_block: {
+            fin_ast_block_stmt_t* block_stmt = (fin_ast_block_stmt_t*)stmt;
+            fin_mod_scope_begin(cmp);
+            for (fin_ast_stmt_t* s = block_stmt->stmts; s; s = s->next)
+                fin_mod_compile_reg_stmt(ctx, cmp, s);
+            fin_mod_scope_end(cmp);
+            break;
+        }
+    }
+    cmp->temps = cmp->locals_count;
+}
+
+// Replaces the opcode of every instruction that starts a known sequence with
+// its superinstruction. Only the first byte is rewritten, so the inner
+// instructions stay intact and remain valid branch targets.
+static void fin_mod_fuse(uint8_t* code, int32_t length) {
+#if !FIN_VM_TRAIN
+    int32_t pos = 0;
+    while (pos < length) {
+        int32_t next = pos + 1 + fin_mod_op_sizes[code[pos]];
+        if (code[pos] == fin_op_wide)
+            next = pos + 2 + 2 * fin_mod_op_sizes[code[pos + 1]];
+        for (int32_t i = 0; fin_mod_supers[i].count; i++) {
+            int32_t end = pos;
+            int32_t op = 0;
+            while (op < fin_mod_supers[i].count && end < length && code[end] == fin_mod_supers[i].ops[op]) {
+                end += 1 + fin_mod_op_sizes[code[end]];
+                op++;
+            }
+            if (op == fin_mod_supers[i].count) {
+                code[pos] = (uint8_t)fin_mod_supers[i].op;
+                next = end;
+                break;
+            }
+        }
+        pos = next;
+    }
+#endif
+}
+
+// Register code needs every frame slot to fit an rk operand and every branch
+// a 16-bit offset. Functions that don't are compiled to stack code instead;
+// both share the calling convention. Stack code whose branches don't fit is
+// compiled again with wide branches.
+static void fin_mod_compile_func(fin_mod_func_t* out_func, fin_ctx_t* ctx, fin_arena_t* arena, fin_mod_t* mod, fin_ast_func_t* func, bool is_reg, bool is_wide) {
     FIN_LOG("\n");
     FIN_LOG("func %s\n", fin_str_cstr(out_func->sign));
 
     fin_mod_compiler_t cmp;
+    cmp.arena = arena;
     cmp.mod = mod;
     cmp.func = func;
     cmp.locals_count = 0;
     cmp.locals_max = 0;
     cmp.params_count = 0;
     cmp.scopes_count = 0;
+    cmp.temps = 0;
+    cmp.temps_max = 0;
+    cmp.depth = 0;
+    cmp.depth_max = 0;
+    cmp.regs_overflow = false;
+    cmp.branch_overflow = false;
+    cmp.wide = is_wide;
+    cmp.locals_size = 16;
+    cmp.locals = (fin_mod_local_t*)fin_arena_alloc(arena, sizeof(fin_mod_local_t) * cmp.locals_size);
     cmp.ret_type = fin_str_clone(out_func->ret_type);
-    fin_mod_code_init(&cmp.code);
+    cmp.scalars = NULL;
+    cmp.scalars_count = 0;
+    fin_mod_code_init(&cmp.code, arena);
 
     for (fin_ast_param_t* param = func->params; param; param = param->next) {
-        fin_mod_local_t* l = &cmp.locals[cmp.locals_count++];
+        fin_mod_local_t* l = fin_mod_local_add(ctx, &cmp);
         l->name = param->name;
         l->type = param->type->name;
         l->idx = cmp.params_count++;
+        l->fields = 0;
         l->is_param = true;
+        fin_mod_scalar_mark(&cmp, param->name, true);
     }
-
-    fin_mod_compile_stmt(ctx, &cmp, &func->block->base);
-    if (cmp.code.top == cmp.code.begin || cmp.code.top[-1] != fin_op_return) {
-        fin_mod_code_emit_uint8(ctx, &cmp.code, fin_op_return);
-        FIN_LOG("\tret\n");
+    fin_mod_escape_stmt(ctx, &cmp, &func->block->base);
+
+    if (is_reg) {
+        fin_mod_compile_reg_stmt(ctx, &cmp, &func->block->base);
+        fin_mod_reg_emit(ctx, &cmp, fin_reg_op_return_v, 0, 0, 0, 0);
+        FIN_LOG("\tret_v\n");
+        if (cmp.regs_overflow || cmp.branch_overflow) {
+            fin_mod_compile_func(out_func, ctx, arena, mod, func, false, false);
+            return;
+        }
+    }
+    else {
+        fin_mod_compile_stmt(ctx, &cmp, &func->block->base);
+        if (cmp.code.top == cmp.code.begin || cmp.code.top[-1] != fin_op_return) {
+            fin_mod_code_emit_uint8(ctx, &cmp.code, fin_op_return);
+            FIN_LOG("\tret\n");
+        }
+        if (cmp.branch_overflow) {
+            fin_mod_compile_func(out_func, ctx, arena, mod, func, false, true);
+            return;
+        }
+        fin_mod_fuse(cmp.code.begin, (int32_t)(cmp.code.top - cmp.code.begin));
     }
 
+    out_func->is_reg = is_reg;
     out_func->code_length = (int32_t)(cmp.code.top - cmp.code.begin);
     out_func->code = (uint8_t*)ctx->alloc(NULL, out_func->code_length);
     memcpy(out_func->code, cmp.code.begin, out_func->code_length);
-    out_func->locals = cmp.locals_max - cmp.params_count;
-
-    fin_mod_code_reset(ctx, &cmp.code);
+    out_func->locals = (cmp.temps_max > cmp.locals_max ? cmp.temps_max : cmp.locals_max) - cmp.params_count;
+    out_func->stack = is_reg ? 0 : cmp.depth_max;
 
     FIN_LOG("\n");
 }
@@ -748,9 +1833,58 @@ static void fin_mod_compile_type(fin_ctx_t* ctx, fin_ast_type_t* type, fin_mod_t
     while (field) {
         f->name = fin_str_clone(field->name);
         f->type = fin_str_clone(field->type->name);
+        f->offset = 0;
+        f->is_inline = field->is_inline;
         field = field->next;
         f++;
     }
+    dest_type->layout.fields_count = -1;
+    dest_type->layout.refs_count = 0;
+    dest_type->layout.refs = NULL;
+}
+
+static void fin_mod_layout_ref(fin_ctx_t* ctx, fin_obj_type_t* layout, int32_t slot) {
+    layout->refs = (int32_t*)ctx->alloc(layout->refs, sizeof(int32_t) * (layout->refs_count + 1));
+    layout->refs[layout->refs_count++] = slot;
+}
+
+// The slots of type and which of them hold structs, found once every type of
+// mod is known. Inline fields lay out their type first, fields_count is -1
+// before and -2 during, which catches types that contain themselves.
+static void fin_mod_compile_layout(fin_ctx_t* ctx, fin_mod_t* mod, fin_mod_type_t* type) {
+    fin_obj_type_t* layout = &type->layout;
+    if (layout->fields_count >= 0)
+        return;
+    if (layout->fields_count == -2) {
+        printf("Struct %s contains itself inline\n", fin_str_cstr(type->name));
+        assert(layout->fields_count != -2);
+    }
+    layout->fields_count = -2;
+    int32_t slots = 0;
+    for (int32_t i=0; i<type->fields_count; i++) {
+        fin_mod_field_t* field = &type->fields[i];
+        fin_mod_type_t* field_type = fin_mod_find_type(ctx, mod, field->type);
+        field->offset = slots;
+        if (!field->is_inline) {
+            if (field_type)
+                fin_mod_layout_ref(ctx, layout, slots);
+            slots++;
+            continue;
+        }
+        if (!field_type) {
+            printf("Inline field %s is not a struct\n", fin_str_cstr(field->name));
+            assert(field_type);
+        }
+        fin_mod_compile_layout(ctx, mod, field_type);
+        for (int32_t r=0; r<field_type->layout.refs_count; r++)
+            fin_mod_layout_ref(ctx, layout, slots + field_type->layout.refs[r]);
+        slots += field_type->layout.fields_count;
+    }
+    if (slots > 0x100) {
+        printf("Struct %s has more than 256 slots\n", fin_str_cstr(type->name));
+        assert(slots <= 0x100);
+    }
+    layout->fields_count = slots;
 }
 
 static void fin_mod_register(fin_ctx_t* ctx, fin_mod_t* mod) {
@@ -775,6 +1909,8 @@ static void fin_mod_register(fin_ctx_t* ctx, fin_mod_t* mod) {
             assert(mod->binds[i].func);
         }
     }
+
+    fin_vm_link(ctx, mod);
 }
 
 fin_mod_t* fin_mod_create(fin_ctx_t* ctx, const char* name, fin_mod_func_desc_t* descs, int32_t descs_count) {
@@ -786,9 +1922,11 @@ fin_mod_t* fin_mod_create(fin_ctx_t* ctx, const char* name, fin_mod_func_desc_t*
     mod->funcs = funcs;
     mod->binds = NULL;
     mod->consts = NULL;
+    mod->obj_types = NULL;
     mod->types_count = 0;
     mod->funcs_count = descs_count;
     mod->binds_count = 0;
+    mod->obj_types_count = 0;
     mod->consts_count = 0;
     mod->next = NULL;
 
@@ -796,9 +1934,18 @@ fin_mod_t* fin_mod_create(fin_ctx_t* ctx, const char* name, fin_mod_func_desc_t*
         funcs[i].mod = mod;
         funcs[i].func = descs[i].func;
         funcs[i].is_native = true;
+        funcs[i].is_reg = false;
+        funcs[i].is_aot = false;
+        funcs[i].is_hot = false;
         funcs[i].code = NULL;
         funcs[i].code_length = 0;
+        funcs[i].cells = NULL;
+        funcs[i].jit = NULL;
         funcs[i].args = 0;
+        funcs[i].locals = 0;
+        funcs[i].stack = 0;
+        funcs[i].calls = 0;
+        funcs[i].loops = 0;
 
         // ret_type name "(" arg? ("," arg)* ")"
         fin_lex_t* lex = fin_lex_create(ctx->alloc, descs[i].sign);
@@ -840,18 +1987,23 @@ fin_mod_t* fin_mod_create(fin_ctx_t* ctx, const char* name, fin_mod_func_desc_t*
     return mod;
 }
 
+// The AST and the scratch data of the compilers are freed at once, with the
+// arena, when done.
 fin_mod_t* fin_mod_compile(fin_ctx_t* ctx, const char* cstr) {
-    fin_ast_module_t* module = fin_ast_parse(ctx, cstr);
+    fin_arena_t* arena = fin_arena_create(ctx);
+    fin_ast_module_t* module = fin_ast_parse(arena, cstr);
 
     fin_mod_t* mod = (fin_mod_t*)ctx->alloc(NULL, sizeof(fin_mod_t));
     mod->types = NULL;
     mod->funcs = NULL;
-    mod->consts = (fin_val_t*)ctx->alloc(NULL, sizeof(fin_val_t) * 128);
-    mod->binds = (fin_mod_func_bind_t*)ctx->alloc(NULL, sizeof(fin_mod_func_bind_t) * 128);
+    mod->consts = (fin_val_t*)ctx->alloc(NULL, sizeof(fin_val_t) * FIN_MOD_TABLE_SIZE);
+    mod->binds = (fin_mod_func_bind_t*)ctx->alloc(NULL, sizeof(fin_mod_func_bind_t) * FIN_MOD_TABLE_SIZE);
+    mod->obj_types = (const fin_obj_type_t**)ctx->alloc(NULL, sizeof(fin_obj_type_t*) * FIN_MOD_TABLE_SIZE);
     mod->types_count = 0;
     mod->funcs_count = 0;
     mod->consts_count = 0;
     mod->binds_count = 0;
+    mod->obj_types_count = 0;
 
     mod->next = NULL;
 
@@ -866,6 +2018,8 @@ fin_mod_t* fin_mod_compile(fin_ctx_t* ctx, const char* cstr) {
         int32_t idx = 0;
         for (fin_ast_type_t* type = module->types; type; type = type->next)
             fin_mod_compile_type(ctx, type, &mod->types[idx++]);
+        for (int32_t i=0; i<mod->types_count; i++)
+            fin_mod_compile_layout(ctx, mod, &mod->types[i]);
     }
 
     if (mod->funcs_count) {
@@ -894,18 +2048,25 @@ fin_mod_t* fin_mod_compile(fin_ctx_t* ctx, const char* cstr) {
             f->sign = fin_str_create(ctx, signature, -1);
             f->func = NULL;
             f->is_native = false;
+            f->is_reg = false;
+            f->is_aot = false;
+            f->is_hot = false;
             f->code = NULL;
             f->code_length = 0;
+            f->cells = NULL;
+            f->jit = NULL;
             f->args = args;
+            f->calls = 0;
+            f->loops = 0;
             f->ret_type = func->ret ? func->ret->name : NULL;
         }
 
         idx = 0;
         for (fin_ast_func_t* func = module->funcs; func; func = func->next)
-            fin_mod_compile_func(&mod->funcs[idx++], ctx, mod, func);
+            fin_mod_compile_func(&mod->funcs[idx++], ctx, arena, mod, func, ctx->vm_mode == fin_vm_mode_reg, false);
     }
 
-    fin_ast_destroy(module);
+    fin_arena_destroy(arena);
 
     mod->name = NULL;
     fin_str_t* entry_name = fin_str_create(ctx, "Main()", 6);
@@ -926,12 +2087,17 @@ void fin_mod_destroy(fin_ctx_t* ctx, fin_mod_t* mod) {
             fin_str_destroy(ctx, type->fields[j].type);
         }
         ctx->alloc(type->fields, 0);
+        if (type->layout.refs)
+            ctx->alloc(type->layout.refs, 0);
     }
     for (int32_t i=0; i<mod->funcs_count; i++) {
         fin_mod_func_t* func = &mod->funcs[i];
         if (func->ret_type)
             fin_str_destroy(ctx, func->ret_type);
         ctx->alloc(func->code, 0);
+        ctx->alloc(func->cells, 0);
+        if (!func->is_aot)
+            fin_jit_free(ctx, func);
         fin_str_destroy(ctx, func->sign);
     }
     if (mod->binds) {
@@ -943,6 +2109,8 @@ void fin_mod_destroy(fin_ctx_t* ctx, fin_mod_t* mod) {
     }
     if (mod->consts)
         ctx->alloc(mod->consts, 0);
+    if (mod->obj_types)
+        ctx->alloc(mod->obj_types, 0);
     if (mod->funcs)
         ctx->alloc(mod->funcs, 0);
     if (mod->types)
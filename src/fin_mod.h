@@ -13,17 +13,27 @@ typedef struct fin_ctx_t        fin_ctx_t;
 typedef struct fin_vm_t         fin_vm_t;
 typedef struct fin_mod_t        fin_mod_t;
 typedef struct fin_mod_type_t   fin_mod_type_t;
+typedef struct fin_obj_type_t   fin_obj_type_t;
+typedef union  fin_vm_cell_t    fin_vm_cell_t;
 
 typedef struct fin_mod_func_t {
-    fin_mod_t*  mod;
-    fin_str_t*  ret_type;
-    fin_str_t*  sign;
-    void        (*func)(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* res);
-    bool        is_native;
-    uint8_t*    code;
-    int32_t     code_length;
-    uint8_t     args;
-    uint8_t     locals;
+    fin_mod_t*     mod;
+    fin_str_t*     ret_type;
+    fin_str_t*     sign;
+    void           (*func)(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* res);
+    bool           is_native;
+    bool           is_reg;
+    bool           is_aot;
+    bool           is_hot;      // queued for the JIT of tiered mode
+    uint8_t*       code;
+    int32_t        code_length;
+    fin_vm_cell_t* cells;
+    void*          jit;         // fin_jit_func_t, jitted or translated ahead of time
+    uint8_t        args;
+    uint16_t       locals;
+    uint16_t       stack;       // max operand stack depth of stack code
+    uint32_t       calls;       // tiering counters of the interpreter
+    uint32_t       loops;
 } fin_mod_func_t;
 
 typedef struct fin_mod_func_desc_t {
@@ -42,10 +52,12 @@ typedef struct fin_mod_t {
     fin_mod_func_t*      funcs;
     fin_val_t*           consts;
     fin_mod_func_bind_t* binds;
+    const fin_obj_type_t** obj_types;   // layouts of the structs created by new
     int32_t              types_count;
     int32_t              funcs_count;
     int32_t              consts_count;
     int32_t              binds_count;
+    int32_t              obj_types_count;
     fin_mod_func_t*      entry;
     struct fin_mod_t*    next;
 } fin_mod_t;
@@ -8,13 +8,22 @@
 
 #include <fin/fin.h>
 
+typedef struct fin_vm_t fin_vm_t;
+
+// Layout of the objects of a struct type. refs lists the fields that hold
+// objects, the ones the collector follows.
+typedef struct fin_obj_type_t {
+    int32_t  fields_count;
+    int32_t  refs_count;
+    int32_t* refs;
+} fin_obj_type_t;
+
 typedef struct fin_obj_t {
-    int32_t   ref;
-    fin_val_t fields[0];
+    struct fin_obj_t*     next;     // in the heap of the vm that created it
+    const fin_obj_type_t* type;
+    fin_val_t             fields[0];
 } fin_obj_t;
 
-fin_obj_t* fin_obj_create(fin_alloc alloc, fin_val_t* fields, int32_t fields_count);
-void       fin_obj_inc_ref(fin_obj_t* obj);
-void       fin_obj_dec_ref(fin_alloc alloc, fin_obj_t* obj);
+fin_obj_t* fin_obj_create(fin_vm_t* vm, const fin_obj_type_t* type, const fin_val_t* fields);
 
 #endif //#ifndef FIN_OBJ_H
@@ -6,21 +6,172 @@
 #ifndef FIN_OP_H
 #define FIN_OP_H
 
+// Operators of the std module that compile to a dedicated opcode in both
+// instruction sets instead of a call.
+//   X(name, result field, expression over a [and b], std signature)
+#define FIN_OP_UNARY_LIST(X)                                          \
+    X(pos_i,  i, a.i,                        "__op_pos(int)")         \
+    X(neg_i,  i, -a.i,                       "__op_neg(int)")         \
+    X(not_i,  i, !a.i,                       "__op_not(int)")         \
+    X(bnot_i, i, ~a.i,                       "__op_bnot(int)")        \
+    X(inc_i,  i, a.i + 1,                    "__op_inc(int)")         \
+    X(dec_i,  i, a.i - 1,                    "__op_dec(int)")         \
+    X(neg_f,  f, -a.f,                       "__op_neg(float)")
+
+#define FIN_OP_BINARY_LIST(X)                                         \
+    X(and_b,  b, a.b && b.b,                 "__op_and(bool,bool)")   \
+    X(or_b,   b, a.b || b.b,                 "__op_or(bool,bool)")    \
+    X(add_i,  i, a.i + b.i,                  "__op_add(int,int)")     \
+    X(sub_i,  i, a.i - b.i,                  "__op_sub(int,int)")     \
+    X(mul_i,  i, a.i * b.i,                  "__op_mul(int,int)")     \
+    X(div_i,  i, a.i / b.i,                  "__op_div(int,int)")     \
+    X(mod_i,  i, a.i % b.i,                  "__op_mod(int,int)")     \
+    X(band_i, i, a.i & b.i,                  "__op_band(int,int)")    \
+    X(bor_i,  i, a.i | b.i,                  "__op_bor(int,int)")     \
+    X(bxor_i, i, a.i ^ b.i,                  "__op_bxor(int,int)")    \
+    X(shl_i,  i, a.i << b.i,                 "__op_shl(int,int)")     \
+    X(shr_i,  i, a.i >> b.i,                 "__op_shr(int,int)")     \
+    X(lt_i,   b, a.i < b.i,                  "__op_lt(int,int)")      \
+    X(leq_i,  b, a.i <= b.i,                 "__op_leq(int,int)")     \
+    X(gt_i,   b, a.i > b.i,                  "__op_gt(int,int)")      \
+    X(geq_i,  b, a.i >= b.i,                 "__op_geq(int,int)")     \
+    X(eq_i,   b, a.i == b.i,                 "__op_eq(int,int)")      \
+    X(neq_i,  b, a.i != b.i,                 "__op_neq(int,int)")     \
+    X(add_f,  f, a.f + b.f,                  "__op_add(float,float)") \
+    X(sub_f,  f, a.f - b.f,                  "__op_sub(float,float)") \
+    X(mul_f,  f, a.f * b.f,                  "__op_mul(float,float)") \
+    X(div_f,  f, a.f / b.f,                  "__op_div(float,float)") \
+    X(mod_f,  f, fmod(a.f, b.f),             "__op_mod(float,float)") \
+    X(lt_f,   b, a.f < b.f,                  "__op_lt(float,float)")  \
+    X(leq_f,  b, a.f <= b.f,                 "__op_leq(float,float)") \
+    X(gt_f,   b, a.f > b.f,                  "__op_gt(float,float)")  \
+    X(geq_f,  b, a.f >= b.f,                 "__op_geq(float,float)") \
+    X(eq_f,   b, a.f == b.f,                 "__op_eq(float,float)")  \
+    X(neq_f,  b, a.f != b.f,                 "__op_neq(float,float)") \
+    X(add_s,  s, fin_str_concat(ctx, a.s, b.s), "__op_add(string,string)") \
+    X(eq_s,   b, a.s == b.s,                 "__op_eq(string,string)") \
+    X(neq_s,  b, a.s != b.s,                 "__op_neq(string,string)")
+
+// Stack instruction set. The wide prefix doubles the operand bytes of the
+// load_const, load_local, store_local or branch that follows it. new names
+// the layout of its struct in the obj_types of the module.
+//   X(name, operand bytes)
+#define FIN_OP_LIST(X)  \
+    X(load_const,  2)   \
+    X(load_arg,    1)   \
+    X(store_arg,   1)   \
+    X(load_local,  1)   \
+    X(store_local, 1)   \
+    X(load_field,  1)   \
+    X(store_field, 1)   \
+    X(call,        2)   \
+    X(tail_call,   2)   \
+    X(branch,      2)   \
+    X(branch_if,   2)   \
+    X(branch_if_n, 2)   \
+    X(return,      0)   \
+    X(pop,         0)   \
+    X(new,         2)   \
+    X(wide,        0)
+
+// Register instruction set. Operands name frame slots directly: args first,
+// then locals, then temporaries. An operand with FIN_REG_K set names a
+// constant instead (the rk operands below).
+//   move        r, rk
+//   load_k      r, k16
+//   load_field  r, r, idx
+//   store_field r, idx, rk
+//   call        r, bind16       args in r.., result in r
+//   tail_call   r, bind16       args in r.., result in r0
+//   branch      off16
+//   branch_if   rk, off16
+//   branch_if_n rk, off16
+//   return      rk
+//   return_v
+//   new         r, r, type16     fields in r.., see the stack new
+//   <unary>     r, rk
+//   <binary>    r, rk, rk
+#define FIN_REG_OP_LIST(X) \
+    X(move)                \
+    X(load_k)              \
+    X(load_field)          \
+    X(store_field)         \
+    X(call)                \
+    X(tail_call)           \
+    X(branch)              \
+    X(branch_if)           \
+    X(branch_if_n)         \
+    X(return)              \
+    X(return_v)            \
+    X(new)
+
+#define FIN_REG_K     0x80
+#define FIN_REG_COUNT 0x80
+
+// Call specializations selected by fin_vm_link for threaded code, never
+// emitted by the compiler. fin_op_call_script covers script functions.
+//   X(name, args, returns value)
+#define FIN_OP_CALL_NATIVE_LIST(X)  \
+    X(call_native_0,   0, 1)        \
+    X(call_native_0_v, 0, 0)        \
+    X(call_native_1,   1, 1)        \
+    X(call_native_1_v, 1, 0)        \
+    X(call_native_2,   2, 1)        \
+    X(call_native_2_v, 2, 0)        \
+    X(call_native_3,   3, 1)        \
+    X(call_native_3_v, 3, 0)
+
+#include "fin_op_super.h"
+
+#define FIN_OP_ENUM(op, size)                 fin_op_##op,
+#define FIN_OP_ENUM_EXPR(op, res, expr, sign) fin_op_##op,
+#define FIN_OP_ENUM_SUPER2(a, b)              fin_op_##a##__##b,
+#define FIN_OP_ENUM_SUPER3(a, b, c)           fin_op_##a##__##b##__##c,
+#define FIN_OP_ENUM_SUPER4(a, b, c, d)        fin_op_##a##__##b##__##c##__##d,
+#define FIN_OP_ENUM_CALL(op, args, ret)       fin_op_##op,
+
 typedef enum fin_op_t {
-    fin_op_load_const,
-    fin_op_load_arg,
-    fin_op_store_arg,
-    fin_op_load_local,
-    fin_op_store_local,
-    fin_op_load_field,
-    fin_op_store_field,
-    fin_op_call,
-    fin_op_branch,
-    fin_op_branch_if,
-    fin_op_branch_if_n,
-    fin_op_return,
-    fin_op_pop,
-    fin_op_new,
+    FIN_OP_LIST(FIN_OP_ENUM)
+    FIN_OP_UNARY_LIST(FIN_OP_ENUM_EXPR)
+    FIN_OP_BINARY_LIST(FIN_OP_ENUM_EXPR)
+    FIN_OP_SUPER2_LIST(FIN_OP_ENUM_SUPER2)
+    FIN_OP_SUPER3_LIST(FIN_OP_ENUM_SUPER3)
+    FIN_OP_SUPER4_LIST(FIN_OP_ENUM_SUPER4)
+    FIN_OP_CALL_NATIVE_LIST(FIN_OP_ENUM_CALL)
+    fin_op_call_script,
+    fin_op_count
 } fin_op_t;
 
+#undef FIN_OP_ENUM
+#undef FIN_OP_ENUM_EXPR
+#undef FIN_OP_ENUM_SUPER2
+#undef FIN_OP_ENUM_SUPER3
+#undef FIN_OP_ENUM_SUPER4
+#undef FIN_OP_ENUM_CALL
+
+#define FIN_OP_SIZE(op, size)                 fin_op_size_##op = size,
+#define FIN_OP_SIZE_EXPR(op, res, expr, sign) fin_op_size_##op = 0,
+
+typedef enum fin_op_size_t {
+    FIN_OP_LIST(FIN_OP_SIZE)
+    FIN_OP_UNARY_LIST(FIN_OP_SIZE_EXPR)
+    FIN_OP_BINARY_LIST(FIN_OP_SIZE_EXPR)
+} fin_op_size_t;
+
+#undef FIN_OP_SIZE
+#undef FIN_OP_SIZE_EXPR
+
+#define FIN_REG_OP_ENUM(op)                     fin_reg_op_##op,
+#define FIN_REG_OP_ENUM_EXPR(op, res, expr, sign) fin_reg_op_##op,
+
+typedef enum fin_reg_op_t {
+    FIN_REG_OP_LIST(FIN_REG_OP_ENUM)
+    FIN_OP_UNARY_LIST(FIN_REG_OP_ENUM_EXPR)
+    FIN_OP_BINARY_LIST(FIN_REG_OP_ENUM_EXPR)
+    fin_reg_op_count
+} fin_reg_op_t;
+
+#undef FIN_REG_OP_ENUM
+#undef FIN_REG_OP_ENUM_EXPR
+
 #endif //#ifndef FIN_OP_H
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+// Generated by a FIN_VM_TRAIN build, see `make super`. Do not edit.
+
+#ifndef FIN_OP_SUPER_H
+#define FIN_OP_SUPER_H
+
+#define FIN_OP_SUPER2_LIST(X) \
+    X(load_local, load_const) /* 20000001 */ \
+    X(add_i, store_local) /* 20000000 */ \
+    X(load_const, lt_i) /* 17049156 */ \
+    X(lt_i, branch_if_n) /* 17049156 */ \
+    X(load_arg, load_const) /* 14098309 */ \
+    X(store_local, load_local) /* 10000001 */ \
+    X(load_const, add_i) /* 10000000 */ \
+    X(load_local, load_local) /* 10000000 */ \
+    X(load_local, add_i) /* 10000000 */ \
+    X(store_local, branch) /* 10000000 */ \
+    X(sub_i, call) /* 7049154 */ \
+
+#define FIN_OP_SUPER3_LIST(X) \
+    X(load_const, lt_i, branch_if_n) /* 17049156 */ \
+    X(load_local, load_const, lt_i) /* 10000001 */ \
+    X(store_local, load_local, load_const) /* 10000001 */ \
+    X(load_local, load_local, add_i) /* 10000000 */ \
+    X(add_i, store_local, branch) /* 10000000 */ \
+    X(load_local, add_i, store_local) /* 10000000 */ \
+    X(load_const, add_i, store_local) /* 10000000 */ \
+    X(add_i, store_local, load_local) /* 10000000 */ \
+    X(load_local, load_const, add_i) /* 10000000 */ \
+    X(load_arg, load_const, lt_i) /* 7049155 */ \
+    X(load_arg, load_const, sub_i) /* 7049154 */ \
+    X(load_const, sub_i, call) /* 7049154 */ \
+
+#define FIN_OP_SUPER4_LIST(X) \
+    X(load_local, load_const, lt_i, branch_if_n) /* 10000001 */ \
+    X(add_i, store_local, load_local, load_const) /* 10000000 */ \
+    X(load_local, add_i, store_local, load_local) /* 10000000 */ \
+    X(store_local, load_local, load_const, add_i) /* 10000000 */ \
+    X(load_local, load_const, add_i, store_local) /* 10000000 */ \
+    X(load_local, load_local, add_i, store_local) /* 10000000 */ \
+    X(load_const, add_i, store_local, branch) /* 10000000 */ \
+    X(load_arg, load_const, lt_i, branch_if_n) /* 7049155 */ \
+    X(load_arg, load_const, sub_i, call) /* 7049154 */ \
+
+#endif //#ifndef FIN_OP_SUPER_H
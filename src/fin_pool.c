@@ -0,0 +1,226 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#include "fin_pool.h"
+#include "fin_ctx.h"
+#include "fin_mod.h"
+#include "fin_vm.h"
+#include <assert.h>
+
+#if !defined(_MSC_VER)
+
+#include <pthread.h>
+
+#define FIN_POOL_ARGS 8
+
+typedef struct fin_pool_task_t {
+    fin_mod_func_t* func;
+    fin_val_t*      res;
+    fin_val_t       args[FIN_POOL_ARGS];
+} fin_pool_task_t;
+
+// Ring of tasks, the owner pops from the head and thieves from the tail.
+typedef struct fin_pool_deque_t {
+    pthread_mutex_t  lock;
+    fin_pool_task_t* tasks;
+    int32_t          capacity;
+    int32_t          head;
+    int32_t          count;
+} fin_pool_deque_t;
+
+typedef struct fin_pool_worker_t {
+    fin_pool_t*      pool;
+    pthread_t        thread;
+    fin_pool_deque_t deque;
+} fin_pool_worker_t;
+
+typedef struct fin_pool_t {
+    fin_ctx_t*         ctx;
+    fin_pool_worker_t* workers;
+    int32_t            workers_count;
+    uint32_t           next;        // worker of the next submission
+    int32_t            queued;      // tasks in the deques
+    int32_t            pending;     // tasks submitted and not finished
+    bool               stop;
+    pthread_mutex_t    lock;
+    pthread_cond_t     work;
+    pthread_cond_t     done;
+} fin_pool_t;
+
+static void fin_pool_push(fin_ctx_t* ctx, fin_pool_deque_t* deque, fin_pool_task_t* task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        int32_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+        fin_pool_task_t* tasks = (fin_pool_task_t*)ctx->alloc(NULL, sizeof(fin_pool_task_t) * capacity);
+        for (int32_t i=0; i<deque->count; i++)
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        if (deque->tasks)
+            ctx->alloc(deque->tasks, 0);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->head = 0;
+    }
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = *task;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static bool fin_pool_pop(fin_pool_deque_t* deque, fin_pool_task_t* task, bool steal) {
+    pthread_mutex_lock(&deque->lock);
+    bool result = deque->count > 0;
+    if (result) {
+        deque->count--;
+        if (steal)
+            *task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+        else {
+            *task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return result;
+}
+
+static bool fin_pool_take(fin_pool_worker_t* worker, fin_pool_task_t* task) {
+    fin_pool_t* pool = worker->pool;
+    if (fin_pool_pop(&worker->deque, task, false))
+        return true;
+    int32_t self = (int32_t)(worker - pool->workers);
+    for (int32_t i=1; i<pool->workers_count; i++) {
+        fin_pool_worker_t* victim = &pool->workers[(self + i) % pool->workers_count];
+        if (fin_pool_pop(&victim->deque, task, true))
+            return true;
+    }
+    return false;
+}
+
+static void* fin_pool_worker(void* arg) {
+    fin_pool_worker_t* worker = (fin_pool_worker_t*)arg;
+    fin_pool_t* pool = worker->pool;
+    fin_vm_t* vm = fin_vm_create(pool->ctx);
+    while (true) {
+        fin_pool_task_t task;
+        if (fin_pool_take(worker, &task)) {
+            __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_RELAXED);
+            fin_vm_call(vm, task.func, task.args, task.res);
+            if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->done);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (!__atomic_load_n(&pool->queued, __ATOMIC_RELAXED) && !pool->stop)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        bool stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+            break;
+    }
+    fin_vm_destroy(vm);
+    return NULL;
+}
+
+static void fin_pool_stop(fin_pool_t* pool, int32_t started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int32_t i=0; i<started; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    for (int32_t i=0; i<pool->workers_count; i++) {
+        fin_pool_deque_t* deque = &pool->workers[i].deque;
+        if (deque->tasks)
+            pool->ctx->alloc(deque->tasks, 0);
+        pthread_mutex_destroy(&deque->lock);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    pool->ctx->alloc(pool->workers, 0);
+    pool->ctx->alloc(pool, 0);
+}
+
+fin_pool_t* fin_pool_create(fin_ctx_t* ctx, int32_t workers) {
+    if (workers <= 0)
+        return NULL;
+    fin_pool_t* pool = (fin_pool_t*)ctx->alloc(NULL, sizeof(fin_pool_t));
+    pool->ctx = ctx;
+    pool->workers = (fin_pool_worker_t*)ctx->alloc(NULL, sizeof(fin_pool_worker_t) * workers);
+    pool->workers_count = workers;
+    pool->next = 0;
+    pool->queued = 0;
+    pool->pending = 0;
+    pool->stop = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int32_t i=0; i<workers; i++) {
+        fin_pool_worker_t* worker = &pool->workers[i];
+        worker->pool = pool;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->deque.tasks = NULL;
+        worker->deque.capacity = 0;
+        worker->deque.head = 0;
+        worker->deque.count = 0;
+    }
+    for (int32_t i=0; i<workers; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, &fin_pool_worker, &pool->workers[i]) != 0) {
+            fin_pool_stop(pool, i);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+// Finishes the submitted work before stopping the workers.
+void fin_pool_destroy(fin_pool_t* pool) {
+    fin_pool_wait(pool);
+    fin_pool_stop(pool, pool->workers_count);
+}
+
+// Queues an invocation of func, res is written by the time fin_pool_wait
+// returns. Thread safe.
+void fin_pool_submit(fin_pool_t* pool, fin_mod_func_t* func, const fin_val_t* args, fin_val_t* res) {
+    assert(func->args <= FIN_POOL_ARGS);
+    fin_pool_task_t task;
+    task.func = func;
+    task.res = res;
+    for (int32_t i=0; i<func->args; i++)
+        task.args[i] = args[i];
+    uint32_t idx = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+    fin_pool_push(pool->ctx, &pool->workers[idx % pool->workers_count].deque, &task);
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Blocks until every invocation submitted so far has finished.
+void fin_pool_wait(fin_pool_t* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+#else
+
+fin_pool_t* fin_pool_create(fin_ctx_t* ctx, int32_t workers) {
+    return NULL;
+}
+
+void fin_pool_destroy(fin_pool_t* pool) {
+}
+
+void fin_pool_submit(fin_pool_t* pool, fin_mod_func_t* func, const fin_val_t* args, fin_val_t* res) {
+}
+
+void fin_pool_wait(fin_pool_t* pool) {
+}
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#ifndef FIN_POOL_H
+#define FIN_POOL_H
+
+#include <fin/fin.h>
+
+// Worker threads, each running its own vm over the modules of one context.
+// Every worker has a deque of invocations; submissions are spread over the
+// workers round robin and an idle worker steals from the others. Modules are
+// only read while they run, so the context must not compile new ones while
+// the pool has work. Script objects passed as args must not be shared between
+// invocations.
+
+fin_pool_t* fin_pool_create(fin_ctx_t* ctx, int32_t workers);
+void        fin_pool_destroy(fin_pool_t* pool);
+void        fin_pool_submit(fin_pool_t* pool, fin_mod_func_t* func, const fin_val_t* args, fin_val_t* res);
+void        fin_pool_wait(fin_pool_t* pool);
+
+#endif //#ifndef FIN_POOL_H
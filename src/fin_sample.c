@@ -0,0 +1,164 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "fin_sample.h"
+#include "fin_ctx.h"
+#include "fin_mod.h"
+#include "fin_str.h"
+#include "fin_vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+    #define FIN_SAMPLE_ENABLED 1
+    #include <signal.h>
+    #include <sys/time.h>
+#else
+    #define FIN_SAMPLE_ENABLED 0
+#endif
+
+#if FIN_SAMPLE_ENABLED
+
+#define FIN_SAMPLE_MAX   16384
+#define FIN_SAMPLE_DEPTH 64
+
+typedef struct fin_sample_t {
+    int32_t         depth;
+    fin_mod_func_t* funcs[FIN_SAMPLE_DEPTH];    // innermost first
+} fin_sample_t;
+
+// The buffer is allocated by fin_sample_start, the handler only fills it.
+typedef struct fin_sample_state_t {
+    fin_ctx_t*            ctx;
+    fin_sample_t*         samples;
+    volatile sig_atomic_t count;
+    volatile sig_atomic_t dropped;              // buffer full
+    struct sigaction      prev;
+} fin_sample_state_t;
+
+static fin_sample_state_t fin_sample_state;
+
+// Samples taken on threads without a vm, or between script calls, are not
+// recorded.
+static void fin_sample_handler(int sig) {
+    (void)sig;
+    fin_vm_t* vm = fin_vm_current();
+    if (!vm)
+        return;
+    int32_t idx = fin_sample_state.count;
+    if (idx == FIN_SAMPLE_MAX) {
+        fin_sample_state.dropped++;
+        return;
+    }
+    fin_sample_t* sample = &fin_sample_state.samples[idx];
+    sample->depth = fin_vm_walk(vm, sample->funcs, FIN_SAMPLE_DEPTH);
+    if (sample->depth)
+        fin_sample_state.count = idx + 1;
+}
+
+bool fin_sample_start(fin_ctx_t* ctx, int32_t hz) {
+    if (fin_sample_state.ctx || hz <= 0 || hz > 1000000)
+        return false;
+
+    fin_sample_state.ctx = ctx;
+    fin_sample_state.samples = (fin_sample_t*)ctx->alloc(NULL, sizeof(fin_sample_t) * FIN_SAMPLE_MAX);
+    fin_sample_state.count = 0;
+    fin_sample_state.dropped = 0;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &fin_sample_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &fin_sample_state.prev);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+    return true;
+}
+
+static char* fin_sample_fold(fin_ctx_t* ctx, fin_sample_t* sample) {
+    int32_t len = 0;
+    for (int32_t i=0; i<sample->depth; i++)
+        len += fin_str_len(sample->funcs[i]->sign) + 1;
+    char* line = (char*)ctx->alloc(NULL, len);
+    char* pos = line;
+    for (int32_t i=sample->depth - 1; i>=0; i--) {
+        int32_t size = fin_str_len(sample->funcs[i]->sign);
+        memcpy(pos, fin_str_cstr(sample->funcs[i]->sign), size);
+        pos += size;
+        *pos++ = i ? ';' : '\0';
+    }
+    return line;
+}
+
+static int fin_sample_compare(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Writes the samples taken since fin_sample_start to path, root first.
+// Identical stacks share a line. A NULL path discards the samples.
+bool fin_sample_stop(fin_ctx_t* ctx, const char* path) {
+    if (fin_sample_state.ctx != ctx)
+        return false;
+
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &fin_sample_state.prev, NULL);
+
+    bool result = true;
+    int32_t count = fin_sample_state.count;
+    FILE* fp = path ? fopen(path, "w") : NULL;
+    if (path && !fp)
+        result = false;
+    if (fp && count) {
+        char** lines = (char**)ctx->alloc(NULL, sizeof(char*) * count);
+        for (int32_t i=0; i<count; i++)
+            lines[i] = fin_sample_fold(ctx, &fin_sample_state.samples[i]);
+        qsort(lines, count, sizeof(char*), &fin_sample_compare);
+        for (int32_t i=0, n=1; i<count; i++, n++) {
+            if (i + 1 < count && strcmp(lines[i], lines[i + 1]) == 0)
+                continue;
+            fprintf(fp, "%s %d\n", lines[i], n);
+            n = 0;
+        }
+        for (int32_t i=0; i<count; i++)
+            ctx->alloc(lines[i], 0);
+        ctx->alloc(lines, 0);
+    }
+    if (fp && fin_sample_state.dropped)
+        fprintf(stderr, "Sampler buffer full, %d samples dropped\n", (int32_t)fin_sample_state.dropped);
+    if (fp)
+        result = fclose(fp) == 0;
+
+    ctx->alloc(fin_sample_state.samples, 0);
+    fin_sample_state.samples = NULL;
+    fin_sample_state.ctx = NULL;
+    return result;
+}
+
+#else
+
+bool fin_sample_start(fin_ctx_t* ctx, int32_t hz) {
+    (void)ctx;
+    (void)hz;
+    return false;
+}
+
+bool fin_sample_stop(fin_ctx_t* ctx, const char* path) {
+    (void)ctx;
+    (void)path;
+    return false;
+}
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#ifndef FIN_SAMPLE_H
+#define FIN_SAMPLE_H
+
+#include <fin/fin.h>
+
+// Statistical profiler of script code. A SIGPROF timer interrupts the process
+// and records the script functions on the call stack of the vm running on the
+// interrupted thread. The samples are written as folded stacks, one line per
+// distinct stack: "Main();Fib(int);Fib(int) 42". Linux only.
+
+bool fin_sample_start(fin_ctx_t* ctx, int32_t hz);
+bool fin_sample_stop(fin_ctx_t* ctx, const char* path);
+
+#endif //#ifndef FIN_SAMPLE_H
@@ -7,9 +7,43 @@
 #include "fin_ctx.h"
 #include <string.h>
 
+#if defined(_MSC_VER)
+    #include <windows.h>
+    typedef SRWLOCK fin_str_lock_t;
+    #define FIN_STR_LOCK_INIT(l)    InitializeSRWLock(l)
+    #define FIN_STR_LOCK_FREE(l)
+    #define FIN_STR_LOCK(l)         AcquireSRWLockExclusive(l)
+    #define FIN_STR_UNLOCK(l)       ReleaseSRWLockExclusive(l)
+    #define FIN_STR_REF_INC(r)      _InterlockedIncrement((volatile long*)(r))
+    #define FIN_STR_REF_DEC(r)      _InterlockedDecrement((volatile long*)(r))
+    #define FIN_STR_REF_CAS(r, e, d) (_InterlockedCompareExchange((volatile long*)(r), (d), *(e)) == *(e) ? 1 : (*(e) = *(r), 0))
+    #define FIN_STR_REF_LOAD(r)     (*(volatile int32_t*)(r))
+#else
+    #include <pthread.h>
+    typedef pthread_mutex_t fin_str_lock_t;
+    #define FIN_STR_LOCK_INIT(l)    pthread_mutex_init(l, NULL)
+    #define FIN_STR_LOCK_FREE(l)    pthread_mutex_destroy(l)
+    #define FIN_STR_LOCK(l)         pthread_mutex_lock(l)
+    #define FIN_STR_UNLOCK(l)       pthread_mutex_unlock(l)
+    #define FIN_STR_REF_INC(r)      __atomic_add_fetch(r, 1, __ATOMIC_RELAXED)
+    #define FIN_STR_REF_DEC(r)      __atomic_sub_fetch(r, 1, __ATOMIC_ACQ_REL)
+    #define FIN_STR_REF_CAS(r, e, d) __atomic_compare_exchange_n(r, e, d, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+    #define FIN_STR_REF_LOAD(r)     __atomic_load_n(r, __ATOMIC_RELAXED)
+#endif
+
+// Strings are interned in one of FIN_STR_SHARDS tables, picked by the top bits
+// of their hash, each behind its own lock. A string leaves its table only when
+// its last reference is released under the lock of the table, so a lookup
+// never revives a string that is being freed. The alloc of the pool has to be
+// thread safe for contexts shared between threads.
+#define FIN_STR_SHARDS_LOG2 4
+#define FIN_STR_SHARDS      (1 << FIN_STR_SHARDS_LOG2)
+#define FIN_STR_SHARD(hash) ((uint32_t)(hash) >> (32 - FIN_STR_SHARDS_LOG2))
+
 typedef struct fin_str_t {
     int32_t ref;
     int32_t len;
+    int32_t hash;
     int32_t slot;
     char    cstr[1];
 } fin_str_t;
@@ -19,11 +53,16 @@ typedef struct fin_str_entry_t {
     fin_str_t* str;
 } fin_str_entry_t;
 
-typedef struct fin_str_pool_t {
+typedef struct fin_str_shard_t {
+    fin_str_lock_t   lock;
     fin_str_entry_t* entries;
     int32_t          capacity;
     int32_t          count;
-    fin_alloc        alloc;
+} fin_str_shard_t;
+
+typedef struct fin_str_pool_t {
+    fin_str_shard_t shards[FIN_STR_SHARDS];
+    fin_alloc       alloc;
 } fin_str_pool_t;
 
 static int32_t fin_str_hash(const char* cstr, int32_t* len) {
@@ -40,51 +79,59 @@ static int32_t fin_str_hash(const char* cstr, int32_t* len) {
     return hash;
 }
 
-static void fin_str_insert(fin_str_pool_t* pool, int32_t hash, fin_str_t* str) {
-    int32_t slot = (uint32_t)hash % pool->capacity;
+static void fin_str_insert(fin_str_shard_t* shard, int32_t hash, fin_str_t* str) {
+    int32_t slot = (uint32_t)hash % shard->capacity;
     int32_t end_slot = slot;
     do {
-        fin_str_entry_t* entry = &pool->entries[slot];
+        fin_str_entry_t* entry = &shard->entries[slot];
         if (entry->hash == 0 || entry->str == NULL) {
             entry->hash = hash;
             entry->str = str;
             str->slot = slot;
-            pool->count++;
+            shard->count++;
             break;
         }
-        slot = (slot + 1) % pool->capacity;
+        slot = (slot + 1) % shard->capacity;
     } while (slot != end_slot);
 }
 
-void fin_str_resize(fin_str_pool_t* pool, int32_t capacity) {
-    fin_str_pool_t new_pool;
-    new_pool.entries = (fin_str_entry_t*)pool->alloc(NULL, sizeof(fin_str_entry_t) * capacity);
-    new_pool.capacity = capacity;
-    new_pool.count = 0;
-    new_pool.alloc = pool->alloc;
+static void fin_str_resize(fin_alloc alloc, fin_str_shard_t* shard, int32_t capacity) {
+    fin_str_entry_t* entries = shard->entries;
+    int32_t old_capacity = shard->capacity;
+    shard->entries = (fin_str_entry_t*)alloc(NULL, sizeof(fin_str_entry_t) * capacity);
+    shard->capacity = capacity;
+    shard->count = 0;
     for (int32_t i=0; i<capacity; i++) {
-        new_pool.entries[i].hash = 0;
-        new_pool.entries[i].str = NULL;
+        shard->entries[i].hash = 0;
+        shard->entries[i].str = NULL;
     }
-    for (int32_t i=0; i<pool->capacity; i++)
-        if (pool->entries[i].str != 0)
-            fin_str_insert(&new_pool, pool->entries[i].hash, pool->entries[i].str);
-    pool->alloc(pool->entries, 0);
-    *pool = new_pool;
+    for (int32_t i=0; i<old_capacity; i++)
+        if (entries[i].str != 0)
+            fin_str_insert(shard, entries[i].hash, entries[i].str);
+    if (entries)
+        alloc(entries, 0);
 }
 
 fin_str_pool_t* fin_str_pool_create(fin_alloc alloc) {
     fin_str_pool_t* pool = (fin_str_pool_t*)alloc(NULL, sizeof(fin_str_pool_t));
-    pool->entries = NULL;
-    pool->capacity = 0;
-    pool->count = 0;
+    for (int32_t i=0; i<FIN_STR_SHARDS; i++) {
+        fin_str_shard_t* shard = &pool->shards[i];
+        FIN_STR_LOCK_INIT(&shard->lock);
+        shard->entries = NULL;
+        shard->capacity = 0;
+        shard->count = 0;
+    }
     pool->alloc = alloc;
     return pool;
 }
 
 void fin_str_pool_destroy(fin_str_pool_t* pool) {
-    if (pool->entries)
-        pool->alloc(pool->entries, 0);
+    for (int32_t i=0; i<FIN_STR_SHARDS; i++) {
+        fin_str_shard_t* shard = &pool->shards[i];
+        if (shard->entries)
+            pool->alloc(shard->entries, 0);
+        FIN_STR_LOCK_FREE(&shard->lock);
+    }
     pool->alloc(pool, 0);
 }
 
@@ -94,46 +141,61 @@ fin_str_t* fin_str_create(fin_ctx_t* ctx, const char* cstr, int32_t len) {
         return NULL;
 
     int32_t hash = fin_str_hash(cstr, &len);
-    if (pool->capacity) {
-        int32_t slot = (uint32_t)hash % pool->capacity;
+    fin_str_shard_t* shard = &pool->shards[FIN_STR_SHARD(hash)];
+    FIN_STR_LOCK(&shard->lock);
+    if (shard->capacity) {
+        int32_t slot = (uint32_t)hash % shard->capacity;
         int32_t end_slot = slot;
         do {
-            fin_str_entry_t* entry = &pool->entries[slot];
+            fin_str_entry_t* entry = &shard->entries[slot];
             if (entry->hash == 0 && entry->str == NULL)
                 break;
-            if (entry->hash == hash && entry->str->len == len) {
+            if (entry->hash == hash && entry->str && entry->str->len == len) {
                 if (strncmp(entry->str->cstr, cstr, len) == 0) {
-                    entry->str->ref++;
-                    return entry->str;
+                    fin_str_t* str = entry->str;
+                    FIN_STR_REF_INC(&str->ref);
+                    FIN_STR_UNLOCK(&shard->lock);
+                    return str;
                 }
             }
-            slot = (slot + 1) % pool->capacity;
+            slot = (slot + 1) % shard->capacity;
         } while (slot != end_slot);
     }
-    if (pool->capacity == 0)
-        fin_str_resize(pool, 16);
-    else if (pool->count + 1 > pool->capacity * 3 / 4)
-        fin_str_resize(pool, pool->capacity * 2);
+    if (shard->capacity == 0)
+        fin_str_resize(pool->alloc, shard, 16);
+    else if (shard->count + 1 > shard->capacity * 3 / 4)
+        fin_str_resize(pool->alloc, shard, shard->capacity * 2);
     fin_str_t* str = (fin_str_t*)pool->alloc(NULL, sizeof(fin_str_t) + len);
     str->ref = 1;
     str->len = len;
+    str->hash = hash;
     strncpy(str->cstr, cstr, len);
     str->cstr[len] = '\0';
-    fin_str_insert(pool, hash, str);
+    fin_str_insert(shard, hash, str);
+    FIN_STR_UNLOCK(&shard->lock);
     return str;
 }
 
+// Releases without the lock while other references remain.
 void fin_str_destroy(fin_ctx_t* ctx, fin_str_t* str) {
+    int32_t ref = FIN_STR_REF_LOAD(&str->ref);
+    while (ref > 1) {
+        if (FIN_STR_REF_CAS(&str->ref, &ref, ref - 1))
+            return;
+    }
     fin_str_pool_t* pool = ctx->pool;
-    if (--str->ref == 0) {
-        pool->entries[str->slot].str = NULL;
-        pool->entries[str->slot].hash = 1;
+    fin_str_shard_t* shard = &pool->shards[FIN_STR_SHARD(str->hash)];
+    FIN_STR_LOCK(&shard->lock);
+    if (FIN_STR_REF_DEC(&str->ref) == 0) {
+        shard->entries[str->slot].str = NULL;
+        shard->entries[str->slot].hash = 1;
         pool->alloc(str, 0);
     }
+    FIN_STR_UNLOCK(&shard->lock);
 }
 
 fin_str_t* fin_str_clone(fin_str_t* str) {
-    str->ref++;
+    FIN_STR_REF_INC(&str->ref);
     return str;
 }
 
@@ -4,174 +4,1412 @@
  */
 
 #include "fin_vm.h"
+#include "fin_aot.h"
 #include "fin_ctx.h"
+#include "fin_gc.h"
+#include "fin_jit.h"
 #include "fin_obj.h"
 #include "fin_op.h"
 #include "fin_mod.h"
 #include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <string.h>
+
+#if FIN_VM_TRAIN || FIN_VM_PROFILE
+    #include <stdlib.h>
+#endif
+
+#if FIN_VM_PROFILE_CYCLES && (defined(__x86_64__) || defined(__i386__))
+    #include <x86intrin.h>
+#else
+    #undef  FIN_VM_PROFILE_CYCLES
+    #define FIN_VM_PROFILE_CYCLES 0
+#endif
+
+// Computed goto builds execute stack code as direct-threaded cells, see
+// fin_vm_link. Training builds count bytecode sequences and stay on bytecode.
+#if FIN_CONFIG_COMPUTED_GOTO && !FIN_VM_TRAIN
+    #define FIN_VM_THREADED 1
+#else
+    #define FIN_VM_THREADED 0
+#endif
 
 #if FIN_CONFIG_COMPUTED_GOTO
-    #define FIN_VM_NEXT()       goto *goto_table[*ip++]
-    #define FIN_VM_LOOP_BEGIN() static void* goto_table[] = { \
-                                    &&fin_op_load_const,      \
-                                    &&fin_op_load_arg,        \
-                                    &&fin_op_store_arg,       \
-                                    &&fin_op_load_local,      \
-                                    &&fin_op_store_local,     \
-                                    &&fin_op_load_field,      \
-                                    &&fin_op_store_field,     \
-                                    &&fin_op_call,            \
-                                    &&fin_op_branch,          \
-                                    &&fin_op_branch_if,       \
-                                    &&fin_op_branch_if_n,     \
-                                    &&fin_op_return,          \
-                                    &&fin_op_pop,             \
-                                    &&fin_op_new              \
-                                };                            \
-                                FIN_VM_NEXT();
+    #define FIN_VM_NEXT()             FIN_VM_HOOK(); FIN_VM_DISPATCH()
+    #define FIN_VM_DISPATCH()         goto *goto_table[*ip++]
+    #define FIN_VM_TABLE(...)         static void* goto_table[] = { __VA_ARGS__ };
+    #define FIN_VM_LOOP_BEGIN(labels) FIN_VM_TABLE(labels)          \
+                                      FIN_VM_NEXT();
     #define FIN_VM_LOOP_END()
-    #define FIN_VM_OP(op)       op:
+    #define FIN_VM_OP(op)             op: FIN_VM_OP_HOOK(op);
+    #define FIN_VM_SUPER_OP(op)       FIN_VM_OP(op)
 #else
-    #define FIN_VM_NEXT()       break
-    #define FIN_VM_LOOP_BEGIN() while (true) {                \
-                                   fin_op op = *ip++;         \
-                                   switch (op)
-    #define FIN_VM_LOOP_END()   }
-    #define FIN_VM_OP(op)       case op:
+    #define FIN_VM_NEXT()             break
+    #define FIN_VM_LOOP_BEGIN(labels) while (true) {                \
+                                          FIN_VM_HOOK();            \
+                                          switch (*ip++)
+    #define FIN_VM_LOOP_END()         }
+    #define FIN_VM_OP(op)             case op: op: FIN_VM_LABEL_UNUSED FIN_VM_OP_HOOK(op);
+    #define FIN_VM_SUPER_OP(op)       case op: FIN_VM_OP_HOOK(op);
 #endif
 
+// Switch dispatch only jumps to labels at the end of a superinstruction, the
+// labels of other handlers stay unused.
+#if defined(__GNUC__) || defined(__clang__)
+    #define FIN_VM_LABEL_UNUSED __attribute__((unused));
+#else
+    #define FIN_VM_LABEL_UNUSED
+#endif
+
+// Per instruction and per handler hooks, redefined around the interpreter
+// loops that need them.
+#define FIN_VM_HOOK()
+#define FIN_VM_OP_HOOK(op)
+
+#define FIN_VM_LABEL(op, size)                   &&fin_op_##op,
+#define FIN_VM_LABEL_EXPR(op, res, expr, sign)   &&fin_op_##op,
+#define FIN_VM_LABEL_SUPER2(a, b)                &&fin_op_##a##__##b,
+#define FIN_VM_LABEL_SUPER3(a, b, c)             &&fin_op_##a##__##b##__##c,
+#define FIN_VM_LABEL_SUPER4(a, b, c, d)          &&fin_op_##a##__##b##__##c##__##d,
+#define FIN_VM_LABEL_CALL(op, args, ret)         &&fin_op_##op,
+#define FIN_VM_LABELS                            FIN_OP_LIST(FIN_VM_LABEL)               \
+                                                 FIN_OP_UNARY_LIST(FIN_VM_LABEL_EXPR)    \
+                                                 FIN_OP_BINARY_LIST(FIN_VM_LABEL_EXPR)   \
+                                                 FIN_OP_SUPER2_LIST(FIN_VM_LABEL_SUPER2) \
+                                                 FIN_OP_SUPER3_LIST(FIN_VM_LABEL_SUPER3) \
+                                                 FIN_OP_SUPER4_LIST(FIN_VM_LABEL_SUPER4) \
+                                                 FIN_VM_LABELS_LINK
+
+#define FIN_VM_REG_LABEL(op)                     &&fin_reg_op_##op,
+#define FIN_VM_REG_LABEL_EXPR(op, res, expr, sign) &&fin_reg_op_##op,
+#define FIN_VM_REG_LABELS                        FIN_REG_OP_LIST(FIN_VM_REG_LABEL)         \
+                                                 FIN_OP_UNARY_LIST(FIN_VM_REG_LABEL_EXPR)  \
+                                                 FIN_OP_BINARY_LIST(FIN_VM_REG_LABEL_EXPR)
+
+// Straight-line stack instructions are implemented as fin_vm_exec_<op>
+// functions, so that a superinstruction can inline the bodies of all but
+// its last instruction, skip the opcode byte that follows each of them and
+// jump to the handler of the last one.
+#define FIN_VM_EXEC_ARGS fin_vm_t* vm, fin_mod_t* mod, fin_val_t* args, fin_val_t* stack, fin_val_t* top, fin_vm_ip_t ip
+#define FIN_VM_EXEC(op)  top = fin_vm_exec_##op(vm, mod, args, stack, top, ip); \
+                         ip += FIN_VM_OPERANDS(op)
+#define FIN_VM_STEP(op)  FIN_VM_OP(fin_op_##op) { \
+                             FIN_VM_EXEC(op);     \
+                             FIN_VM_NEXT();       \
+                         }
+
+#define FIN_VM_UNARY(op, res, expr, sign)  static inline fin_val_t* fin_vm_exec_##op(FIN_VM_EXEC_ARGS) { \
+                                               fin_val_t a = top[-1];                                \
+                                               top[-1].res = expr;                                   \
+                                               return top;                                           \
+                                           }
+// Only the string operators need the context of the vm.
+#define FIN_VM_BINARY(op, res, expr, sign) static inline fin_val_t* fin_vm_exec_##op(FIN_VM_EXEC_ARGS) { \
+                                               fin_ctx_t* ctx = vm->ctx; (void)ctx;                  \
+                                               fin_val_t b = *--top;                                 \
+                                               fin_val_t a = top[-1];                                \
+                                               top[-1].res = expr;                                   \
+                                               return top;                                           \
+                                           }
+#define FIN_VM_STEP_EXPR(op, res, expr, sign) FIN_VM_STEP(op)
+
+#define FIN_VM_SUPER2(a, b)       FIN_VM_SUPER_OP(fin_op_##a##__##b) {               \
+                                      FIN_VM_EXEC(a);                                \
+                                      FIN_VM_TAIL(b);                                \
+                                  }
+#define FIN_VM_SUPER3(a, b, c)    FIN_VM_SUPER_OP(fin_op_##a##__##b##__##c) {        \
+                                      FIN_VM_EXEC(a); ip++;                          \
+                                      FIN_VM_EXEC(b);                                \
+                                      FIN_VM_TAIL(c);                                \
+                                  }
+#define FIN_VM_SUPER4(a, b, c, d) FIN_VM_SUPER_OP(fin_op_##a##__##b##__##c##__##d) { \
+                                      FIN_VM_EXEC(a); ip++;                          \
+                                      FIN_VM_EXEC(b); ip++;                          \
+                                      FIN_VM_EXEC(c);                                \
+                                      FIN_VM_TAIL(d);                                \
+                                  }
+
+#define FIN_VM_CALL_NATIVE(op, args, ret) FIN_VM_OP(fin_op_##op) {                         \
+                                              fin_val_t result;                            \
+                                              ip->native(vm->ctx, top - args, &result);    \
+                                              if (ret)                                     \
+                                                  top[-args] = result;                     \
+                                              top += ret - args;                           \
+                                              ip++;                                        \
+                                              FIN_VM_SUSPEND(ret ? top - 1 : NULL, false); \
+                                              FIN_VM_NEXT();                               \
+                                          }
+
+#define FIN_VM_RK(x) ((x) & FIN_REG_K ? consts[(x) & ~FIN_REG_K] : regs[x])
+
+#define FIN_VM_REG_UNARY(op, res, expr, sign)  FIN_VM_OP(fin_reg_op_##op) {    \
+                                                   fin_val_t a = FIN_VM_RK(ip[1]); \
+                                                   regs[ip[0]].res = expr;         \
+                                                   ip += 2;                        \
+                                                   FIN_VM_NEXT();                  \
+                                               }
+#define FIN_VM_REG_BINARY(op, res, expr, sign) FIN_VM_OP(fin_reg_op_##op) {    \
+                                                   fin_val_t a = FIN_VM_RK(ip[1]); \
+                                                   fin_val_t b = FIN_VM_RK(ip[2]); \
+                                                   regs[ip[0]].res = expr;         \
+                                                   ip += 3;                        \
+                                                   FIN_VM_NEXT();                  \
+                                               }
+
+// A threaded instruction is a handler cell followed by its operand cells,
+// decoded at link time. Branches hold the cell to continue from. Calls are
+// specialized by the kind and arity of the resolved function.
+typedef struct fin_vm_sig_t {
+    uint8_t  args;
+    uint8_t  ret;
+    uint16_t locals;
+    uint32_t size;
+} fin_vm_sig_t;
+
+typedef union fin_vm_cell_t {
+    void*                 handler;
+    const fin_val_t*      k;
+    fin_mod_func_t*       func;
+    const fin_obj_type_t* type;
+    union fin_vm_cell_t*  target;
+    union fin_vm_cell_t*  code;
+    fin_vm_sig_t          sig;
+    intptr_t              n;
+    void                  (*native)(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* res);
+} fin_vm_cell_t;
+
+// Continues a superinstruction with its last instruction. Threaded code
+// dispatches a call through its own cell, which fin_vm_link may have
+// specialized, and jumps straight to the handler of anything else.
+#if FIN_VM_THREADED
+    typedef const fin_vm_cell_t* fin_vm_ip_t;
+    #define FIN_VM_LABELS_LINK  FIN_OP_CALL_NATIVE_LIST(FIN_VM_LABEL_CALL) &&fin_op_call_script,
+    #define FIN_VM_TAIL(op)     if (fin_op_##op == fin_op_call)  \
+                                    goto *(ip++)->handler;       \
+                                else {                           \
+                                    ip++;                        \
+                                    goto fin_op_##op;            \
+                                }
+    #define FIN_VM_OPERANDS(op) (fin_op_size_##op ? 1 : 0)
+    #define FIN_VM_CODE(func)   (func)->cells
+    #define FIN_VM_U8(ip)       (ip)->n
+    #define FIN_VM_TYPE(ip)     (ip)->type
+    #define FIN_VM_CONST(ip)    (ip)->k
+    #define FIN_VM_FUNC(ip)     (ip)->func
+    #define FIN_VM_JUMP(ip)     (ip) = (ip)->target
+    #define FIN_VM_BACK(ip)     ((ip)->target < (ip))
+#else
+    typedef const uint8_t* fin_vm_ip_t;
+    #define FIN_VM_LABELS_LINK
+    #define FIN_VM_TAIL(op)     ip++;                            \
+                                goto fin_op_##op
+    #define FIN_VM_OPERANDS(op) fin_op_size_##op
+    #define FIN_VM_CODE(func)   (func)->code
+    #define FIN_VM_U8(ip)       (ip)[0]
+    #define FIN_VM_TYPE(ip)     mod->obj_types[(ip)[0] | (ip)[1] << 8]
+    #define FIN_VM_CONST(ip)    &mod->consts[(ip)[0] | (ip)[1] << 8]
+    #define FIN_VM_FUNC(ip)     mod->binds[(ip)[0] | (ip)[1] << 8].func
+    #define FIN_VM_JUMP(ip)     (ip) += 2 + (int16_t)((ip)[0] | (ip)[1] << 8)
+    #define FIN_VM_BACK(ip)     ((int16_t)((ip)[0] | (ip)[1] << 8) < 0)
+#endif
+
+// JIT builds count the calls and loop back edges of interpreted functions,
+// fin_jit_tier_up hands the hot ones to the background compiler of tiered
+// mode. Calls switch to the machine code once it is published. The counters
+// are shared by the vms of a fin_pool_t, an update lost to a race only delays
+// the tier up.
+#if FIN_JIT
+    #define FIN_VM_TIER_CALLS        1000
+    #define FIN_VM_TIER_LOOPS        10000
+    #define FIN_VM_MACHINE(func)     __atomic_load_n(&(func)->jit, __ATOMIC_ACQUIRE)
+    #define FIN_VM_JITTED(func)      (FIN_VM_MACHINE(func) != NULL && !vm->fiber)
+    #define FIN_VM_COUNT(func, n, k) if (fin_vm_count(&(func)->n) == (k)) fin_jit_tier_up(vm->ctx, func)
+    #define FIN_VM_LOOP(ip)          if (FIN_VM_BACK(ip)) FIN_VM_COUNT(func, loops, FIN_VM_TIER_LOOPS)
+
+    static inline uint32_t fin_vm_count(uint32_t* counter) {
+        uint32_t count = __atomic_load_n(counter, __ATOMIC_RELAXED) + 1;
+        __atomic_store_n(counter, count, __ATOMIC_RELAXED);
+        return count;
+    }
+#else
+    #define FIN_VM_MACHINE(func)     (func)->jit
+    #define FIN_VM_JITTED(func)      false
+    #define FIN_VM_COUNT(func, n, k)
+    #define FIN_VM_LOOP(ip)
+#endif
+
+#define FIN_VM_SEG_SIZE 1024
+
+// The value stack is a chain of segments. A call whose frame does not fit in
+// the current segment runs at the start of the next one, so values never move
+// and the pointers held by the callers stay valid.
+typedef struct fin_vm_seg_t {
+    struct fin_vm_seg_t* next;
+    fin_val_t*           end;
+    fin_val_t            storage[];
+} fin_vm_seg_t;
+
 typedef struct fin_vm_stack_t {
-    fin_val_t* top;
-    fin_val_t* begin;
-    fin_val_t* end;
-    fin_val_t  storage[64];
+    fin_val_t*    end;
+    fin_vm_seg_t* seg;
+    fin_vm_seg_t* first;
 } fin_vm_stack_t;
 
+// Caller state saved by a script call, restored by its return.
+typedef struct fin_vm_frame_t {
+    fin_vm_ip_t     ip;
+    fin_val_t*      args;
+    fin_val_t*      stack;
+    fin_val_t*      top;
+    fin_mod_t*      mod;
+    fin_mod_func_t* func;
+} fin_vm_frame_t;
+
+// Interpreter state of a suspended fiber. res is the result slot of the native
+// that suspended it, NULL for void natives and preemption.
+typedef struct fin_vm_resume_t {
+    fin_vm_ip_t     ip;
+    fin_val_t*      stack;
+    fin_val_t*      top;
+    fin_val_t*      res;
+    fin_mod_func_t* func;
+    bool            returning;  // suspended by a native in tail position
+} fin_vm_resume_t;
+
+#if FIN_VM_PROFILE
+// Handlers run by one vm, stack instructions first, then register ones.
+#define FIN_VM_PROFILE_OPS (fin_op_count + fin_reg_op_count)
+
+typedef struct fin_vm_profile_t {
+    uint64_t counts[FIN_VM_PROFILE_OPS];
+    uint64_t cycles[FIN_VM_PROFILE_OPS];
+    uint64_t stamp;
+    int32_t  last;
+} fin_vm_profile_t;
+#endif
+
 typedef struct fin_vm_t {
-    fin_vm_stack_t stack;
-    fin_ctx_t*     ctx;
+    fin_vm_stack_t  stack;
+    fin_vm_frame_t* frames;
+    fin_vm_frame_t* frames_end;
+    fin_vm_frame_t* frame;
+    fin_mod_func_t* func;       // running in the innermost frame, for samplers
+    fin_gc_heap_t*  heap;
+    const int32_t*  gc_stop;    // set while a collection waits, see fin_gc_stopping
+    fin_vm_resume_t resume;
+    int32_t         nested;     // runs of script code on the C stack
+    int32_t         slice;      // back edges and calls a fiber runs per resume
+    int32_t         ticks;      // left of the slice, 0 when unlimited
+    bool            fiber;      // may suspend, see fin_vm_yield
+    bool            yield;
+    bool            suspended;
+    bool            moving;     // frames being grown, not walked by samplers
+    fin_ctx_t*      ctx;
+#if FIN_VM_PROFILE
+    fin_vm_profile_t profile;
+#endif
 } fin_vm_t;
 
-void fin_vm_invoke_int(fin_ctx_t* ctx, fin_mod_func_t* func, fin_val_t* stack);
+#if FIN_VM_THREADED
+static void** fin_vm_handlers = NULL;
+#endif
 
-void fin_vm_interpret(fin_ctx_t* ctx, fin_mod_func_t* func, fin_val_t* stack) {
-    fin_mod_t* mod  = func->mod;
-    fin_val_t* args = stack - func->args;
-    fin_val_t* top  = stack + func->locals;
-    uint8_t* ip   = func->code;
+#if defined(_MSC_VER)
+    #define FIN_VM_TLS __declspec(thread)
+#else
+    #define FIN_VM_TLS __thread
+#endif
 
-    FIN_VM_LOOP_BEGIN() {
-        FIN_VM_OP(fin_op_load_const) {
-            int32_t idx = *ip++;
-            idx |= *ip++ << 8;
-            *top++ = mod->consts[idx];
+// The vm running on this thread, for fin_vm_yield and samplers.
+static FIN_VM_TLS fin_vm_t* fin_vm_running = NULL;
+
+#define FIN_VM_SIZE(op, size)                 size,
+#define FIN_VM_SIZE_EXPR(op, res, expr, sign) 0,
+#define FIN_VM_BASE(op, size)                 fin_op_##op,
+#define FIN_VM_BASE_EXPR(op, res, expr, sign) fin_op_##op,
+#define FIN_VM_BASE_SUPER2(a, b)              fin_op_##a,
+#define FIN_VM_BASE_SUPER3(a, b, c)           fin_op_##a,
+#define FIN_VM_BASE_SUPER4(a, b, c, d)        fin_op_##a,
+
+static const uint8_t fin_vm_op_sizes[fin_op_count] = {
+    FIN_OP_LIST(FIN_VM_SIZE)
+    FIN_OP_UNARY_LIST(FIN_VM_SIZE_EXPR)
+    FIN_OP_BINARY_LIST(FIN_VM_SIZE_EXPR)
+};
+
+#if FIN_VM_THREADED
+// The instruction whose operands follow the opcode. A superinstruction
+// keeps the operands of its first instruction.
+static const uint8_t fin_vm_op_base[fin_op_count] = {
+    FIN_OP_LIST(FIN_VM_BASE)
+    FIN_OP_UNARY_LIST(FIN_VM_BASE_EXPR)
+    FIN_OP_BINARY_LIST(FIN_VM_BASE_EXPR)
+    FIN_OP_SUPER2_LIST(FIN_VM_BASE_SUPER2)
+    FIN_OP_SUPER3_LIST(FIN_VM_BASE_SUPER3)
+    FIN_OP_SUPER4_LIST(FIN_VM_BASE_SUPER4)
+};
+#endif
+
+void fin_vm_invoke_int(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* stack);
+void fin_vm_invoke_seg(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* stack);
+
+// Doubles the frames of vm once calls nest deeper than them. Nested loops of
+// the interpreter refer to their frames by depth, so the frames may move.
+static void fin_vm_grow_frames(fin_vm_t* vm) {
+    int32_t depth = (int32_t)(vm->frame - vm->frames);
+    int32_t count = (int32_t)(vm->frames_end - vm->frames);
+    fin_vm_frame_t* frames = (fin_vm_frame_t*)vm->ctx->alloc(NULL, sizeof(fin_vm_frame_t) * count * 2);
+    memcpy(frames, vm->frames, sizeof(fin_vm_frame_t) * count);
+    memset(frames + count, 0, sizeof(fin_vm_frame_t) * count);
+    vm->moving = true;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    vm->ctx->alloc(vm->frames, 0);
+    vm->frames     = frames;
+    vm->frames_end = frames + count * 2;
+    vm->frame      = frames + depth;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    vm->moving = false;
+}
+
+static inline fin_val_t* fin_vm_exec_load_const(FIN_VM_EXEC_ARGS) {
+    *top++ = *FIN_VM_CONST(ip);
+    return top;
+}
+
+static inline fin_val_t* fin_vm_exec_load_arg(FIN_VM_EXEC_ARGS) {
+    *top++ = args[FIN_VM_U8(ip)];
+    return top;
+}
+
+static inline fin_val_t* fin_vm_exec_store_arg(FIN_VM_EXEC_ARGS) {
+    args[FIN_VM_U8(ip)] = *--top;
+    return top;
+}
+
+static inline fin_val_t* fin_vm_exec_load_local(FIN_VM_EXEC_ARGS) {
+    *top++ = stack[FIN_VM_U8(ip)];
+    return top;
+}
+
+static inline fin_val_t* fin_vm_exec_store_local(FIN_VM_EXEC_ARGS) {
+    stack[FIN_VM_U8(ip)] = *--top;
+    return top;
+}
+
+static inline fin_val_t* fin_vm_exec_load_field(FIN_VM_EXEC_ARGS) {
+    if (top[-1].o)
+        top[-1] = top[-1].o->fields[FIN_VM_U8(ip)];
+    return top;
+}
+
+static inline fin_val_t* fin_vm_exec_store_field(FIN_VM_EXEC_ARGS) {
+    if (top[-2].o)
+        top[-2].o->fields[FIN_VM_U8(ip)] = top[-1];
+    return top - 2;
+}
+
+static inline fin_val_t* fin_vm_exec_call(FIN_VM_EXEC_ARGS) {
+    fin_mod_func_t* func = FIN_VM_FUNC(ip);
+    fin_vm_invoke_int(vm, func, top);
+    return top - func->args + (func->ret_type ? 1 : 0);
+}
+
+static inline fin_val_t* fin_vm_exec_pop(FIN_VM_EXEC_ARGS) {
+    return top - 1;
+}
+
+static inline fin_val_t* fin_vm_exec_new(FIN_VM_EXEC_ARGS) {
+    const fin_obj_type_t* type = FIN_VM_TYPE(ip);
+    top -= type->fields_count;
+    top->o = fin_obj_create(vm, type, top);
+    return top + 1;
+}
+
+FIN_OP_UNARY_LIST(FIN_VM_UNARY)
+FIN_OP_BINARY_LIST(FIN_VM_BINARY)
+
+#if FIN_VM_TRAIN || FIN_VM_PROFILE
+
+#define FIN_VM_NAME(op, size)                 #op,
+#define FIN_VM_NAME_EXPR(op, res, expr, sign) #op,
+#define FIN_VM_NAME_SUPER2(a, b)              #a "__" #b,
+#define FIN_VM_NAME_SUPER3(a, b, c)           #a "__" #b "__" #c,
+#define FIN_VM_NAME_SUPER4(a, b, c, d)        #a "__" #b "__" #c "__" #d,
+#define FIN_VM_NAME_CALL(op, args, ret)       #op,
+
+static const char* fin_vm_op_names[fin_op_count] = {
+    FIN_OP_LIST(FIN_VM_NAME)
+    FIN_OP_UNARY_LIST(FIN_VM_NAME_EXPR)
+    FIN_OP_BINARY_LIST(FIN_VM_NAME_EXPR)
+    FIN_OP_SUPER2_LIST(FIN_VM_NAME_SUPER2)
+    FIN_OP_SUPER3_LIST(FIN_VM_NAME_SUPER3)
+    FIN_OP_SUPER4_LIST(FIN_VM_NAME_SUPER4)
+    FIN_OP_CALL_NATIVE_LIST(FIN_VM_NAME_CALL)
+    "call_script",
+};
+
+#endif //#if FIN_VM_TRAIN || FIN_VM_PROFILE
+
+#if FIN_VM_PROFILE
+
+// Profile builds count the handlers run by fin_vm_interpret per fin_op_t, and
+// by fin_vm_interpret_reg per fin_reg_op_t. A superinstruction counts once for
+// itself and once more for the handler of its last instruction. With
+// FIN_VM_PROFILE_CYCLES the time stamp counter between two handlers of a vm is
+// charged to the first one, callees of calls included.
+//
+// Every vm counts on its own, and adds its counts to the totals of the
+// process when destroyed or when it reports from its own thread.
+
+#define FIN_VM_NAME_REG(op)                       "reg_" #op,
+#define FIN_VM_NAME_REG_EXPR(op, res, expr, sign) "reg_" #op,
+
+static const char* fin_vm_reg_op_names[fin_reg_op_count] = {
+    FIN_REG_OP_LIST(FIN_VM_NAME_REG)
+    FIN_OP_UNARY_LIST(FIN_VM_NAME_REG_EXPR)
+    FIN_OP_BINARY_LIST(FIN_VM_NAME_REG_EXPR)
+};
+
+static uint64_t fin_vm_profile_counts[FIN_VM_PROFILE_OPS];
+static uint64_t fin_vm_profile_cycles[FIN_VM_PROFILE_OPS];
+static FIN_VM_TLS uint64_t* fin_vm_profile_scores;  // read by fin_vm_profile_compare
+
+static inline void fin_vm_profile_record(fin_vm_profile_t* profile, int32_t op) {
+    profile->counts[op]++;
+#if FIN_VM_PROFILE_CYCLES
+    uint64_t stamp = __rdtsc();
+    if (profile->last >= 0)
+        profile->cycles[profile->last] += stamp - profile->stamp;
+    profile->stamp = stamp;
+    profile->last = op;
+#endif
+}
+
+static void fin_vm_profile_merge(fin_vm_profile_t* profile) {
+    for (int32_t op=0; op<FIN_VM_PROFILE_OPS; op++) {
+        if (profile->counts[op])
+            __atomic_fetch_add(&fin_vm_profile_counts[op], profile->counts[op], __ATOMIC_RELAXED);
+        if (profile->cycles[op])
+            __atomic_fetch_add(&fin_vm_profile_cycles[op], profile->cycles[op], __ATOMIC_RELAXED);
+    }
+    memset(profile, 0, sizeof(fin_vm_profile_t));
+    profile->last = -1;
+}
+
+static int fin_vm_profile_compare(const void* a, const void* b) {
+    uint64_t score_a = fin_vm_profile_scores[*(const int32_t*)a];
+    uint64_t score_b = fin_vm_profile_scores[*(const int32_t*)b];
+    return score_a < score_b ? 1 : score_a > score_b ? -1 : 0;
+}
+
+#endif //#if FIN_VM_PROFILE
+
+#if FIN_VM_TRAIN
+
+// Training builds count every sequence of 2 to 4 instructions executed by
+// falling through from one to the next. Only the last instruction of a
+// sequence may transfer control or call. fin_vm_destroy writes the best scoring
+// sequences as the superinstruction lists of fin_op_super.h.
+
+#define FIN_VM_TRAIN_SLOTS  4096
+#define FIN_VM_TRAIN_SUPERS 32
+
+typedef struct fin_vm_train_seq_t {
+    uint8_t  ops[4];
+    int32_t  count;
+    uint64_t hits;
+} fin_vm_train_seq_t;
+
+static struct {
+    const uint8_t*     next;
+    uint8_t            window[4];
+    int32_t            window_count;
+    fin_vm_train_seq_t seqs[FIN_VM_TRAIN_SLOTS];
+} fin_vm_train;
+
+static void fin_vm_train_count(const uint8_t* ops, int32_t count) {
+    uint32_t hash = 2166136261u;
+    for (int32_t i = 0; i < count; i++)
+        hash = (hash ^ ops[i]) * 16777619u;
+    for (int32_t i = 0; i < FIN_VM_TRAIN_SLOTS; i++) {
+        fin_vm_train_seq_t* seq = &fin_vm_train.seqs[(hash + i) % FIN_VM_TRAIN_SLOTS];
+        if (seq->count == 0) {
+            memcpy(seq->ops, ops, count);
+            seq->count = count;
+        }
+        if (seq->count == count && memcmp(seq->ops, ops, count) == 0) {
+            seq->hits++;
+            return;
+        }
+    }
+}
+
+static void fin_vm_train_record(const uint8_t* ip) {
+    uint8_t op = *ip;
+    if (op == fin_op_wide) {
+        fin_vm_train.window_count = 0;
+        return;
+    }
+    if (ip != fin_vm_train.next)
+        fin_vm_train.window_count = 0;
+    fin_vm_train.next = ip + 1 + fin_vm_op_sizes[op];
+
+    uint8_t* window = fin_vm_train.window;
+    if (fin_vm_train.window_count == 4)
+        memmove(window, window + 1, 3);
+    else
+        fin_vm_train.window_count++;
+    window[fin_vm_train.window_count - 1] = op;
+
+    for (int32_t count = 2; count <= fin_vm_train.window_count; count++)
+        fin_vm_train_count(window + fin_vm_train.window_count - count, count);
+
+    // Calls end sequences as well, fin_vm_link rewrites their cells.
+    if (op == fin_op_branch || op == fin_op_branch_if || op == fin_op_branch_if_n || op == fin_op_return || op == fin_op_call || op == fin_op_tail_call)
+        fin_vm_train.window_count = 0;
+}
+
+static uint64_t fin_vm_train_score(const fin_vm_train_seq_t* seq) {
+    return seq->hits * (seq->count - 1);
+}
+
+static int fin_vm_train_compare(const void* a, const void* b) {
+    uint64_t score_a = fin_vm_train_score((const fin_vm_train_seq_t*)a);
+    uint64_t score_b = fin_vm_train_score((const fin_vm_train_seq_t*)b);
+    return score_a < score_b ? 1 : score_a > score_b ? -1 : 0;
+}
+
+static void fin_vm_train_dump() {
+    const char* path = getenv("FIN_TRAIN_OUT");
+    FILE* fp = fopen(path ? path : "fin_op_super.h", "w");
+    if (!fp)
+        return;
+
+    static fin_vm_train_seq_t seqs[FIN_VM_TRAIN_SLOTS];
+    memcpy(seqs, fin_vm_train.seqs, sizeof(seqs));
+    qsort(seqs, FIN_VM_TRAIN_SLOTS, sizeof(fin_vm_train_seq_t), &fin_vm_train_compare);
+
+    fprintf(fp, "/*\n");
+    fprintf(fp, " * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.\n");
+    fprintf(fp, " * License: https://github.com/naleksiev/fin/blob/master/LICENSE\n");
+    fprintf(fp, " */\n\n");
+    fprintf(fp, "// Generated by a FIN_VM_TRAIN build, see `make super`. Do not edit.\n\n");
+    fprintf(fp, "#ifndef FIN_OP_SUPER_H\n");
+    fprintf(fp, "#define FIN_OP_SUPER_H\n\n");
+    for (int32_t count = 2; count <= 4; count++) {
+        fprintf(fp, "#define FIN_OP_SUPER%d_LIST(X) \\\n", count);
+        for (int32_t i = 0; i < FIN_VM_TRAIN_SUPERS && seqs[i].hits; i++) {
+            if (seqs[i].count != count)
+                continue;
+            fprintf(fp, "    X(");
+            for (int32_t op = 0; op < count; op++)
+                fprintf(fp, "%s%s", op ? ", " : "", fin_vm_op_names[seqs[i].ops[op]]);
+            fprintf(fp, ") /* %llu */ \\\n", (unsigned long long)seqs[i].hits);
+        }
+        fprintf(fp, "\n");
+    }
+    fprintf(fp, "#endif //#ifndef FIN_OP_SUPER_H\n");
+    fclose(fp);
+}
+
+#undef FIN_VM_HOOK
+#define FIN_VM_HOOK() fin_vm_train_record(ip)
+
+#endif //#if FIN_VM_TRAIN
+
+#if FIN_VM_PROFILE
+    #undef  FIN_VM_OP_HOOK
+    #define FIN_VM_OP_HOOK(op) fin_vm_profile_record(&vm->profile, op)
+#endif
+
+// Threaded code dispatches through the handlers of its cells, the table of
+// the stack loop is published by fin_vm_link instead.
+#if FIN_VM_THREADED
+    #undef  FIN_VM_DISPATCH
+    #define FIN_VM_DISPATCH() goto *(ip++)->handler
+    #undef  FIN_VM_TABLE
+    #define FIN_VM_TABLE(...)
+#endif
+
+// Suspends the fiber of vm once a native asked to, see fin_vm_yield. The
+// interpreter returns, fin_vm_resume continues it with the next instruction,
+// or with a return when the native was called in tail position.
+#define FIN_VM_SUSPEND(slot, ret) if (vm->yield) {                     \
+        vm->yield            = false;                                   \
+        vm->suspended        = true;                                    \
+        vm->resume.ip        = ip;                                      \
+        vm->resume.stack     = stack;                                   \
+        vm->resume.top       = top;                                     \
+        vm->resume.res       = (slot);                                  \
+        vm->resume.func      = func;                                    \
+        vm->resume.returning = (ret);                                   \
+        return;                                                         \
+    }
+
+// Parks at a back edge or a call while a collection waits for the vm.
+#define FIN_VM_SAFEPOINT()                                              \
+    if (__atomic_load_n(vm->gc_stop, __ATOMIC_RELAXED))                 \
+        fin_gc_safepoint(vm->ctx)
+
+// Counts a back edge or a call against the slice of a fiber. Once it runs out
+// the fiber suspends before the next instruction, unless a nested run of
+// script code can't return to the host, which starts a new slice instead.
+#define FIN_VM_TICK() do {                                              \
+        FIN_VM_SAFEPOINT();                                             \
+        if (vm->ticks && --vm->ticks == 0) {                            \
+            vm->ticks = vm->slice;                                      \
+            vm->yield = vm->nested == 1;                                \
+            FIN_VM_SUSPEND(NULL, false);                                \
+        }                                                               \
+    } while (0)
+
+// Takes the branch at ip, counting it against the slice when backward.
+#define FIN_VM_BRANCH(ip) {                                             \
+        bool back = FIN_VM_BACK(ip);                                    \
+        FIN_VM_LOOP(ip);                                                \
+        FIN_VM_JUMP(ip);                                                \
+        if (back)                                                       \
+            FIN_VM_TICK();                                              \
+    }
+
+// Saves the caller in a new frame and continues in the callee. The caller
+// resumes at ip + operands with the args of the call replaced by the result.
+// A callee whose locals and operands don't fit in the current segment of the
+// value stack, or that runs as machine code, is called through
+// fin_vm_jit_call instead.
+#define FIN_VM_ENTER(callee, operands, code, nargs, nlocals, nret, nsize) { \
+        FIN_VM_COUNT(callee, calls, FIN_VM_TIER_CALLS);                 \
+        if (top + (nsize) > vm->stack.end || FIN_VM_JITTED(callee)) {   \
+            fin_vm_jit_call(vm, callee, top);                           \
+            top += (nret) - (nargs);                                    \
+            ip  += (operands);                                          \
+        }                                                               \
+        else {                                                          \
+            if (vm->frame == vm->frames_end)                            \
+                fin_vm_grow_frames(vm);                                 \
+            fin_vm_frame_t* frame = vm->frame++;                        \
+            frame->ip    = ip + (operands);                             \
+            frame->args  = args;                                        \
+            frame->stack = stack;                                       \
+            frame->top   = top - (nargs) + (nret);                      \
+            frame->mod   = mod;                                         \
+            frame->func  = func;                                        \
+            func  = callee;                                             \
+            mod   = func->mod;                                          \
+            vm->func = func;                                            \
+            args  = top - (nargs);                                      \
+            stack = top;                                                \
+            top   = stack + (nlocals);                                  \
+            ip    = code;                                               \
+            FIN_VM_TICK();                                              \
+        }                                                               \
+    }
+
+// Script to script calls and returns stay within one loop, using the frames
+// of the vm. The loop returns when the function it was entered with does.
+// Called with a NULL func by fin_vm_link to publish the handler addresses.
+void fin_vm_interpret(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* stack) {
+#if FIN_VM_THREADED
+    if (!func) {
+        static void* handlers[] = { FIN_VM_LABELS };
+        fin_vm_handlers = handlers;
+        return;
+    }
+#endif
+    int32_t         base  = (int32_t)(vm->frame - vm->frames);
+    fin_mod_t*      mod   = func->mod;
+    fin_val_t*      args  = stack - func->args;
+    fin_val_t*      top   = stack + func->locals;
+    fin_vm_ip_t     ip    = FIN_VM_CODE(func);
+
+    if (vm->suspended) {
+        // Resumed by fin_vm_resume with the func and stack of the innermost
+        // frame, the caller frames are still in place.
+        vm->suspended = false;
+        base = 0;
+        top  = vm->resume.top;
+        ip   = vm->resume.ip;
+        if (vm->resume.returning)
+            goto fin_op_return;
+    }
+
+    FIN_VM_LOOP_BEGIN(FIN_VM_LABELS) {
+        FIN_VM_STEP(load_const)
+        FIN_VM_STEP(load_arg)
+        FIN_VM_STEP(store_arg)
+        FIN_VM_STEP(load_local)
+        FIN_VM_STEP(store_local)
+        FIN_VM_STEP(load_field)
+        FIN_VM_STEP(store_field)
+        FIN_VM_OP(fin_op_call) {
+            fin_mod_func_t* callee = FIN_VM_FUNC(ip);
+            if (callee->is_native || callee->is_reg) {
+                FIN_VM_EXEC(call);
+                FIN_VM_SUSPEND(callee->ret_type ? top - 1 : NULL, false);
+            }
+            else
+                FIN_VM_ENTER(callee, FIN_VM_OPERANDS(call), FIN_VM_CODE(callee), callee->args, callee->locals, callee->ret_type ? 1 : 0, callee->locals + callee->stack);
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_load_arg) {
-            *top++ = args[*ip++];
+        FIN_VM_OP(fin_op_branch) {
+            FIN_VM_BRANCH(ip);
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_store_arg) {
-            args[*ip++] = *--top;
+        FIN_VM_OP(fin_op_branch_if) {
+            if ((--top)->b)
+                FIN_VM_BRANCH(ip)
+            else
+                ip += FIN_VM_OPERANDS(branch_if);
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_load_local) {
-            *top++ = stack[*ip++];
+        FIN_VM_OP(fin_op_branch_if_n) {
+            if ((--top)->b)
+                ip += FIN_VM_OPERANDS(branch_if_n);
+            else
+                FIN_VM_JUMP(ip);
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_store_local) {
-            stack[*ip++] = *--top;
+        FIN_VM_OP(fin_op_tail_call) {
+            fin_mod_func_t* callee = FIN_VM_FUNC(ip);
+            FIN_VM_COUNT(callee, calls, FIN_VM_TIER_CALLS);
+            if (callee->is_native || callee->is_reg || FIN_VM_JITTED(callee) ||
+                args + callee->args + callee->locals + callee->stack > vm->stack.end) {
+                top = fin_vm_exec_call(vm, mod, args, stack, top, ip);
+                FIN_VM_SUSPEND(callee->ret_type ? top - 1 : NULL, true);
+                goto fin_op_return;
+            }
+            // Reuse the frame, the result still goes to args[0].
+            fin_val_t* src = top - callee->args;
+            for (int32_t i=0; i<callee->args; i++)
+                args[i] = src[i];
+            func  = callee;
+            mod   = func->mod;
+            vm->func = func;
+            stack = args + func->args;
+            top   = stack + func->locals;
+            ip    = FIN_VM_CODE(func);
+            FIN_VM_TICK();
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_load_field) {
-            if (top[-1].o)
-                top[-1] = top[-1].o->fields[*ip++];
+        FIN_VM_OP(fin_op_return) {
+            if (func->ret_type)
+                args[0] = top[-1];
+            if (vm->frame == vm->frames + base)
+                return;
+            fin_vm_frame_t* frame = --vm->frame;
+            ip    = frame->ip;
+            args  = frame->args;
+            stack = frame->stack;
+            top   = frame->top;
+            mod   = frame->mod;
+            func  = frame->func;
+            vm->func = func;
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_store_field) {
-            if (top[-2].o)
-                top[-2].o->fields[*ip++] = top[-1];
-            top -= 2;
+        FIN_VM_STEP(pop)
+        FIN_VM_STEP(new)
+        FIN_VM_OP(fin_op_wide) {
+#if !FIN_VM_THREADED
+            // Threaded code decodes wide operands at link time.
+            fin_op_t op = (fin_op_t)*ip++;
+            uint32_t x = ip[0] | ip[1] << 8;
+            if (fin_vm_op_sizes[op] == 2)
+                x |= ip[2] << 16 | (uint32_t)ip[3] << 24;
+            ip += 2 * fin_vm_op_sizes[op];
+            bool back = false;
+            switch (op) {
+                case fin_op_load_const:  *top++ = mod->consts[x];       break;
+                case fin_op_load_local:  *top++ = stack[x];             break;
+                case fin_op_store_local: stack[x] = *--top;             break;
+                case fin_op_branch:      ip += (int32_t)x; back = (int32_t)x < 0; break;
+                case fin_op_branch_if:   if ((--top)->b) { ip += (int32_t)x; back = (int32_t)x < 0; } break;
+                case fin_op_branch_if_n: if (!(--top)->b) ip += (int32_t)x; break;
+                default:                 assert(0);
+            }
+            if (back)
+                FIN_VM_TICK();
+#endif
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_call) {
+
+        FIN_OP_UNARY_LIST(FIN_VM_STEP_EXPR)
+        FIN_OP_BINARY_LIST(FIN_VM_STEP_EXPR)
+
+        FIN_OP_SUPER2_LIST(FIN_VM_SUPER2)
+        FIN_OP_SUPER3_LIST(FIN_VM_SUPER3)
+        FIN_OP_SUPER4_LIST(FIN_VM_SUPER4)
+
+#if FIN_VM_THREADED
+        FIN_OP_CALL_NATIVE_LIST(FIN_VM_CALL_NATIVE)
+        FIN_VM_OP(fin_op_call_script) {
+            fin_vm_sig_t sig = ip[1].sig;
+            FIN_VM_ENTER(ip[2].func, 3, ip[0].code, sig.args, sig.locals, sig.ret, sig.size);
+            FIN_VM_NEXT();
+        }
+#endif
+    }
+    FIN_VM_LOOP_END();
+}
+
+#undef  FIN_VM_HOOK
+#define FIN_VM_HOOK()
+#undef  FIN_VM_OP_HOOK
+#if FIN_VM_PROFILE
+    #define FIN_VM_OP_HOOK(op) fin_vm_profile_record(&vm->profile, fin_op_count + op)
+#else
+    #define FIN_VM_OP_HOOK(op)
+#endif
+#if FIN_VM_THREADED
+    #undef  FIN_VM_DISPATCH
+    #define FIN_VM_DISPATCH() goto *goto_table[*ip++]
+    #undef  FIN_VM_TABLE
+    #define FIN_VM_TABLE(...) static void* goto_table[] = { __VA_ARGS__ };
+#endif
+
+void fin_vm_interpret_reg(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* stack) {
+    fin_ctx_t*       ctx    = vm->ctx;
+    fin_mod_t*       mod    = func->mod;
+    const fin_val_t* consts = mod->consts;
+    fin_val_t*       regs   = stack - func->args;
+    uint8_t*         ip     = func->code;
+
+    FIN_VM_LOOP_BEGIN(FIN_VM_REG_LABELS) {
+        FIN_VM_OP(fin_reg_op_move) {
+            regs[ip[0]] = FIN_VM_RK(ip[1]);
+            ip += 2;
+            FIN_VM_NEXT();
+        }
+        FIN_VM_OP(fin_reg_op_load_k) {
+            uint8_t dst = *ip++;
+            int32_t idx = *ip++;
+            idx |= *ip++ << 8;
+            regs[dst] = consts[idx];
+            FIN_VM_NEXT();
+        }
+        FIN_VM_OP(fin_reg_op_load_field) {
+            fin_obj_t* obj = regs[ip[1]].o;
+            regs[ip[0]] = obj ? obj->fields[ip[2]] : regs[ip[1]];
+            ip += 3;
+            FIN_VM_NEXT();
+        }
+        FIN_VM_OP(fin_reg_op_store_field) {
+            fin_obj_t* obj = regs[ip[0]].o;
+            if (obj)
+                obj->fields[ip[1]] = FIN_VM_RK(ip[2]);
+            ip += 3;
+            FIN_VM_NEXT();
+        }
+        FIN_VM_OP(fin_reg_op_call) {
+            uint8_t base = *ip++;
             int32_t idx = *ip++;
             idx |= *ip++ << 8;
             fin_mod_func_t* func = mod->binds[idx].func;
-            fin_vm_invoke_int(ctx, func, top);
-            top -= func->args - (func->ret_type ? 1 : 0);
+            fin_vm_jit_call(vm, func, regs + base + func->args);
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_branch) {
+        FIN_VM_OP(fin_reg_op_tail_call) {
+            uint8_t base = ip[0];
+            fin_mod_func_t* callee = mod->binds[ip[1] | ip[2] << 8].func;
+            if (!callee->is_reg || regs + callee->args + callee->locals > vm->stack.end) {
+                fin_vm_invoke_int(vm, callee, regs + base + callee->args);
+                regs[0] = regs[base];
+                return;
+            }
+            for (int32_t i=0; i<callee->args; i++)
+                regs[i] = regs[base + i];
+            vm->func = callee;
+            mod    = callee->mod;
+            consts = mod->consts;
+            ip     = callee->code;
+            FIN_VM_SAFEPOINT();
+            FIN_VM_NEXT();
+        }
+        FIN_VM_OP(fin_reg_op_branch) {
             int16_t offset = *ip++;
             offset |= *ip++ << 8;
             ip += offset;
+            if (offset < 0)
+                FIN_VM_SAFEPOINT();
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_branch_if) {
-            if ((--top)->b) {
-                int16_t offset = *ip++;
-                offset |= *ip++ << 8;
-                ip += offset;
+        FIN_VM_OP(fin_reg_op_branch_if) {
+            if (FIN_VM_RK(ip[0]).b) {
+                int16_t offset = ip[1] | ip[2] << 8;
+                ip += 3 + offset;
+                if (offset < 0)
+                    FIN_VM_SAFEPOINT();
             } else
-                ip += 2;
+                ip += 3;
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_branch_if_n) {
-            if ((--top)->b)
-                ip += 2;
+        FIN_VM_OP(fin_reg_op_branch_if_n) {
+            if (FIN_VM_RK(ip[0]).b)
+                ip += 3;
             else {
-                int16_t offset = *ip++;
-                offset |= *ip++ << 8;
-                ip += offset;
+                int16_t offset = ip[1] | ip[2] << 8;
+                ip += 3 + offset;
+                if (offset < 0)
+                    FIN_VM_SAFEPOINT();
             }
             FIN_VM_NEXT();
         }
-        FIN_VM_OP(fin_op_return) {
-            if (func->ret_type)
-                args[0] = top[-1];
+        FIN_VM_OP(fin_reg_op_return) {
+            regs[0] = FIN_VM_RK(ip[0]);
             return;
         }
-        FIN_VM_OP(fin_op_pop) {
-            top--;
-            FIN_VM_NEXT();
+        FIN_VM_OP(fin_reg_op_return_v) {
+            return;
         }
-        FIN_VM_OP(fin_op_new) {
-            top -= *ip;
-            top->o = fin_obj_create(ctx->alloc, top, *ip);
-            top++;
-            ip++;
+        FIN_VM_OP(fin_reg_op_new) {
+            regs[ip[0]].o = fin_obj_create(vm, mod->obj_types[ip[2] | ip[3] << 8], regs + ip[1]);
+            ip += 4;
             FIN_VM_NEXT();
         }
+        FIN_OP_UNARY_LIST(FIN_VM_REG_UNARY)
+        FIN_OP_BINARY_LIST(FIN_VM_REG_BINARY)
     }
     FIN_VM_LOOP_END();
 }
 
+#if FIN_VM_THREADED
+
+#define FIN_VM_LINK_CALL(op, args, ret) { fin_op_##op, args, ret },
+
+static const struct {
+    fin_op_t op;
+    int32_t  args;
+    bool     ret;
+} fin_vm_link_calls[] = {
+    FIN_OP_CALL_NATIVE_LIST(FIN_VM_LINK_CALL)
+};
+
+#undef FIN_VM_LINK_CALL
+
+// Bytes taken by the instruction at code, wide ones included.
+static int32_t fin_vm_link_length(const uint8_t* code) {
+    if (code[0] == fin_op_wide)
+        return 2 + 2 * fin_vm_op_sizes[code[1]];
+    return 1 + fin_vm_op_sizes[fin_vm_op_base[code[0]]];
+}
+
+// The threaded form of the instruction at code, with its operand cell count.
+// A wide instruction links to the cells of its short form.
+static fin_op_t fin_vm_link_op(fin_mod_t* mod, const uint8_t* code, int32_t* operands) {
+    if (code[0] == fin_op_wide)
+        code++;
+    fin_op_t op = (fin_op_t)code[0];
+    *operands = fin_vm_op_sizes[fin_vm_op_base[op]] ? 1 : 0;
+    if (op != fin_op_call)
+        return op;
+
+    fin_mod_func_t* func = mod->binds[code[1] | code[2] << 8].func;
+    if (func->is_native) {
+        for (int32_t i=0; i<FIN_COUNT_OF(fin_vm_link_calls); i++) {
+            if (fin_vm_link_calls[i].args == func->args && fin_vm_link_calls[i].ret == (func->ret_type != NULL))
+                return fin_vm_link_calls[i].op;
+        }
+    }
+    else if (!func->is_reg) {
+        *operands = 3;
+        return fin_op_call_script;
+    }
+    return op;
+}
+
+static int32_t fin_vm_link_map(fin_mod_func_t* func, int32_t* cell_at) {
+    int32_t cells = 0;
+    for (int32_t pos = 0; pos < func->code_length; pos += fin_vm_link_length(func->code + pos)) {
+        int32_t operands;
+        fin_vm_link_op(func->mod, func->code + pos, &operands);
+        if (cell_at)
+            cell_at[pos] = cells;
+        cells += 1 + operands;
+    }
+    if (cell_at)
+        cell_at[func->code_length] = cells;
+    return cells;
+}
+
+static void fin_vm_link_func(fin_ctx_t* ctx, fin_mod_func_t* func) {
+    fin_mod_t* mod = func->mod;
+    const uint8_t* code = func->code;
+    int32_t* cell_at = (int32_t*)ctx->alloc(NULL, sizeof(int32_t) * (func->code_length + 1));
+    fin_vm_link_map(func, cell_at);
+
+    fin_vm_cell_t* cell = func->cells;
+    for (int32_t pos = 0; pos < func->code_length; pos += fin_vm_link_length(code + pos)) {
+        int32_t operands;
+        fin_op_t op = fin_vm_link_op(mod, code + pos, &operands);
+        bool wide = code[pos] == fin_op_wide;
+        const uint8_t* bytes = code + pos + (wide ? 2 : 1);
+        int32_t size = fin_vm_op_sizes[fin_vm_op_base[op]] << (wide ? 1 : 0);
+        uint32_t x = 0;
+        for (int32_t i=0; i<size; i++)
+            x |= (uint32_t)bytes[i] << (i * 8);
+        (cell++)->handler = fin_vm_handlers[op];
+        if (op >= fin_op_call_native_0 && op <= fin_op_call_script) {
+            fin_mod_func_t* target = mod->binds[x].func;
+            if (op == fin_op_call_script) {
+                (cell++)->code = target->cells;
+                cell->sig.args = target->args;
+                cell->sig.locals = target->locals;
+                cell->sig.ret = target->ret_type ? 1 : 0;
+                cell->sig.size = target->locals + target->stack;
+                cell++;
+                (cell++)->func = target;
+            }
+            else
+                (cell++)->native = target->func;
+            continue;
+        }
+        switch (fin_vm_op_base[op]) {
+            case fin_op_load_const:
+                (cell++)->k = &mod->consts[x];
+                break;
+            case fin_op_new:
+                (cell++)->type = mod->obj_types[x];
+                break;
+            case fin_op_call:
+            case fin_op_tail_call:
+                (cell++)->func = mod->binds[x].func;
+                break;
+            case fin_op_branch:
+            case fin_op_branch_if:
+            case fin_op_branch_if_n:
+                (cell++)->target = func->cells + cell_at[bytes + size - code + (wide ? (int32_t)x : (int16_t)x)];
+                break;
+            default:
+                if (operands)
+                    (cell++)->n = x;
+                break;
+        }
+    }
+    assert(cell == func->cells + cell_at[func->code_length]);
+    ctx->alloc(cell_at, 0);
+}
+
+#endif //#if FIN_VM_THREADED
+
+// Translates the stack code of every function in mod to threaded cells. Runs
+// once the binds of mod are resolved. All cells are allocated up front, so
+// that calls within the module can refer to the code of their target.
+void fin_vm_link(fin_ctx_t* ctx, fin_mod_t* mod) {
+#if FIN_VM_THREADED
+    if (!fin_vm_handlers)
+        fin_vm_interpret(NULL, NULL, NULL);
+
+    for (int32_t i=0; i<mod->funcs_count; i++) {
+        fin_mod_func_t* func = &mod->funcs[i];
+        if (!func->is_native && !func->is_reg)
+            func->cells = (fin_vm_cell_t*)ctx->alloc(NULL, sizeof(fin_vm_cell_t) * fin_vm_link_map(func, NULL));
+    }
+    for (int32_t i=0; i<mod->funcs_count; i++) {
+        fin_mod_func_t* func = &mod->funcs[i];
+        if (!func->is_native && !func->is_reg)
+            fin_vm_link_func(ctx, func);
+    }
+#endif
+    fin_aot_link(ctx, mod);
+    if (ctx->vm_mode == fin_vm_mode_jit) {
+        for (int32_t i=0; i<mod->funcs_count; i++) {
+            fin_mod_func_t* func = &mod->funcs[i];
+            if (!func->is_native && !func->is_reg && !func->jit)
+                fin_jit_compile(ctx, func);
+        }
+    }
+}
+
+static fin_vm_seg_t* fin_vm_seg_create(fin_ctx_t* ctx, fin_vm_seg_t* seg, int32_t size) {
+    if (size < FIN_VM_SEG_SIZE)
+        size = FIN_VM_SEG_SIZE;
+    seg = (fin_vm_seg_t*)ctx->alloc(seg, sizeof(fin_vm_seg_t) + sizeof(fin_val_t) * size);
+    seg->end = seg->storage + size;
+    memset(seg->storage, 0, sizeof(fin_val_t) * size);
+    return seg;
+}
+
 fin_vm_t* fin_vm_create(fin_ctx_t* ctx) {
     fin_vm_t* vm = (fin_vm_t*)ctx->alloc(NULL, sizeof(fin_vm_t));
-    vm->stack.top   = vm->stack.storage;
-    vm->stack.begin = vm->stack.storage;
-    vm->stack.end   = vm->stack.storage + FIN_COUNT_OF(vm->stack.storage);
+    vm->stack.first = fin_vm_seg_create(ctx, NULL, FIN_VM_SEG_SIZE);
+    vm->stack.first->next = NULL;
+    vm->stack.seg   = vm->stack.first;
+    vm->stack.end   = vm->stack.first->end;
+    vm->frames      = (fin_vm_frame_t*)ctx->alloc(NULL, sizeof(fin_vm_frame_t) * ctx->max_frames);
+    vm->frames_end  = vm->frames + ctx->max_frames;
+    vm->frame       = vm->frames;
+    vm->func        = NULL;
+    vm->nested      = 0;
+    vm->slice       = 0;
+    vm->ticks       = 0;
+    vm->fiber       = false;
+    vm->yield       = false;
+    vm->suspended   = false;
+    vm->moving      = false;
+    memset(vm->frames, 0, sizeof(fin_vm_frame_t) * ctx->max_frames);
+#if FIN_VM_PROFILE
+    memset(&vm->profile, 0, sizeof(fin_vm_profile_t));
+    vm->profile.last = -1;
+#endif
     vm->ctx = ctx;
+    vm->heap = fin_gc_heap_create(ctx, vm);
+    vm->gc_stop = fin_gc_stopping(ctx);
+    return vm;
+}
+
+// A vm whose script code can suspend, running stack code in the interpreter
+// only. It is preempted after slice back edges and calls, never when 0.
+fin_vm_t* fin_vm_create_fiber(fin_ctx_t* ctx, int32_t slice) {
+    fin_vm_t* vm = fin_vm_create(ctx);
+    vm->fiber = true;
+    vm->slice = slice;
     return vm;
 }
 
 void fin_vm_destroy(fin_vm_t* vm) {
+#if FIN_VM_TRAIN
+    fin_vm_train_dump();
+#endif
+#if FIN_VM_PROFILE
+    fin_vm_profile_merge(&vm->profile);
+#endif
+    fin_gc_heap_destroy(vm->heap);
+    fin_vm_seg_t* seg = vm->stack.first;
+    while (seg) {
+        fin_vm_seg_t* next = seg->next;
+        vm->ctx->alloc(seg, 0);
+        seg = next;
+    }
+    vm->ctx->alloc(vm->frames, 0);
     vm->ctx->alloc(vm, 0);
 }
 
-inline void fin_vm_invoke_int(fin_ctx_t* ctx, fin_mod_func_t* func, fin_val_t* stack) {
+// Script functions run as machine code when jitted or translated ahead of
+// time, interpreted otherwise.
+static inline void fin_vm_run(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* stack) {
+    vm->func = func;
+    fin_jit_func_t machine = vm->fiber ? NULL : (fin_jit_func_t)FIN_VM_MACHINE(func);
+    if (machine)
+        machine(vm, stack - func->args, stack);
+    else if (func->is_reg)
+        fin_vm_interpret_reg(vm, func, stack);
+    else {
+        FIN_VM_COUNT(func, calls, FIN_VM_TIER_CALLS);
+        fin_vm_interpret(vm, func, stack);
+    }
+}
+
+// Runs func at the start of the next segment, growing it when the frame of
+// func does not fit. The args are copied over and the result copied back.
+void fin_vm_invoke_seg(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* stack) {
+    fin_ctx_t* ctx = vm->ctx;
+    fin_vm_seg_t* seg = vm->stack.seg;
+    fin_vm_seg_t* next = seg->next;
+    int32_t size = func->args + func->locals + func->stack;
+    if (!next || next->end - next->storage < size) {
+        fin_vm_seg_t* after = next ? next->next : NULL;
+        next = fin_vm_seg_create(ctx, next, size);
+        next->next = after;
+        seg->next = next;
+    }
+
+    fin_val_t* args = stack - func->args;
+    for (int32_t i=0; i<func->args; i++)
+        next->storage[i] = args[i];
+
+    vm->stack.seg = next;
+    vm->stack.end = next->end;
+    fin_vm_run(vm, func, next->storage + func->args);
+    vm->stack.seg = seg;
+    vm->stack.end = seg->end;
+
+    if (func->ret_type)
+        args[0] = next->storage[0];
+}
+
+inline void fin_vm_invoke_int(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* stack) {
     if (func->is_native) {
         fin_val_t result;
-        (*func->func)(ctx, stack - func->args, &result);
+        (*func->func)(vm->ctx, stack - func->args, &result);
         if (func->ret_type)
             stack[-func->args] = result;
     }
-    else
-        fin_vm_interpret(ctx, func, stack);
+    else {
+        fin_mod_func_t* caller = vm->func;
+        vm->nested++;
+        if (stack + func->locals + func->stack > vm->stack.end)
+            fin_vm_invoke_seg(vm, func, stack);
+        else
+            fin_vm_run(vm, func, stack);
+        vm->nested--;
+        vm->func = caller;
+    }
 }
 
 void fin_vm_invoke(fin_vm_t* vm, fin_mod_func_t* func) {
-    fin_vm_invoke_int(vm->ctx, func, vm->stack.top);
-    assert(vm->stack.top == vm->stack.begin);
+    fin_vm_t* outer = fin_vm_running;
+    fin_vm_running = vm;
+    fin_gc_enter(vm->ctx, &outer);
+    fin_vm_invoke_int(vm, func, vm->stack.first->storage + func->args);
+    fin_gc_leave(vm->ctx);
+    fin_vm_running = outer;
+}
+
+// Invokes func with args. False when the fiber of vm suspended before func
+// returned, otherwise res takes the result unless NULL.
+bool fin_vm_call(fin_vm_t* vm, fin_mod_func_t* func, const fin_val_t* args, fin_val_t* res) {
+    fin_vm_t* outer = fin_vm_running;
+    fin_vm_running = vm;
+    fin_gc_enter(vm->ctx, &outer);
+    fin_val_t* storage = vm->stack.first->storage;
+    for (int32_t i=0; i<func->args; i++)
+        storage[i] = args[i];
+    vm->ticks = vm->slice;
+    fin_vm_invoke_int(vm, func, storage + func->args);
+    bool done = !vm->suspended;
+    if (done && res)
+        *res = storage[0];
+    fin_gc_leave(vm->ctx);
+    fin_vm_running = outer;
+    return done;
+}
+
+// Continues a suspended fiber, value replaces the result of the native that
+// suspended it unless NULL. Returns as fin_vm_call.
+bool fin_vm_resume(fin_vm_t* vm, const fin_val_t* value, fin_val_t* res) {
+    assert(vm->suspended);
+    fin_vm_t* outer = fin_vm_running;
+    fin_vm_running = vm;
+    fin_gc_enter(vm->ctx, &outer);
+    if (value && vm->resume.res)
+        *vm->resume.res = *value;
+    fin_mod_func_t* func = vm->resume.func;
+    vm->nested++;
+    vm->func = func;
+    vm->ticks = vm->slice;
+    fin_vm_interpret(vm, func, vm->resume.stack);
+    vm->nested--;
+    vm->func = NULL;
+    bool done = !vm->suspended;
+    if (done && res)
+        *res = vm->stack.first->storage[0];
+    fin_gc_leave(vm->ctx);
+    fin_vm_running = outer;
+    return done;
+}
+
+// Asks the fiber running on this thread to suspend when the calling native
+// returns. False outside of fibers, and when the native was not called by
+// the outermost interpreter loop of the fiber, which is the only one that
+// can save its state.
+bool fin_vm_yield(fin_ctx_t* ctx) {
+    fin_vm_t* vm = fin_vm_running;
+    if (!vm || vm->ctx != ctx || !vm->fiber || vm->nested != 1)
+        return false;
+    vm->yield = true;
+    return true;
+}
+
+fin_vm_t* fin_vm_current() {
+    return fin_vm_running;
+}
+
+fin_gc_heap_t* fin_vm_heap(fin_vm_t* vm) {
+    return vm->heap;
+}
+
+// Passes every slot of the value stack of vm to visit, the collector finds
+// the objects among them.
+void fin_vm_roots(fin_vm_t* vm, void (*visit)(void* arg, const fin_val_t* vals, int32_t count), void* arg) {
+    for (fin_vm_seg_t* seg = vm->stack.first; seg; seg = seg->next)
+        visit(arg, seg->storage, (int32_t)(seg->end - seg->storage));
+}
+
+// The script functions on the call stack of vm, innermost first. Frames are
+// only read, so that a signal handler can walk the vm it interrupted.
+int32_t fin_vm_walk(fin_vm_t* vm, fin_mod_func_t** funcs, int32_t count) {
+    int32_t n = 0;
+    if (vm->func && n < count)
+        funcs[n++] = vm->func;
+    if (vm->moving)
+        return n;
+    for (fin_vm_frame_t* frame = vm->frame - 1; frame >= vm->frames && n < count; frame--) {
+        if (frame->func)
+            funcs[n++] = frame->func;
+    }
+    return n;
+}
+
+// A script call made by jitted code or the register interpreter, counted
+// against the frames of the vm, and a safepoint.
+void fin_vm_jit_call(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* top) {
+    FIN_VM_SAFEPOINT();
+    if (vm->frame == vm->frames_end)
+        fin_vm_grow_frames(vm);
+    fin_vm_frame_t* frame = vm->frame++;
+    frame->func = vm->func;
+    fin_vm_invoke_int(vm, func, top);
+    vm->frame--;
+}
+
+fin_val_t* fin_vm_jit_new(fin_vm_t* vm, fin_val_t* top, const fin_obj_type_t* type) {
+    top -= type->fields_count;
+    top->o = fin_obj_create(vm, type, top);
+    return top + 1;
+}
+
+#define FIN_VM_JIT_EXEC(op, res, expr, sign) case fin_op_##op: return fin_vm_exec_##op(vm, NULL, NULL, NULL, top, NULL);
+
+// Instructions that jitted code leaves to the interpreter.
+fin_val_t* fin_vm_jit_exec(fin_vm_t* vm, fin_val_t* top, int32_t op) {
+    switch (op) {
+        FIN_OP_UNARY_LIST(FIN_VM_JIT_EXEC)
+        FIN_OP_BINARY_LIST(FIN_VM_JIT_EXEC)
+    }
+    assert(false);
+    return top;
+}
+
+#undef FIN_VM_JIT_EXEC
+
+// Writes the handlers run since the last report, busiest first, and starts
+// over. Covers the vms destroyed since then and the vm running on the calling
+// thread. Does nothing unless built with FIN_VM_PROFILE.
+void fin_vm_profile_dump(FILE* fp) {
+#if FIN_VM_PROFILE
+    if (fin_vm_running)
+        fin_vm_profile_merge(&fin_vm_running->profile);
+    int32_t ops[FIN_VM_PROFILE_OPS];
+    uint64_t op_counts[FIN_VM_PROFILE_OPS];
+    uint64_t op_cycles[FIN_VM_PROFILE_OPS];
+    uint64_t counts = 0;
+    uint64_t cycles = 0;
+    for (int32_t op=0; op<FIN_VM_PROFILE_OPS; op++) {
+        ops[op] = op;
+        op_counts[op] = __atomic_exchange_n(&fin_vm_profile_counts[op], 0, __ATOMIC_RELAXED);
+        op_cycles[op] = __atomic_exchange_n(&fin_vm_profile_cycles[op], 0, __ATOMIC_RELAXED);
+        counts += op_counts[op];
+        cycles += op_cycles[op];
+    }
+    fin_vm_profile_scores = FIN_VM_PROFILE_CYCLES ? op_cycles : op_counts;
+    qsort(ops, FIN_VM_PROFILE_OPS, sizeof(int32_t), &fin_vm_profile_compare);
+
+    fprintf(fp, "%-40s %14s %7s", "op", "count", "%");
+    if (FIN_VM_PROFILE_CYCLES)
+        fprintf(fp, " %16s %7s %10s", "cycles", "%", "per op");
+    fprintf(fp, "\n");
+    for (int32_t i=0; i<FIN_VM_PROFILE_OPS; i++) {
+        int32_t op = ops[i];
+        uint64_t count = op_counts[op];
+        if (!count)
+            continue;
+        const char* name = op < fin_op_count ? fin_vm_op_names[op] : fin_vm_reg_op_names[op - fin_op_count];
+        fprintf(fp, "%-40s %14llu %6.2f%%", name, (unsigned long long)count, 100.0 * count / counts);
+        if (FIN_VM_PROFILE_CYCLES)
+            fprintf(fp, " %16llu %6.2f%% %10.1f", (unsigned long long)op_cycles[op],
+                    cycles ? 100.0 * op_cycles[op] / cycles : 0.0, (double)op_cycles[op] / count);
+        fprintf(fp, "\n");
+    }
+#endif
 }
@@ -7,12 +7,31 @@
 #define FIN_VM_H
 
 #include <fin/fin.h>
+#include <stdio.h>
 
 typedef struct fin_vm_t       fin_vm_t;
 typedef struct fin_mod_func_t fin_mod_func_t;
+typedef struct fin_mod_t      fin_mod_t;
+typedef struct fin_gc_heap_t  fin_gc_heap_t;
+typedef struct fin_obj_type_t fin_obj_type_t;
 
 fin_vm_t* fin_vm_create(fin_ctx_t* ctx);
+fin_vm_t* fin_vm_create_fiber(fin_ctx_t* ctx, int32_t slice);
 void      fin_vm_destroy(fin_vm_t* vm);
 void      fin_vm_invoke(fin_vm_t* vm, fin_mod_func_t* func);
+bool      fin_vm_call(fin_vm_t* vm, fin_mod_func_t* func, const fin_val_t* args, fin_val_t* res);
+bool      fin_vm_resume(fin_vm_t* vm, const fin_val_t* value, fin_val_t* res);
+bool      fin_vm_yield(fin_ctx_t* ctx);
+fin_vm_t* fin_vm_current();
+fin_gc_heap_t* fin_vm_heap(fin_vm_t* vm);
+void      fin_vm_roots(fin_vm_t* vm, void (*visit)(void* arg, const fin_val_t* vals, int32_t count), void* arg);
+void      fin_vm_link(fin_ctx_t* ctx, fin_mod_t* mod);
+void      fin_vm_profile_dump(FILE* fp);
+int32_t   fin_vm_walk(fin_vm_t* vm, fin_mod_func_t** funcs, int32_t count);
+
+// Entry points of jitted and translated code back into the vm.
+void       fin_vm_jit_call(fin_vm_t* vm, fin_mod_func_t* func, fin_val_t* top);
+fin_val_t* fin_vm_jit_new(fin_vm_t* vm, fin_val_t* top, const fin_obj_type_t* type);
+fin_val_t* fin_vm_jit_exec(fin_vm_t* vm, fin_val_t* top, int32_t op);
 
 #endif //#ifndef FIN_VM_H
@@ -0,0 +1,20 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#include "fin_fiber.h"
+#include "../fin_mod.h"
+
+// Hands control back to the host resuming the fiber, a no-op outside fibers.
+static void fin_fiber_yield(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* res) {
+    fin_ctx_yield(ctx);
+}
+
+void fin_fiber_register(fin_ctx_t* ctx) {
+    fin_mod_func_desc_t descs[] = {
+        { "void Yield()", &fin_fiber_yield },
+    };
+
+    fin_mod_create(ctx, "fiber", descs, FIN_COUNT_OF(descs));
+}
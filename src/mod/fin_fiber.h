@@ -0,0 +1,13 @@
+/*
+ * Copyright 2016-2017 Nikolay Aleksiev. All rights reserved.
+ * License: https://github.com/naleksiev/fin/blob/master/LICENSE
+ */
+
+#ifndef FIN_MOD_FIBER_H
+#define FIN_MOD_FIBER_H
+
+#include <fin/fin.h>
+
+void fin_fiber_register(fin_ctx_t* ctx);
+
+#endif //#ifndef FIN_MOD_FIBER_H
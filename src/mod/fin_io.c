@@ -4,6 +4,7 @@
  */
 
 #include "fin_io.h"
+#include "../fin_loop.h"
 #include "../fin_mod.h"
 #include <stdio.h>
 
@@ -16,14 +17,26 @@ static void fin_io_write_line(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t*
 }
 
 static void fin_io_file_write(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* ret) {
-    const char* file = fin_str_cstr(args[0].s);
-    if (!file)
-        return;
-    FILE* fp = fopen(file, "wb");
-    if (!fp)
-        return;
-    fputs(fin_str_cstr(args[1].s), fp);
-    fclose(fp);
+    fin_loop_file_write(ctx, args[0].s, args[1].s);
+}
+
+// The functions below suspend a fiber of the event loop calling them, see
+// fin_loop.h.
+
+static void fin_io_file_read(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* ret) {
+    fin_loop_file_read(ctx, args[0].s, ret);
+}
+
+static void fin_io_read(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* ret) {
+    fin_loop_read(ctx, (int32_t)args[0].i, ret);
+}
+
+static void fin_io_write_fd(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* ret) {
+    fin_loop_write(ctx, (int32_t)args[0].i, args[1].s, ret);
+}
+
+static void fin_io_sleep(fin_ctx_t* ctx, const fin_val_t* args, fin_val_t* ret) {
+    fin_loop_sleep(ctx, args[0].i);
 }
 
 void fin_io_register(fin_ctx_t* ctx) {
@@ -31,6 +44,10 @@ void fin_io_register(fin_ctx_t* ctx) {
         { "void Write(string)", &fin_io_write },
         { "void WriteLine(string)", &fin_io_write_line },
         { "void FileWrite(string,string)", &fin_io_file_write },
+        { "string FileRead(string)", &fin_io_file_read },
+        { "string Read(int)", &fin_io_read },
+        { "int Write(int,string)", &fin_io_write_fd },
+        { "void Sleep(int)", &fin_io_sleep },
     };
 
     fin_mod_create(ctx, "io", descs, FIN_COUNT_OF(descs));
@@ -4,12 +4,120 @@
  */
 
 #include <fin/fin.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+static fin_mod_func_t* compile_main(fin_ctx_t* ctx, const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* src = (char*)malloc(size + 1);
+    src[fread(src, 1, size, fp)] = '\0';
+    fclose(fp);
+    fin_mod_t* mod = fin_ctx_compile_str(ctx, src);
+    free(src);
+    return mod ? fin_ctx_find_func(ctx, mod, "Main()") : NULL;
+}
+
+static bool run_fiber(fin_ctx_t* ctx, const char* path) {
+    fin_mod_func_t* entry = compile_main(ctx, path);
+    fin_fiber_t* fiber = entry ? fin_fiber_create(ctx, entry, NULL) : NULL;
+    if (!fiber)
+        return false;
+    int32_t yields = 0;
+    while (!fin_fiber_resume(fiber, NULL, NULL))
+        yields++;
+    fin_fiber_destroy(fiber);
+    printf("yields: %d\n", yields);
+    return true;
+}
+
+// fin [-reg | -jit | -tiered] [-aot out.c | -load translation.so]
+//     [-sample out.folded] [-fiber | -loop] [-slice n] [file.fin...]
+// -fiber runs Main in a fiber, resuming it until it returns.
+// -loop runs the Main of every file at once on the event loop.
+// -slice preempts fibers after n back edges and calls.
 int main(int argc, const char* argv[]) {
-    fin_ctx_t* ctx = fin_ctx_create_default();
-    if (argc == 1)
+    fin_ctx_config_t config = { NULL, fin_vm_mode_stack, 0, 0 };
+    const char* aot_out = NULL;
+    const char* aot_load = NULL;
+    const char* sample_out = NULL;
+    bool fiber = false;
+    bool loop = false;
+    int32_t arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-reg") == 0)
+            config.vm_mode = fin_vm_mode_reg;
+        else if (strcmp(argv[arg], "-jit") == 0)
+            config.vm_mode = fin_vm_mode_jit;
+        else if (strcmp(argv[arg], "-tiered") == 0)
+            config.vm_mode = fin_vm_mode_tiered;
+        else if (strcmp(argv[arg], "-aot") == 0 && arg + 1 < argc)
+            aot_out = argv[++arg];
+        else if (strcmp(argv[arg], "-load") == 0 && arg + 1 < argc)
+            aot_load = argv[++arg];
+        else if (strcmp(argv[arg], "-sample") == 0 && arg + 1 < argc)
+            sample_out = argv[++arg];
+        else if (strcmp(argv[arg], "-fiber") == 0)
+            fiber = true;
+        else if (strcmp(argv[arg], "-loop") == 0)
+            loop = true;
+        else if (strcmp(argv[arg], "-slice") == 0 && arg + 1 < argc)
+            config.fiber_slice = atoi(argv[++arg]);
+    }
+    fin_ctx_t* ctx = fin_ctx_create_config(&config);
+    void* lib = NULL;
+    if (aot_load) {
+        lib = dlopen(aot_load, RTLD_NOW);
+        const fin_aot_module_t* aot = lib ? (const fin_aot_module_t*)dlsym(lib, "fin_aot_module") : NULL;
+        if (!aot) {
+            printf("Can't load %s\n", aot_load);
+            return 1;
+        }
+        fin_ctx_aot_register(ctx, aot);
+    }
+    if (sample_out && !fin_ctx_sample_start(ctx, 997)) {
+        printf("Can't sample to %s\n", sample_out);
+        return 1;
+    }
+    if (aot_out) {
+        if (arg == argc || !fin_ctx_aot_file(ctx, argv[arg], aot_out)) {
+            printf("Can't translate to %s\n", aot_out);
+            return 1;
+        }
+    }
+    else if (arg == argc)
         fin_ctx_eval_str(ctx, "void Main() { io.WriteLine(\"Hello, world!\"); }");
-    else
-        fin_ctx_eval_file(ctx, argv[1]);
+    else if (fiber) {
+        for (; arg < argc; arg++) {
+            if (!run_fiber(ctx, argv[arg])) {
+                printf("Can't run %s in a fiber\n", argv[arg]);
+                return 1;
+            }
+        }
+    }
+    else if (loop) {
+        for (; arg < argc; arg++) {
+            fin_mod_func_t* entry = compile_main(ctx, argv[arg]);
+            if (!entry || !fin_ctx_spawn(ctx, entry, NULL)) {
+                printf("Can't run %s on the loop\n", argv[arg]);
+                return 1;
+            }
+        }
+        fin_ctx_run(ctx);
+    }
+    else {
+        for (; arg < argc; arg++)
+            fin_ctx_eval_file(ctx, argv[arg]);
+    }
+    if (sample_out && !fin_ctx_sample_stop(ctx, sample_out))
+        printf("Can't write %s\n", sample_out);
     fin_ctx_destroy(ctx);
+    if (lib)
+        dlclose(lib);
 }